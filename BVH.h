@@ -0,0 +1,361 @@
+/**
+@file BVH.h
+@author JOL
+*/
+#pragma once
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include "BoundingBox.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "RenderStats.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A node of a BVH. Nodes are stored in depth-first order in one
+  /// array: the first child of an inner node immediately follows it.
+  struct BVHNode {
+    /// The bounding box of all primitives below this node.
+    BoundingBox box;
+    /// Leaf: index of its first primitive in BVH::indices().
+    /// Inner node: index of its second child.
+    int first;
+    /// Leaf: number of primitives (> 0). Inner node: 0.
+    int count;
+
+    bool isLeaf() const { return count > 0; }
+  };
+
+  /// A bounding volume hierarchy over a set of primitives given by
+  /// their bounding boxes. It is built with the surface area heuristic
+  /// (SAH) evaluated on bins, and flattened into a contiguous array of
+  /// nodes. It only knows primitives by their index, so it may be used
+  /// for graphical objects as well as for the parts of an object.
+  /// Traversals count visited nodes and primitives in RenderStats.
+  class BVH {
+  public:
+    /// Default maximal number of primitives in a leaf.
+    static const int MAX_LEAF_SIZE = 4;
+    /// Number of bins used to evaluate the SAH.
+    static const int NB_BINS = 16;
+    /// Maximal depth of the tree (and size of the traversal stack).
+    static const int MAX_DEPTH = 64;
+
+    /// Default constructor. The BVH is empty.
+    BVH() : ptrExternal( 0 ), myNbExternal( 0 ), myMaxLeafSize( MAX_LEAF_SIZE ) {}
+
+    /// Builds the hierarchy over the primitives of bounding boxes \a
+    /// boxes, with at most \a max_leaf_size primitives per leaf when
+    /// they can be separated.
+    void build( const std::vector< BoundingBox >& boxes,
+                int max_leaf_size = MAX_LEAF_SIZE )
+    {
+      int n = (int) boxes.size();
+      myMaxLeafSize = std::max( 1, max_leaf_size );
+      ptrExternal   = 0;
+      myNbExternal  = 0;
+      myNodes.clear();
+      myIndices.resize( n );
+      std::iota( myIndices.begin(), myIndices.end(), 0 );
+      if ( n == 0 ) return;
+      std::vector< Point3 > centers( n );
+      for ( int i = 0; i < n; ++i ) centers[ i ] = boxes[ i ].center();
+      myNodes.reserve( 2 * n / myMaxLeafSize + 1 );
+      buildNode( boxes, centers, 0, n, 0 );
+    }
+
+    /// Uses the \a nb_nodes nodes given by \a nodes (e.g. stored in a
+    /// mapped file) instead of building them. They are not copied and
+    /// must outlive the BVH. indices() is left empty, hence primitives
+    /// must be stored in the order of the leaves (see traverseLeaves).
+    void attach( const BVHNode* nodes, int nb_nodes )
+    {
+      myNodes.clear();
+      myIndices.clear();
+      ptrExternal  = nodes;
+      myNbExternal = nb_nodes;
+    }
+
+    /// @return 'true' if the BVH has no node.
+    bool empty() const { return size() == 0; }
+
+    /// @return the number of nodes.
+    int size() const { return ptrExternal ? myNbExternal : (int) myNodes.size(); }
+
+    /// @return the nodes in depth-first order (the root is the first one).
+    const BVHNode* data() const { return ptrExternal ? ptrExternal : myNodes.data(); }
+
+    /// @return the permutation of primitive indices referred to by leaves.
+    const std::vector< int >& indices() const { return myIndices; }
+
+    /// Visits the leaves met by \a ray, from near to far, and stops as
+    /// soon as the next node is further than the closest hit found so far.
+    ///
+    /// @param[in,out] tmax the distance to the closest hit (initially
+    /// the maximal distance of interest).
+    ///
+    /// @param f a functor called as `f( i, tmax )` for every primitive
+    /// \a i in a visited leaf. It must lower \a tmax when it finds a
+    /// closer hit. Setting \a tmax to a negative value stops the
+    /// traversal (remaining primitives of the current leaf are still
+    /// passed to \a f).
+    template <typename Intersector>
+    void traverse( const Ray& ray, Real& tmax, Intersector& f ) const
+    {
+      auto leaf = [&] ( int first, int count, Real& t ) {
+        for ( int k = first, kE = first + count; k < kE; ++k )
+          f( myIndices[ k ], t );
+      };
+      traverseLeaves( ray, tmax, leaf );
+    }
+
+    /// Same as traverse, but the functor is called once per leaf as
+    /// `f( first, count, tmax )`, where [first,first+count[ is the
+    /// range of the leaf in indices(). Useful when primitives are
+    /// stored in the order of indices(), e.g. for SIMD kernels.
+    template <typename LeafIntersector>
+    void traverseLeaves( const Ray& ray, Real& tmax, LeafIntersector& f ) const
+    {
+      if ( empty() ) return;
+      const BVHNode* nodes = data();
+      const Vector3 inv_dir( 1.0f / ray.direction[ 0 ],
+                             1.0f / ray.direction[ 1 ],
+                             1.0f / ray.direction[ 2 ] );
+      Real tnear;
+      if ( ! nodes[ 0 ].box.intersect( ray.origin, inv_dir, tmax, tnear ) )
+        return;
+      const int nb = size();
+      // Stack of nodes to visit together with their entry distance.
+      int  stack[ MAX_DEPTH ];
+      Real stack_t[ MAX_DEPTH ];
+      int  top = 0;
+      stack[ top ] = 0; stack_t[ top++ ] = tnear;
+      while ( top > 0 )
+        {
+          --top;
+          if ( stack_t[ top ] > tmax ) continue;
+          const BVHNode* node = &nodes[ stack[ top ] ];
+          while ( ! node->isLeaf() )
+            {
+              RT_STAT( node_visits++ );
+              int  i1 = (int)( node - nodes ) + 1;
+              int  i2 = node->first;
+              if ( ! validChildren( i1, i2, nb ) ) { node = 0; break; }
+              Real t1, t2;
+              bool h1 = nodes[ i1 ].box.intersect( ray.origin, inv_dir, tmax, t1 );
+              bool h2 = nodes[ i2 ].box.intersect( ray.origin, inv_dir, tmax, t2 );
+              if ( h1 && h2 && top < MAX_DEPTH )
+                { // visit the nearest child first.
+                  if ( t2 < t1 ) { std::swap( i1, i2 ); std::swap( t1, t2 ); }
+                  stack[ top ] = i2; stack_t[ top++ ] = t2;
+                  node = &nodes[ i1 ];
+                }
+              else if ( h1 ) node = &nodes[ i1 ];
+              else if ( h2 ) node = &nodes[ i2 ];
+              else { node = 0; break; }
+            }
+          if ( node == 0 ) continue;
+          RT_STAT( node_visits++ );
+          RT_STAT( primitive_tests += node->count );
+          f( node->first, node->count, tmax );
+        }
+    }
+
+    /// Same as traverseLeaves, for all the rays of \a packet at once.
+    /// A node is visited if it is met by at least one active ray before
+    /// its own closest hit (packet.tmax), and children are visited in
+    /// the order of their entry distance along the first such ray.
+    ///
+    /// @param f a functor called as `f( first, count )` for every
+    /// visited leaf. It must lower packet.tmax for the rays that hit a
+    /// primitive of the leaf.
+    template <typename LeafIntersector>
+    void traversePacketLeaves( RayPacket& packet, LeafIntersector& f ) const
+    {
+      if ( empty() || packet.size() == 0 ) return;
+      const BVHNode* nodes = data();
+      packet.pad();
+      const int nb = size();
+      Real tnear;
+      int  stack[ MAX_DEPTH ];
+      int  top = 0;
+      stack[ top++ ] = 0;
+      while ( top > 0 )
+        {
+          const BVHNode* node = &nodes[ stack[ --top ] ];
+          // The packet may have shrunk since this node was pushed.
+          if ( ! intersect( node->box, packet, tnear ) ) continue;
+          while ( ! node->isLeaf() )
+            {
+              RT_STAT( node_visits++ );
+              int  i1 = (int)( node - nodes ) + 1;
+              int  i2 = node->first;
+              if ( ! validChildren( i1, i2, nb ) ) { node = 0; break; }
+              Real t1, t2;
+              bool h1 = intersect( nodes[ i1 ].box, packet, t1 );
+              bool h2 = intersect( nodes[ i2 ].box, packet, t2 );
+              if ( h1 && h2 && top < MAX_DEPTH )
+                {
+                  if ( t2 < t1 ) std::swap( i1, i2 );
+                  stack[ top++ ] = i2;
+                  node = &nodes[ i1 ];
+                }
+              else if ( h1 ) node = &nodes[ i1 ];
+              else if ( h2 ) node = &nodes[ i2 ];
+              else { node = 0; break; }
+            }
+          if ( node == 0 ) continue;
+          RT_STAT( node_visits++ );
+          RT_STAT( primitive_tests += node->count );
+          f( node->first, node->count );
+        }
+    }
+
+  private:
+    /// @return 'true' if \a i1 and \a i2 may be the children of node
+    /// i1 - 1 among \a nb nodes: children come after their parent in
+    /// depth-first order. Together with the bound on the stack in the
+    /// traversals, this keeps nodes attached from a corrupted file
+    /// (see attach) from making a traversal read out of them. Built
+    /// trees always pass, and are never deeper than MAX_DEPTH.
+    static bool validChildren( int i1, int i2, int nb )
+    {
+      return i1 < i2 && i2 < nb;
+    }
+
+    /// Nodes given by attach, if any (then myNodes is empty).
+    const BVHNode* ptrExternal;
+    /// Number of nodes given by attach.
+    int myNbExternal;
+
+    /// Slab test of \a box against the lanes of \a packet, which stops
+    /// at the first ray meeting the box before its closest hit.
+    /// @param[out] tnear the entry distance of this ray.
+    /// @return 'true' if at least one ray meets the box.
+    static bool intersect( const BoundingBox& box, const RayPacket& packet, Real& tnear )
+    {
+      for ( int k = 0; k < RayPacket::SIZE; ++k )
+        {
+          Real t0 = 0.0f;
+          Real t1 = packet.tmax[ k ];
+          const Real o[ 3 ]   = { packet.ox[ k ], packet.oy[ k ], packet.oz[ k ] };
+          const Real inv[ 3 ] = { packet.ix[ k ], packet.iy[ k ], packet.iz[ k ] };
+          for ( int i = 0; i < 3; ++i )
+            {
+              Real ta = ( box.lo[ i ] - o[ i ] ) * inv[ i ];
+              Real tb = ( box.hi[ i ] - o[ i ] ) * inv[ i ];
+              if ( ta > tb ) std::swap( ta, tb );
+              t0 = ta > t0 ? ta : t0;
+              t1 = tb < t1 ? tb : t1;
+            }
+          if ( t0 <= t1 ) { tnear = t0; return true; }
+        }
+      return false;
+    }
+
+    /// The nodes in depth-first order.
+    std::vector< BVHNode > myNodes;
+    /// The primitive indices, such that leaves refer to contiguous ranges.
+    std::vector< int > myIndices;
+    /// Maximal number of primitives in a leaf.
+    int myMaxLeafSize;
+
+    /// Builds the subtree of primitives myIndices[begin..end[.
+    /// @return the index of its root node.
+    int buildNode( const std::vector< BoundingBox >& boxes,
+                   const std::vector< Point3 >& centers,
+                   int begin, int end, int depth )
+    {
+      int idx = (int) myNodes.size();
+      myNodes.push_back( BVHNode() );
+      BoundingBox box, cbox;
+      for ( int k = begin; k < end; ++k )
+        {
+          box.extend( boxes[ myIndices[ k ] ] );
+          cbox.extend( centers[ myIndices[ k ] ] );
+        }
+      myNodes[ idx ].box = box;
+      int n    = end - begin;
+      int axis = cbox.longestAxis();
+      Real lo  = cbox.lo[ axis ];
+      Real ext = cbox.hi[ axis ] - lo;
+      if ( n <= myMaxLeafSize || ( ext <= 0.0f && n <= 4 * myMaxLeafSize ) )
+        return makeLeaf( idx, begin, n );
+
+      int mid = begin;
+      if ( ext > 0.0f && depth < MAX_DEPTH / 2 )
+        { // SAH evaluated on bins along the longest axis of the centers.
+          int         bin_count[ NB_BINS ] = { 0 };
+          BoundingBox bin_box[ NB_BINS ];
+          Real        scale = NB_BINS / ext;
+          auto binOf = [&] ( int i ) {
+            int b = (int)( ( centers[ i ][ axis ] - lo ) * scale );
+            return std::min( std::max( b, 0 ), NB_BINS - 1 );
+          };
+          for ( int k = begin; k < end; ++k )
+            {
+              int b = binOf( myIndices[ k ] );
+              bin_count[ b ]++;
+              bin_box[ b ].extend( boxes[ myIndices[ k ] ] );
+            }
+          // right_area[ s ] and right_count[ s ] describe bins s..NB_BINS-1.
+          Real right_area[ NB_BINS ];
+          int  right_count[ NB_BINS ];
+          BoundingBox acc;
+          int  cnt = 0;
+          for ( int b = NB_BINS - 1; b > 0; --b )
+            {
+              acc.extend( bin_box[ b ] ); cnt += bin_count[ b ];
+              right_area[ b ] = acc.area(); right_count[ b ] = cnt;
+            }
+          acc = BoundingBox(); cnt = 0;
+          Real best_cost  = (Real) n; // cost of a leaf
+          int  best_split = -1;
+          for ( int s = 1; s < NB_BINS; ++s )
+            {
+              acc.extend( bin_box[ s - 1 ] ); cnt += bin_count[ s - 1 ];
+              if ( cnt == 0 || right_count[ s ] == 0 ) continue;
+              // traversal cost is 1/8 of one intersection.
+              Real cost = 0.125f + ( acc.area() * cnt
+                                     + right_area[ s ] * right_count[ s ] ) / box.area();
+              if ( cost < best_cost ) { best_cost = cost; best_split = s; }
+            }
+          if ( best_split < 0 && n <= 4 * myMaxLeafSize )
+            return makeLeaf( idx, begin, n );
+          if ( best_split >= 0 )
+            mid = (int)( std::partition( myIndices.begin() + begin,
+                                         myIndices.begin() + end,
+                                         [&] ( int i ) { return binOf( i ) < best_split; } )
+                         - myIndices.begin() );
+        }
+      if ( mid == begin || mid == end )
+        { // degenerate or too deep: split in two halves along the axis.
+          mid = begin + n / 2;
+          std::nth_element( myIndices.begin() + begin, myIndices.begin() + mid,
+                            myIndices.begin() + end,
+                            [&] ( int i, int j ) { return centers[ i ][ axis ] < centers[ j ][ axis ]; } );
+        }
+      buildNode( boxes, centers, begin, mid, depth + 1 );
+      int right = buildNode( boxes, centers, mid, end, depth + 1 );
+      myNodes[ idx ].first = right;
+      myNodes[ idx ].count = 0;
+      return idx;
+    }
+
+    /// Makes node \a idx a leaf with \a n primitives starting at \a begin.
+    int makeLeaf( int idx, int begin, int n )
+    {
+      myNodes[ idx ].first = begin;
+      myNodes[ idx ].count = n;
+      return idx;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _BVH_H_
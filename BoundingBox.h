@@ -0,0 +1,102 @@
+/**
+@file BoundingBox.h
+@author JOL
+*/
+#pragma once
+#ifndef _BOUNDING_BOX_H_
+#define _BOUNDING_BOX_H_
+
+#include <algorithm>
+#include <limits>
+#include "PointVector.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// An axis-aligned bounding box [lo,hi]. The default box is empty.
+  struct BoundingBox {
+    /// lowest corner.
+    Point3 lo;
+    /// highest corner.
+    Point3 hi;
+
+    /// Default constructor. The box is empty.
+    BoundingBox()
+      : lo(  std::numeric_limits<Real>::max(),  std::numeric_limits<Real>::max(),
+             std::numeric_limits<Real>::max() ),
+        hi( -std::numeric_limits<Real>::max(), -std::numeric_limits<Real>::max(),
+            -std::numeric_limits<Real>::max() )
+    {}
+
+    /// Constructor from two corners.
+    BoundingBox( Point3 low, Point3 high ) : lo( low ), hi( high ) {}
+
+    /// @return 'true' if the box contains no point.
+    bool empty() const { return lo[ 0 ] > hi[ 0 ]; }
+
+    /// Extends the box so that it contains point \a p.
+    void extend( const Point3& p )
+    {
+      for ( int i = 0; i < 3; ++i )
+        {
+          lo[ i ] = std::min( lo[ i ], p[ i ] );
+          hi[ i ] = std::max( hi[ i ], p[ i ] );
+        }
+    }
+
+    /// Extends the box so that it contains box \a other.
+    void extend( const BoundingBox& other )
+    {
+      for ( int i = 0; i < 3; ++i )
+        {
+          lo[ i ] = std::min( lo[ i ], other.lo[ i ] );
+          hi[ i ] = std::max( hi[ i ], other.hi[ i ] );
+        }
+    }
+
+    /// @return the center of the box.
+    Point3 center() const { return 0.5f * ( lo + hi ); }
+
+    /// @return the area of the surface of the box (0 if empty).
+    Real area() const
+    {
+      if ( empty() ) return 0.0f;
+      Vector3 d = hi - lo;
+      return 2.0f * ( d[ 0 ] * d[ 1 ] + d[ 1 ] * d[ 2 ] + d[ 2 ] * d[ 0 ] );
+    }
+
+    /// @return the axis (0,1,2) along which the box is the longest.
+    int longestAxis() const
+    {
+      Vector3 d = hi - lo;
+      if ( d[ 0 ] >= d[ 1 ] ) return d[ 0 ] >= d[ 2 ] ? 0 : 2;
+      else                    return d[ 1 ] >= d[ 2 ] ? 1 : 2;
+    }
+
+    /// Slab test with a ray of origin \a o and inverse direction \a
+    /// inv_dir (i.e. 1/dx, 1/dy, 1/dz), restricted to [0,tmax].
+    /// @param[out] tnear the parameter where the ray enters the box.
+    /// @return 'true' if the ray meets the box.
+    bool intersect( const Point3& o, const Vector3& inv_dir, Real tmax,
+                    Real& tnear ) const
+    {
+      Real t0 = 0.0f;
+      Real t1 = tmax;
+      for ( int i = 0; i < 3; ++i )
+        {
+          Real ta = ( lo[ i ] - o[ i ] ) * inv_dir[ i ];
+          Real tb = ( hi[ i ] - o[ i ] ) * inv_dir[ i ];
+          if ( ta > tb ) std::swap( ta, tb );
+          // written so that NaNs (0 * inf) do not shrink the interval.
+          t0 = ta > t0 ? ta : t0;
+          t1 = tb < t1 ? tb : t1;
+          if ( t0 > t1 ) return false;
+        }
+      tnear = t0;
+      return true;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _BOUNDING_BOX_H_
@@ -0,0 +1,68 @@
+/**
+@file Camera.h
+@author JOL
+*/
+#pragma once
+#ifndef _CAMERA_H_
+#define _CAMERA_H_
+
+#include "PointVector.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A perspective camera that does not need QGLViewer. It computes the
+  /// same four corner rays as `camera()->convertClickToLine` does in
+  /// Viewer::keyPressEvent, so that it can feed Renderer::setViewBox.
+  struct Camera {
+    /// The position of the eye.
+    Point3 position;
+    /// The (unit) viewing direction.
+    Vector3 direction;
+    /// The (unit) up vector, orthogonal to direction.
+    Vector3 up;
+    /// The vertical field of view in radians.
+    Real fieldOfView;
+
+    /// Default constructor. Same view as the one stored in .qglviewer.xml.
+    Camera()
+      : position( -17.7189f, 17.0542f, 0.222616f ),
+        direction( 0.608966f, -0.771223f, -0.185407f ),
+        up( 0.454214f, 0.147429f, 0.878609f ),
+        fieldOfView( 0.785398f )
+    {}
+
+    /// Sets the viewing direction and the up vector. The up vector is
+    /// made orthogonal to the direction.
+    void setOrientation( Vector3 dir, Vector3 upv )
+    {
+      direction = dir / dir.norm();
+      up        = upv - upv.dot( direction ) * direction;
+      up       /= up.norm();
+    }
+
+    /// Makes the camera look at point \a target.
+    void lookAt( Point3 target, Vector3 upv )
+    {
+      setOrientation( target - position, upv );
+    }
+
+    /// Computes the directions of the rays going through the four
+    /// corner pixels of a \a width x \a height viewport.
+    void getViewBox( int width, int height,
+                     Vector3& dirUL, Vector3& dirUR,
+                     Vector3& dirLL, Vector3& dirLR ) const
+    {
+      Vector3 right = direction.cross( up );
+      Real    ty    = tan( 0.5f * fieldOfView );
+      Real    tx    = ty * (Real) width / (Real) height;
+      dirUL = direction - tx * right + ty * up;
+      dirUR = direction + tx * right + ty * up;
+      dirLL = direction - tx * right - ty * up;
+      dirLR = direction + tx * right - ty * up;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _CAMERA_H_
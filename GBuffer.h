@@ -0,0 +1,167 @@
+/**
+@file GBuffer.h
+@author JOL
+*/
+#pragma once
+#ifndef _GBUFFER_H_
+#define _GBUFFER_H_
+
+#include <vector>
+#include "Color.h"
+#include "Hit.h"
+#include "Material.h"
+#include "Ray.h"
+#include "TileScheduler.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Keeps, for every camera sample of a rendering, the tree of rays it
+  spawned: where each ray hits (point, normal, material) or that it
+  escapes, with its weight. The tree does not depend on the lights,
+  hence when only lights move or change color, Renderer::render
+  computes the image again from the G-buffer: only illumination and
+  shadow rays are computed, and the image is the same as if it were
+  traced again.
+
+  A sample is only kept if its tree has at most max_records rays and
+  all its materials belong to the objects (not computed at the hit,
+  see Hit::refersToMaterial); other samples are traced again. The
+  G-buffer must be invalidated if objects change.
+  */
+  struct GBuffer {
+    /// A ray of the tree of a sample: where it hits, or that it escapes.
+    struct Record {
+      Ray             ray;
+      Color           weight;
+      Point3          point;
+      Vector3         normal;
+      /// The material at the hit, 0 if the ray escapes.
+      const Material* material;
+    };
+
+    /// The samples of one tile, in the order of Renderer::renderTile.
+    struct Block {
+      std::vector< Record > records;
+      /// First record of each sample.
+      std::vector< int >    first;
+      /// Number of records of each sample, -1 if it is not kept.
+      std::vector< int >    count;
+    };
+
+    /// What the G-buffer depends on, besides objects.
+    struct Key {
+      Point3  origin;
+      Vector3 dirUL, dirUR, dirLL, dirLR;
+      int     width, height, samples, tile_size, max_depth, ray_budget;
+      Real    cull_threshold;
+      bool    roulette;
+
+      bool operator==( const Key& other ) const
+      {
+        return origin == other.origin && dirUL == other.dirUL && dirUR == other.dirUR
+          && dirLL == other.dirLL && dirLR == other.dirLR
+          && width == other.width && height == other.height
+          && samples == other.samples && tile_size == other.tile_size
+          && max_depth == other.max_depth && ray_budget == other.ray_budget
+          && cull_threshold == other.cull_threshold && roulette == other.roulette;
+      }
+    };
+
+    /// Records the tree of one sample into a block.
+    struct Recorder {
+      Recorder( Block* b, int max ) : block( b ), max_records( max ), sample( 0 ), ok( true ) {}
+
+      /// Starts sample \a s, of a block of \a nb samples.
+      void begin( int s, int nb )
+      {
+        if ( (int) block->first.size() < nb ) { block->first.resize( nb ); block->count.resize( nb ); }
+        sample = s;
+        ok     = true;
+        block->first[ s ] = (int) block->records.size();
+      }
+
+      /// Records \a ray, of weight \a weight, hitting at \a hit.
+      void hit( const Ray& ray, const Color& weight, const Hit& hit )
+      {
+        if ( ! hit.refersToMaterial() ) { ok = false; return; }
+        add( Record{ ray, weight, hit.point, hit.normal, &hit.material() } );
+      }
+
+      /// Records \a ray, of weight \a weight, escaping the scene.
+      void escape( const Ray& ray, const Color& weight )
+      {
+        add( Record{ ray, weight, Point3(), Vector3(), 0 } );
+      }
+
+      /// Ends the current sample, dropping it if it cannot be kept.
+      void end()
+      {
+        int n = (int) block->records.size() - block->first[ sample ];
+        if ( ! ok ) block->records.resize( block->first[ sample ] );
+        block->count[ sample ] = ok ? n : -1;
+      }
+
+    private:
+      Block* block;
+      int    max_records;
+      int    sample;
+      bool   ok;
+
+      void add( const Record& r )
+      {
+        if ( ! ok ) return;
+        if ( (int) block->records.size() - block->first[ sample ] == max_records )
+          { ok = false; return; }
+        block->records.push_back( r );
+      }
+    };
+
+    /// Constructor. The G-buffer is empty and keeps at most \a max
+    /// rays per sample.
+    GBuffer( int max = 16 ) : max_records( max ), valid( false ) {}
+
+    /// Forgets everything (e.g. when objects change).
+    void invalidate() { valid = false; blocks.clear(); }
+
+    /// @return 'true' if the G-buffer holds the rendering of key \a k.
+    bool matches( const Key& k ) const { return valid && key == k; }
+
+    /// Prepares the G-buffer for the rendering of key \a k.
+    void reset( const Key& k )
+    {
+      key   = k;
+      valid = true;
+      int ts = k.tile_size;
+      blocks.assign( ( ( k.width + ts - 1 ) / ts ) * ( ( k.height + ts - 1 ) / ts ), Block() );
+    }
+
+    /// @return the block of \a tile.
+    Block& block( const Tile& tile )
+    {
+      int ts = key.tile_size;
+      return blocks[ ( tile.y0 / ts ) * ( ( key.width + ts - 1 ) / ts ) + tile.x0 / ts ];
+    }
+
+    /// Counts the kept samples, and all samples.
+    void kept( long& nb_kept, long& nb_samples ) const
+    {
+      nb_kept = nb_samples = 0;
+      for ( const Block& b : blocks )
+        for ( int c : b.count ) { nb_samples += 1; nb_kept += c >= 0 ? 1 : 0; }
+    }
+
+    /// Maximal number of rays kept per sample.
+    int   max_records;
+    /// 'true' once a rendering is stored.
+    bool  valid;
+    /// The rendering that is stored.
+    Key   key;
+    /// One block per tile, row after row.
+    std::vector< Block > blocks;
+  };
+
+} // namespace rt
+
+#endif // #define _GBUFFER_H_
@@ -6,11 +6,17 @@
 #ifndef _GRAPHICAL_OBJECT_H_
 #define _GRAPHICAL_OBJECT_H_
 
+#ifdef RT_HEADLESS
+#include "Headless.h"
+#else
 // In order to call opengl commands in all graphical objects
 #include "Viewer.h"
+#endif
 #include "PointVector.h"
 #include "Material.h"
 #include "Ray.h"
+#include "BoundingBox.h"
+#include "Hit.h"
 
 /// Namespace RayTracer
 namespace rt {
@@ -50,6 +56,69 @@ namespace rt {
     /// @return either a real < 0.0 if there is an intersection, or a
     /// kind of distance to the closest point of intersection.
     virtual Real rayIntersection( const Ray& ray, Point3& p ) = 0;
+
+    /// Looks for the first intersection of the ray with the object
+    /// strictly between distances \a tmin and \a tmax. Unlike
+    /// rayIntersection, it also finds the points where the ray leaves
+    /// the object, so that calling it again with \a tmin set to \a t
+    /// enumerates every crossing of the object.
+    ///
+    /// @param[in] ray the incoming ray
+    /// @param[out] t the distance along the ray of the intersection (if any).
+    /// @return 'true' if there is an intersection in ]tmin,tmax[.
+    virtual bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t )
+    {
+      Ray    shifted( ray.origin + ray.direction * tmin, ray.direction, ray.depth );
+      Point3 p;
+      if ( rayIntersection( shifted, p ) >= 0.0f ) return false;
+      t = tmin + ( p - shifted.origin ).dot( ray.direction );
+      return t > tmin && t < tmax;
+    }
+
+    /// @name Compound objects
+    /// An object may be made of many parts (e.g. the spheres of a
+    /// SphereCloud), which are not graphical objects themselves. Its
+    /// intersection then also tells which part is hit, and the normal
+    /// and the material depend on it. Simple objects have one part
+    /// (numbered 0) and just use the methods above.
+    /// @{
+
+    /// Same as rayIntersection, also giving the \a part that is hit.
+    virtual Real rayIntersection( const Ray& ray, Point3& p, int& part )
+    {
+      part = 0;
+      return rayIntersection( ray, p );
+    }
+
+    /// Same as nextIntersection, also giving the \a part that is crossed.
+    virtual bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t,
+                                   int& part )
+    {
+      part = 0;
+      return nextIntersection( ray, tmin, tmax, t );
+    }
+
+    /// @return the normal vector at point \a p of part \a part.
+    virtual Vector3 getNormal( Point3 p, int /* part */ ) { return getNormal( p ); }
+
+    /// @return the material at point \a p of part \a part.
+    virtual Material getMaterial( Point3 p, int /* part */ ) { return getMaterial( p ); }
+
+    /// @}
+
+    /// Fills the normals and the material of \a hit, whose point,
+    /// object and part are already set. Scene calls it once per hit.
+    /// The default calls getNormal and copies getMaterial; objects
+    /// should rather refer to their own material.
+    virtual void surface( Hit& hit )
+    {
+      hit.normal = hit.geometric_normal = getNormal( hit.point, hit.part );
+      hit.copyMaterial( getMaterial( hit.point, hit.part ) );
+    }
+
+    /// @return a box containing the whole object (used to build the
+    /// BVH of the scene).
+    virtual BoundingBox boundingBox() const = 0;
                     
 
   };
@@ -0,0 +1,38 @@
+/**
+@file Headless.h
+@author JOL
+*/
+#pragma once
+#ifndef _HEADLESS_H_
+#define _HEADLESS_H_
+
+// This header is only used when RT_HEADLESS is defined, i.e. when
+// building the command-line renderer (target ray-tracer-batch in
+// ray-tracer.pro). It provides the few OpenGL/QGLViewer names that
+// the geometry headers mention, so that neither Qt nor QGLViewer nor
+// an OpenGL context is needed.
+#ifndef RT_HEADLESS
+#error "Headless.h must only be included when RT_HEADLESS is defined."
+#endif
+
+/// Same type as in <GL/gl.h>.
+typedef unsigned int GLenum;
+
+/// Same values as in <GL/gl.h>: lights still carry their number.
+#define GL_LIGHT0 0x4000
+#define GL_LIGHT1 0x4001
+#define GL_LIGHT2 0x4002
+#define GL_LIGHT3 0x4003
+#define GL_LIGHT4 0x4004
+#define GL_LIGHT5 0x4005
+#define GL_LIGHT6 0x4006
+#define GL_LIGHT7 0x4007
+
+/// Namespace RayTracer
+namespace rt {
+  /// The viewer is never instantiated in a headless build. Graphical
+  /// objects and lights only see it through references.
+  class Viewer;
+} // namespace rt
+
+#endif // #define _HEADLESS_H_
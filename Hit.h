@@ -0,0 +1,68 @@
+/**
+@file Hit.h
+@author JOL
+*/
+#pragma once
+#ifndef _HIT_H_
+#define _HIT_H_
+
+#include "PointVector.h"
+#include "Material.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  struct GraphicalObject;
+
+  /// Everything the renderer needs to know about the point where a ray
+  /// hits an object. Scene::rayIntersection fills it once per hit
+  /// (see GraphicalObject::surface), so that shading makes no further
+  /// virtual call and never copies the material.
+  struct Hit {
+    /// distance along the ray.
+    Real distance;
+    /// point of intersection.
+    Point3 point;
+    /// unit normal of the surface itself (e.g. of the triangle).
+    Vector3 geometric_normal;
+    /// unit normal used for shading (e.g. interpolated in the triangle).
+    Vector3 normal;
+    /// the object that is hit.
+    GraphicalObject* object;
+    /// the part of the object that is hit (see GraphicalObject).
+    int part;
+
+    /// Default constructor. Nothing is hit.
+    Hit() : distance( 0.0f ), object( 0 ), part( 0 ), ptrMaterial( 0 ) {}
+
+    /// @return the material at the hit point.
+    const Material& material() const
+    {
+      return ptrMaterial != 0 ? *ptrMaterial : myMaterial;
+    }
+
+    /// @return 'true' if the material is the one of the object (see
+    /// setMaterial), 'false' if it is a copy (see copyMaterial).
+    bool refersToMaterial() const { return ptrMaterial != 0; }
+
+    /// Refers to \a m, which must live as long as the object that is hit.
+    void setMaterial( const Material& m ) { ptrMaterial = &m; }
+
+    /// Stores a copy of \a m, for objects whose material is computed.
+    void copyMaterial( const Material& m ) { myMaterial = m; ptrMaterial = 0; }
+
+    /// Takes the material of \a other, by reference if \a other has one.
+    void takeMaterial( const Hit& other )
+    {
+      if ( other.ptrMaterial != 0 ) setMaterial( *other.ptrMaterial );
+      else copyMaterial( other.myMaterial );
+    }
+
+  private:
+    const Material* ptrMaterial;
+    Material        myMaterial;
+  };
+
+} // namespace rt
+
+#endif // #define _HIT_H_
@@ -1,6 +1,7 @@
 // file Image2D.hpp
 #ifndef _IMAGE2D_HPP_
 #define _IMAGE2D_HPP_
+#include <algorithm>
 #include <vector>
 
 namespace rt {
@@ -136,6 +137,10 @@ public:
   GenericIterator< Accessor > end()
   { return start< Accessor >( 0, h() ); }
    
+  /// @return un pointeur sur les valeurs des pixels, rangées ligne par
+  /// ligne (utile pour les écritures en bloc).
+  const Value* data() const { return m_data.data(); }
+
   /// Accesseur read-only à la valeur d'un pixel.
   /// @return la valeur du pixel(i,j)
   Value at( int i, int j ) const;
@@ -167,7 +172,7 @@ template <typename TValue>
 void
 Image2D<TValue>::fill( Value g )
 {
-  m_data.fill( g );
+  std::fill( m_data.begin(), m_data.end(), g );
 }
 
 template <typename TValue>
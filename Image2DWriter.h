@@ -3,8 +3,13 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "Color.h"
 #include "Image2D.h"
+#include "PixelFormats.h"
 
 namespace rt {
 
@@ -41,12 +46,62 @@ public:
   typedef Color Value;
   typedef Image2D<Value> Image;
 
+  /// Writes \a img as a PPM image, either as text (P3) or binary (P6).
+  /// The binary image is quantized in one pass and written at once.
   static bool write( Image & img, std::ostream & output, bool ascii );
+
+  /// Writes \a img as a PFM image (32 bits floats per channel), which
+  /// keeps colors outside [0,1]. The stream must be opened in binary mode.
+  static bool writePFM( Image & img, std::ostream & output );
+
+  /// Writes the header of a PPM image of size \a w x \a h.
+  static void writeHeader( std::ostream & output, int w, int h, bool ascii );
+
+  /// Writes the header of a PFM image of size \a w x \a h.
+  static void writePFMHeader( std::ostream & output, int w, int h );
+
+  /// Converts the \a n channel values of \a src (in [0,1]) to bytes in
+  /// \a dst, as (unsigned char) (v*255), 16 values at a time when SSE2
+  /// is available.
+  static void quantize( const float* src, int n, unsigned char* dst );
 };
 
+/// Specialization for 8-bit sRGB images (see SRGBColor).
+template <>
+class Image2DWriter<SRGBColor> {
+public:
+  typedef SRGBColor Value;
+  typedef Image2D<Value> Image;
 
+  /// Writes \a img as a binary PPM image: its bytes are written as is.
+  static bool write( Image & img, std::ostream & output );
+};
 
-bool
+/// Specialization for shared-exponent images (see RGBEColor).
+template <>
+class Image2DWriter<RGBEColor> {
+public:
+  typedef RGBEColor Value;
+  typedef Image2D<Value> Image;
+
+  /// Writes \a img as a Radiance HDR image. The stream must be opened
+  /// in binary mode.
+  static bool write( Image & img, std::ostream & output );
+
+  /// Writes the header of a Radiance HDR image of size \a w x \a h.
+  static void writeHeader( std::ostream & output, int w, int h );
+
+  /// Writes the \a w pixels of one row, run-length encoded channel by
+  /// channel when the width allows it (8 to 32767 pixels).
+  static void writeScanline( std::ostream & output, const Value* row, int w,
+                             std::vector< unsigned char > & buffer );
+};
+
+// Colors are stored as 3 consecutive floats, so that an image is one
+// array of floats.
+static_assert( sizeof( Color ) == 3 * sizeof( float ), "Color must be 3 packed floats" );
+
+inline bool
 Image2DWriter<unsigned char>::write( Image & img, std::ostream & output, bool ascii )
 {
   typedef unsigned char GrayLevel;
@@ -68,13 +123,10 @@ Image2DWriter<unsigned char>::write( Image & img, std::ostream & output, bool as
 }
 
 
-bool
+inline bool
 Image2DWriter<Color>::write( Image & img, std::ostream & output, bool ascii )
 {
-  output << ( ascii ? "P3" : "P6" ) << std::endl;
-  output << "# Generated by You !" << std::endl;
-  output << img.w() << " " << img.h() << std::endl;
-  output << "255" << std::endl;
+  writeHeader( output, img.w(), img.h(), ascii );
   if ( ascii ) 
     {
       for ( Image::Iterator it = img.begin(), itE = img.end(); it != itE; ++it )
@@ -85,16 +137,127 @@ Image2DWriter<Color>::write( Image & img, std::ostream & output, bool ascii )
     }
   else 
     {
-      for ( Image::Iterator it = img.begin(), itE = img.end(); it != itE; ++it )
-	{ 
-	  Color c = *it;
-          unsigned char red = (unsigned char) (c.r()*255.0f);
-          unsigned char green = (unsigned char) (c.g()*255.0f);
-          unsigned char blue = (unsigned char) (c.b()*255.0f);
-	  output << red << green << blue;
-	}
+      const int n = 3 * img.w() * img.h();
+      std::vector< unsigned char > buffer( n );
+      quantize( (const float*) img.data(), n, buffer.data() );
+      output.write( (const char*) buffer.data(), n );
     }
-  return true;
+  return output.good();
+}
+
+inline bool
+Image2DWriter<Color>::writePFM( Image & img, std::ostream & output )
+{
+  writePFMHeader( output, img.w(), img.h() );
+  // Rows are stored from bottom to top.
+  for ( int y = img.h() - 1; y >= 0; --y )
+    output.write( (const char*) ( img.data() + y * img.w() ),
+                  3 * sizeof( float ) * img.w() );
+  return output.good();
+}
+
+inline bool
+Image2DWriter<SRGBColor>::write( Image & img, std::ostream & output )
+{
+  Image2DWriter<Color>::writeHeader( output, img.w(), img.h(), false );
+  output.write( (const char*) img.data(), sizeof( Value ) * img.w() * img.h() );
+  return output.good();
+}
+
+inline bool
+Image2DWriter<RGBEColor>::write( Image & img, std::ostream & output )
+{
+  std::vector< unsigned char > buffer;
+  writeHeader( output, img.w(), img.h() );
+  for ( int y = 0; y < img.h(); ++y )
+    writeScanline( output, img.data() + y * img.w(), img.w(), buffer );
+  return output.good();
+}
+
+inline void
+Image2DWriter<RGBEColor>::writeHeader( std::ostream & output, int w, int h )
+{
+  output << "#?RADIANCE\n# Generated by You !\nFORMAT=32-bit_rle_rgbe\n\n"
+         << "-Y " << h << " +X " << w << "\n";
+}
+
+inline void
+Image2DWriter<RGBEColor>::writeScanline( std::ostream & output, const Value* row, int w,
+                                         std::vector< unsigned char > & buffer )
+{
+  if ( w < 8 || w > 0x7FFF )
+    { // flat scanline
+      output.write( (const char*) row, sizeof( Value ) * w );
+      return;
+    }
+  buffer.clear();
+  buffer.push_back( 2 ); buffer.push_back( 2 );
+  buffer.push_back( (unsigned char) ( w >> 8 ) ); buffer.push_back( (unsigned char) ( w & 0xFF ) );
+  for ( int c = 0; c < 4; ++c )
+    {
+      int i = 0;
+      while ( i < w )
+        {
+          const unsigned char v = row[ i ].rgbe[ c ];
+          int run = 1;
+          while ( i + run < w && run < 127 && row[ i + run ].rgbe[ c ] == v ) ++run;
+          if ( run >= 4 )
+            {
+              buffer.push_back( (unsigned char) ( 128 + run ) );
+              buffer.push_back( v );
+              i += run;
+              continue;
+            }
+          // Literal bytes, up to the next run of 4 equal bytes.
+          const int start = i;
+          do ++i;
+          while ( i < w && i - start < 128
+                  && ! ( i + 3 < w && row[ i ].rgbe[ c ] == row[ i + 1 ].rgbe[ c ]
+                         && row[ i ].rgbe[ c ] == row[ i + 2 ].rgbe[ c ]
+                         && row[ i ].rgbe[ c ] == row[ i + 3 ].rgbe[ c ] ) );
+          buffer.push_back( (unsigned char) ( i - start ) );
+          for ( int k = start; k < i; ++k ) buffer.push_back( row[ k ].rgbe[ c ] );
+        }
+    }
+  output.write( (const char*) buffer.data(), buffer.size() );
+}
+
+inline void
+Image2DWriter<Color>::writeHeader( std::ostream & output, int w, int h, bool ascii )
+{
+  output << ( ascii ? "P3" : "P6" ) << std::endl;
+  output << "# Generated by You !" << std::endl;
+  output << w << " " << h << std::endl;
+  output << "255" << std::endl;
+}
+
+inline void
+Image2DWriter<Color>::writePFMHeader( std::ostream & output, int w, int h )
+{
+  output << "PF\n" << w << " " << h << "\n";
+  // A negative scale means little endian.
+  const unsigned short one = 1;
+  output << ( *(const unsigned char*) &one == 1 ? "-1.0" : "1.0" ) << "\n";
+}
+
+inline void
+Image2DWriter<Color>::quantize( const float* src, int n, unsigned char* dst )
+{
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 s = _mm_set1_ps( 255.0f );
+  for ( ; i + 16 <= n; i += 16 )
+    {
+      __m128i a = _mm_cvttps_epi32( _mm_mul_ps( _mm_loadu_ps( src + i ),      s ) );
+      __m128i b = _mm_cvttps_epi32( _mm_mul_ps( _mm_loadu_ps( src + i + 4 ),  s ) );
+      __m128i c = _mm_cvttps_epi32( _mm_mul_ps( _mm_loadu_ps( src + i + 8 ),  s ) );
+      __m128i d = _mm_cvttps_epi32( _mm_mul_ps( _mm_loadu_ps( src + i + 12 ), s ) );
+      _mm_storeu_si128( (__m128i*)( dst + i ),
+                        _mm_packus_epi16( _mm_packs_epi32( a, b ), _mm_packs_epi32( c, d ) ) );
+    }
+#endif
+  for ( ; i < n; ++i )
+    dst[ i ] = (unsigned char) ( src[ i ] * 255.0f );
 }
 
 } // namespace rt
@@ -0,0 +1,137 @@
+/**
+@file ImageSink.h
+@author JOL
+*/
+#pragma once
+#ifndef _IMAGE_SINK_H_
+#define _IMAGE_SINK_H_
+
+#include <iostream>
+#include <vector>
+#include "Color.h"
+#include "Image2DWriter.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// Receives an image band by band, from top to bottom, as soon as
+  /// each band is rendered (see Renderer::render). Only one band needs
+  /// to be in memory at a time, so that very large images can be
+  /// written directly to disk.
+  struct ImageSink {
+    virtual ~ImageSink() {}
+    /// Called once before the first band.
+    /// @return 'false' if the image cannot be written.
+    virtual bool begin( int width, int height ) = 0;
+    /// Receives rows [y, y + \a nb_rows[ of the image, stored row by
+    /// row in \a pixels. Bands arrive in increasing order of \a y.
+    virtual bool write( const Color* pixels, int y, int nb_rows ) = 0;
+    /// Called once after the last band.
+    virtual bool end() { return true; }
+  };
+
+  /// Writes the bands to a binary PPM stream as they arrive. Colors
+  /// are quantized linearly as by Image2DWriter<Color>, or encoded
+  /// with the sRGB curve if \a srgb is 'true' (see SRGBColor).
+  struct PPMSink : public ImageSink {
+    std::ostream& output;
+
+    PPMSink( std::ostream& out, bool srgb = false )
+      : output( out ), myWidth( 0 ), mySRGB( srgb ) {}
+
+    bool begin( int width, int height )
+    {
+      myWidth = width;
+      Image2DWriter<Color>::writeHeader( output, width, height, false );
+      return output.good();
+    }
+    bool write( const Color* pixels, int, int nb_rows )
+    {
+      const int n = 3 * myWidth * nb_rows;
+      myBuffer.resize( n );
+      if ( mySRGB )
+        for ( int i = 0; i < n; ++i )
+          myBuffer[ i ] = SRGBColor::encode( ( (const float*) pixels )[ i ] );
+      else
+        Image2DWriter<Color>::quantize( (const float*) pixels, n, myBuffer.data() );
+      output.write( (const char*) myBuffer.data(), n );
+      return output.good();
+    }
+    bool end() { output.flush(); return output.good(); }
+
+  private:
+    int  myWidth;
+    bool mySRGB;
+    std::vector< unsigned char > myBuffer;
+  };
+
+  /// Writes the bands to a Radiance HDR stream as they arrive, in
+  /// shared-exponent format (4 bytes per pixel, see RGBEColor), which
+  /// keeps colors outside [0,1] at a third of the size of PFM.
+  struct HDRSink : public ImageSink {
+    std::ostream& output;
+
+    HDRSink( std::ostream& out ) : output( out ), myWidth( 0 ) {}
+
+    bool begin( int width, int height )
+    {
+      myWidth = width;
+      Image2DWriter<RGBEColor>::writeHeader( output, width, height );
+      return output.good();
+    }
+    bool write( const Color* pixels, int, int nb_rows )
+    {
+      myRow.resize( myWidth );
+      for ( int j = 0; j < nb_rows; ++j )
+        {
+          for ( int x = 0; x < myWidth; ++x )
+            myRow[ x ] = RGBEColor( pixels[ j * myWidth + x ] );
+          Image2DWriter<RGBEColor>::writeScanline( output, myRow.data(), myWidth, myBuffer );
+        }
+      return output.good();
+    }
+    bool end() { output.flush(); return output.good(); }
+
+  private:
+    int myWidth;
+    std::vector< RGBEColor >     myRow;
+    std::vector< unsigned char > myBuffer;
+  };
+
+  /// Writes the bands to a PFM stream as they arrive. Since PFM stores
+  /// rows from bottom to top, the stream must be seekable (e.g. a file
+  /// opened in binary mode).
+  struct PFMSink : public ImageSink {
+    std::ostream& output;
+
+    PFMSink( std::ostream& out ) : output( out ), myWidth( 0 ), myHeight( 0 ) {}
+
+    bool begin( int width, int height )
+    {
+      myWidth  = width;
+      myHeight = height;
+      Image2DWriter<Color>::writePFMHeader( output, width, height );
+      myStart  = output.tellp();
+      return output.good() && myStart != std::streampos( -1 );
+    }
+    bool write( const Color* pixels, int y, int nb_rows )
+    {
+      const std::streamoff row_size = 3 * sizeof( float ) * myWidth;
+      for ( int j = 0; j < nb_rows; ++j )
+        {
+          output.seekp( myStart + (std::streamoff)( myHeight - 1 - y - j ) * row_size );
+          output.write( (const char*) ( pixels + j * myWidth ), row_size );
+        }
+      return output.good();
+    }
+    bool end() { output.flush(); return output.good(); }
+
+  private:
+    int myWidth;
+    int myHeight;
+    std::streampos myStart;
+  };
+
+} // namespace rt
+
+#endif // #define _IMAGE_SINK_H_
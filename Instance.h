@@ -0,0 +1,174 @@
+/**
+@file Instance.h
+@author JOL
+*/
+#pragma once
+#ifndef _INSTANCE_H_
+#define _INSTANCE_H_
+
+#include <memory>
+#include "GraphicalObject.h"
+#include "Transform.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  A copy of a geometry (e.g. a TriangleMesh or a SphereCloud) placed in
+  the scene by an affine transformation, possibly with another
+  material. The geometry is shared by all its instances and is not
+  part of the scene itself: an instance only costs its transformation,
+  so that a mesh may be repeated thousands of times.
+
+  Rays are transformed into the space of the geometry, where its own
+  BVH is traversed; the scene BVH only sees the box of the instance.
+  */
+  struct Instance final : public GraphicalObject {
+
+    /// Places \a geometry with transformation \a to_world, with the
+    /// materials of \a geometry.
+    Instance( std::shared_ptr< GraphicalObject > geometry, const Transform& to_world )
+      : ptrGeometry( geometry ), myToWorld( to_world ), myToObject( to_world.inverse() ),
+        myHasMaterial( false )
+    {}
+
+    /// Places \a geometry with transformation \a to_world and material \a m.
+    Instance( std::shared_ptr< GraphicalObject > geometry, const Transform& to_world,
+              const Material& m )
+      : ptrGeometry( geometry ), myToWorld( to_world ), myToObject( to_world.inverse() ),
+        myHasMaterial( true ), myMaterial( m )
+    {}
+
+    /// Virtual destructor since object contains virtual methods.
+    virtual ~Instance() {}
+
+    /// @return the shared geometry.
+    const GraphicalObject& geometry() const { return *ptrGeometry; }
+
+    /// @return the transformation from the space of the geometry to the scene.
+    const Transform& toWorld() const { return myToWorld; }
+
+    // ---------------- GraphicalObject services ----------------------------
+  public:
+
+    /// Nothing to precompute.
+    void init( Viewer& /* viewer */ ) {}
+
+    /// Draws the geometry, transformed.
+    void draw( Viewer& viewer )
+    {
+#ifndef RT_HEADLESS
+      // OpenGL matrices are column-major.
+      GLfloat m[ 16 ] = { 0.0f };
+      for ( int i = 0; i < 3; ++i )
+        for ( int j = 0; j < 4; ++j )
+          m[ 4 * j + i ] = myToWorld.m[ i ][ j ];
+      m[ 15 ] = 1.0f;
+      glPushMatrix();
+      glMultMatrixf( m );
+      ptrGeometry->draw( viewer );
+      glPopMatrix();
+#else
+      (void) viewer;
+#endif
+    }
+
+    Vector3 getNormal( Point3 p ) { return getNormal( p, 0 ); }
+    Material getMaterial( Point3 p ) { return getMaterial( p, 0 ); }
+    Real rayIntersection( const Ray& ray, Point3& p )
+    {
+      int part;
+      return rayIntersection( ray, p, part );
+    }
+    bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t )
+    {
+      int part;
+      return nextIntersection( ray, tmin, tmax, t, part );
+    }
+
+    /// @return the normal of the geometry at the antecedent of \a p,
+    /// transformed by the inverse transposed transformation.
+    Vector3 getNormal( Point3 p, int part )
+    {
+      return toWorldNormal( ptrGeometry->getNormal( myToObject.point( p ), part ) );
+    }
+
+    /// @return the material of the instance, or the one of the geometry.
+    Material getMaterial( Point3 p, int part )
+    {
+      return myHasMaterial ? myMaterial : ptrGeometry->getMaterial( myToObject.point( p ), part );
+    }
+
+    /// Transforms the surface of the geometry at the antecedent of the hit.
+    void surface( Hit& hit )
+    {
+      Hit object_hit;
+      object_hit.point  = myToObject.point( hit.point );
+      object_hit.object = ptrGeometry.get();
+      object_hit.part   = hit.part;
+      ptrGeometry->surface( object_hit );
+      hit.geometric_normal = toWorldNormal( object_hit.geometric_normal );
+      hit.normal           = toWorldNormal( object_hit.normal );
+      if ( myHasMaterial ) hit.setMaterial( myMaterial );
+      else hit.takeMaterial( object_hit );
+    }
+
+    /// Intersects the geometry with the ray transformed in its space.
+    Real rayIntersection( const Ray& ray, Point3& p, int& part )
+    {
+      Real scale;
+      Ray  object_ray = toObject( ray, scale );
+      Point3 q;
+      if ( ptrGeometry->rayIntersection( object_ray, q, part ) >= 0.0f ) return 1.0f;
+      p = myToWorld.point( q );
+      return -( q - object_ray.origin ).norm() / scale;
+    }
+
+    /// Same as rayIntersection, between distances \a tmin and \a tmax.
+    bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t, int& part )
+    {
+      Real scale;
+      Ray  object_ray = toObject( ray, scale );
+      Real to;
+      if ( ! ptrGeometry->nextIntersection( object_ray, tmin * scale, tmax * scale, to, part ) )
+        return false;
+      t = to / scale;
+      return t > tmin && t < tmax;
+    }
+
+    /// @return the box of the transformed geometry.
+    BoundingBox boundingBox() const
+    {
+      return myToWorld.box( ptrGeometry->boundingBox() );
+    }
+
+  private:
+    std::shared_ptr< GraphicalObject > ptrGeometry;
+    Transform myToWorld;
+    Transform myToObject;
+    bool      myHasMaterial;
+    Material  myMaterial;
+
+    /// @return \a ray in the space of the geometry, with a unit
+    /// direction; distances along it are \a scale times the ones
+    /// along \a ray.
+    Ray toObject( const Ray& ray, Real& scale ) const
+    {
+      Vector3 d = myToObject.vector( ray.direction );
+      scale     = d.norm();
+      return Ray( myToObject.point( ray.origin ), d, ray.depth );
+    }
+
+    /// @return the unit normal in the scene of normal \a n of the geometry.
+    Vector3 toWorldNormal( const Vector3& n ) const
+    {
+      Vector3 u  = myToObject.transposedVector( n );
+      Real    l2 = u.dot( u );
+      if ( l2 != 0.0f ) u /= sqrt( l2 );
+      return u;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _INSTANCE_H_
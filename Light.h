@@ -6,9 +6,15 @@
 #ifndef _LIGHT_H_
 #define _LIGHT_H_
 
+#ifdef RT_HEADLESS
+#include "Headless.h"
+#else
 // In order to call opengl commands in all graphical objects
 #include "Viewer.h"
+#endif
 #include "PointVector.h"
+#include <limits>
+#include "Color.h"
 
 /// Namespace RayTracer
 namespace rt {
@@ -34,6 +40,10 @@ namespace rt {
     /// redisplay objects in the OpenGL window.
     virtual void draw( Viewer& /* viewer */) = 0;
 
+    /// @return 'true' if the next call to light() will move this light
+    /// (e.g. its manipulator was dragged). By default, lights are fixed.
+    virtual bool moved() const { return false; }
+
     /// Given the point \a p, returns the normalized direction to this
     /// light.
     virtual Vector3 direction( const Vector3& /* p */ ) const = 0;
@@ -42,6 +52,13 @@ namespace rt {
     /// p.
     virtual Color color( const Vector3& /* p */ ) const = 0;
 
+    /// @return the distance from point \a p to this light. Shadow rays
+    /// stop there. By default, the light is at infinity.
+    virtual Real distance( const Vector3& /* p */ ) const
+    {
+      return std::numeric_limits<Real>::infinity();
+    }
+
   };
 
 } // namespace rt
@@ -0,0 +1,161 @@
+/**
+@file ObjectGroup.h
+@author JOL
+*/
+#pragma once
+#ifndef _OBJECT_GROUP_H_
+#define _OBJECT_GROUP_H_
+
+#include <typeinfo>
+#include <vector>
+#include "GraphicalObject.h"
+#include "BVH.h"
+#include "Hit.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  The objects of a scene of one concrete type \a T, with their own
+  BVH. The loops below call the methods of \a T, which are thus
+  static and may be inlined when \a T is final. With \a T =
+  GraphicalObject, they are virtual calls.
+  */
+  template <typename T>
+  struct ObjectGroup {
+    /// The objects (owned by the scene).
+    std::vector< T* > objects;
+    /// The hierarchy over objects.
+    BVH bvh;
+
+    /// Removes all objects.
+    void clear()
+    {
+      objects.clear();
+      bvh = BVH();
+    }
+
+    /// Builds the hierarchy over the objects.
+    void build()
+    {
+      std::vector< BoundingBox > boxes;
+      for ( T* obj : objects ) boxes.push_back( obj->boundingBox() );
+      bvh.build( boxes );
+    }
+
+    /// Looks for a hit of \a ray closer than \a tmax (and whose squared
+    /// distance is below \a distanceMin, unless it is -1). Updates all
+    /// parameters but the surface of \a hit if one is found.
+    void closestHit( const Ray& ray, Real& tmax, Real& distanceMin, Hit& hit ) const
+    {
+      if ( objects.empty() ) return;
+      Point3 pOther;
+      int    partOther;
+      auto intersector = [&] ( int i, Real& t ) {
+        T* obj = objects[ i ];
+        if ( obj->rayIntersection( ray, pOther, partOther ) >= 0 ) return;
+        Real distance = (pOther - ray.origin).dot(pOther - ray.origin);
+        if ( distanceMin == -1.0f || distance < distanceMin )
+          {
+            distanceMin  = distance;
+            t            = sqrt( distance );
+            hit.point    = pOther;
+            hit.distance = t;
+            hit.object   = obj;
+            hit.part     = partOther;
+          }
+      };
+      bvh.traverse( ray, tmax, intersector );
+    }
+
+    /// Calls \a attenuate( m ) with the material \a m of every crossing
+    /// of \a ray with an object between \a epsilon and \a max_distance
+    /// (see Scene::occlusion), until it returns 'false'.
+    /// @return 'false' if the light is stopped.
+    template <typename Attenuate>
+    bool transmit( const Ray& ray, Real epsilon, Real max_distance,
+                   Attenuate& attenuate ) const
+    {
+      if ( objects.empty() ) return true;
+      Real tmax = max_distance;
+      auto transmitter = [&] ( int i, Real& t_stop ) {
+        if ( t_stop < 0.0f ) return; // already in shadow
+        T*   obj = objects[ i ];
+        Real t   = epsilon;
+        int  part;
+        while ( obj->nextIntersection( ray, t, max_distance, t, part ) )
+          if ( ! attenuate( obj->getMaterial( ray.origin + ray.direction * t, part ) ) )
+            { t_stop = -1.0f; return; }
+      };
+      bvh.traverse( ray, tmax, transmitter );
+      return tmax >= 0.0f;
+    }
+  };
+
+  /**
+  The objects of a scene grouped by concrete type: one ObjectGroup for
+  each of \a Types, whose dynamic type must match exactly, and a last
+  group of GraphicalObject for the others. Queries visit the groups
+  in this order.
+  */
+  template <typename... Types>
+  struct ObjectGroups;
+
+  /// The last group, called through virtual methods.
+  template <>
+  struct ObjectGroups<> {
+    ObjectGroup< GraphicalObject > group;
+
+    void clear() { group.clear(); }
+    void add( GraphicalObject* obj ) { group.objects.push_back( obj ); }
+    void build() { group.build(); }
+    void closestHit( const Ray& ray, Real& tmax, Real& distanceMin, Hit& hit ) const
+    {
+      group.closestHit( ray, tmax, distanceMin, hit );
+    }
+    template <typename Attenuate>
+    bool transmit( const Ray& ray, Real epsilon, Real max_distance,
+                   Attenuate& attenuate ) const
+    {
+      return group.transmit( ray, epsilon, max_distance, attenuate );
+    }
+  };
+
+  template <typename T, typename... Others>
+  struct ObjectGroups< T, Others... > {
+    ObjectGroup< T >         group;
+    ObjectGroups< Others... > next;
+
+    /// Removes all objects.
+    void clear() { group.clear(); next.clear(); }
+
+    /// Adds \a obj to the group of its type.
+    void add( GraphicalObject* obj )
+    {
+      if ( typeid( *obj ) == typeid( T ) ) group.objects.push_back( static_cast< T* >( obj ) );
+      else next.add( obj );
+    }
+
+    /// Builds the hierarchies of all groups.
+    void build() { group.build(); next.build(); }
+
+    /// Same as ObjectGroup::closestHit, over all groups.
+    void closestHit( const Ray& ray, Real& tmax, Real& distanceMin, Hit& hit ) const
+    {
+      group.closestHit( ray, tmax, distanceMin, hit );
+      next.closestHit( ray, tmax, distanceMin, hit );
+    }
+
+    /// Same as ObjectGroup::transmit, over all groups.
+    template <typename Attenuate>
+    bool transmit( const Ray& ray, Real epsilon, Real max_distance,
+                   Attenuate& attenuate ) const
+    {
+      return group.transmit( ray, epsilon, max_distance, attenuate )
+        && next.transmit( ray, epsilon, max_distance, attenuate );
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _OBJECT_GROUP_H_
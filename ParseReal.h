@@ -0,0 +1,41 @@
+/**
+@file ParseReal.h
+@author JOL
+*/
+#pragma once
+#ifndef _PARSE_REAL_H_
+#define _PARSE_REAL_H_
+
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// Same as strtof, but the decimal point is always '.', whatever the
+  /// locale: Qt sets the locale of the user (e.g. "1,5" in French),
+  /// while scene and OBJ files are written with '.'.
+  inline float parseReal( const char* s, char** end )
+  {
+    const char point = *std::localeconv()->decimal_point;
+    if ( point == '.' ) return std::strtof( s, end );
+    // Copies the number, with the decimal point of the locale.
+    char  buffer[ 64 ];
+    int   n = 0;
+    while ( n < 63 && s[ n ] != '\0' && s[ n ] != point
+            && std::strchr( " \t\r\n", s[ n ] ) == 0 )
+      {
+        buffer[ n ] = s[ n ] == '.' ? point : s[ n ];
+        ++n;
+      }
+    buffer[ n ] = '\0';
+    char* next;
+    float x = std::strtof( buffer, &next );
+    *end = const_cast< char* >( s ) + ( next - buffer );
+    return x;
+  }
+
+} // namespace rt
+
+#endif // #define _PARSE_REAL_H_
@@ -0,0 +1,84 @@
+/**
+@file PixelFilter.h
+@author JOL
+*/
+#pragma once
+#ifndef _PIXEL_FILTER_H_
+#define _PIXEL_FILTER_H_
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include "PointVector.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// Weights the samples taken within a pixel when supersampling. The
+  /// pixel is cut into n x n strata and one sample is taken at the
+  /// center of each stratum; its weight only depends on its offset
+  /// from the center of the pixel.
+  struct PixelFilter {
+    /// The available filters.
+    enum Type {
+      BOX,      ///< all samples have the same weight.
+      TENT,     ///< weight decreases linearly, reaching 0 one pixel away.
+      GAUSSIAN  ///< gaussian of standard deviation half a pixel.
+    };
+
+    /// Constructor from the filter type.
+    PixelFilter( Type type = BOX ) : myType( type ) {}
+
+    /// @return the filter of name \a name ("box", "tent" or "gaussian").
+    /// @param[out] ok set to 'false' if the name is unknown.
+    static PixelFilter fromName( const std::string& name, bool& ok )
+    {
+      ok = true;
+      if ( name == "box" )      return PixelFilter( BOX );
+      if ( name == "tent" )     return PixelFilter( TENT );
+      if ( name == "gaussian" ) return PixelFilter( GAUSSIAN );
+      ok = false;
+      return PixelFilter();
+    }
+
+    /// @return the type of the filter.
+    Type type() const { return myType; }
+
+    /// @return the (unnormalized) weight of a sample at offset (dx,dy)
+    /// from the center of the pixel, in pixels.
+    Real weight( Real dx, Real dy ) const
+    {
+      switch ( myType ) {
+      case TENT:     return ( 1.0f - std::fabs( dx ) ) * ( 1.0f - std::fabs( dy ) );
+      case GAUSSIAN: return std::exp( -2.0f * ( dx * dx + dy * dy ) );
+      default:       return 1.0f;
+      }
+    }
+
+    /// @return the offset of the \a i-th stratum out of \a n along one
+    /// axis, from the center of the pixel (0 when n is 1).
+    static Real offset( int i, int n )
+    {
+      return ( i + 0.5f ) / (Real) n - 0.5f;
+    }
+
+    /// @return the normalized weights of the n x n samples of a pixel,
+    /// the sample (i,j) being at index j*n+i.
+    std::vector< Real > weights( int n ) const
+    {
+      std::vector< Real > w( n * n );
+      Real sum = 0.0f;
+      for ( int j = 0; j < n; ++j )
+        for ( int i = 0; i < n; ++i )
+          sum += ( w[ j * n + i ] = weight( offset( i, n ), offset( j, n ) ) );
+      for ( Real& x : w ) x /= sum;
+      return w;
+    }
+
+  private:
+    Type myType;
+  };
+
+} // namespace rt
+
+#endif // #define _PIXEL_FILTER_H_
@@ -0,0 +1,204 @@
+/**
+@file PixelFormats.h
+@author JOL
+*/
+#pragma once
+#ifndef _PIXEL_FORMATS_H_
+#define _PIXEL_FORMATS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "Color.h"
+#include "Image2D.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A color stored as 3 half floats (6 bytes instead of 12): 11
+  /// significant bits, values up to 65504.
+  struct HalfColor {
+    uint16_t rgb[ 3 ];
+
+    HalfColor() { rgb[ 0 ] = rgb[ 1 ] = rgb[ 2 ] = 0; }
+    explicit HalfColor( const Color& c )
+    {
+      rgb[ 0 ] = toHalf( c.r() ); rgb[ 1 ] = toHalf( c.g() ); rgb[ 2 ] = toHalf( c.b() );
+    }
+    Color color() const
+    {
+      return Color( toFloat( rgb[ 0 ] ), toFloat( rgb[ 1 ] ), toFloat( rgb[ 2 ] ) );
+    }
+
+    /// @return the half float closest to \a f (ties to even).
+    static uint16_t toHalf( float f )
+    {
+      uint32_t x;
+      std::memcpy( &x, &f, sizeof( x ) );
+      const uint32_t sign = ( x >> 16 ) & 0x8000;
+      x &= 0x7FFFFFFF;
+      if ( x >= 0x7F800000 ) // infinity or NaN
+        return sign | 0x7C00 | ( x > 0x7F800000 ? 0x200 : 0 );
+      if ( x >= 0x477FF000 ) return sign | 0x7C00; // overflow
+      if ( x < 0x38800000 ) // subnormal or zero
+        {
+          if ( x < 0x33000000 ) return sign;
+          const uint32_t e = x >> 23;
+          const uint32_t m = ( x & 0x7FFFFF ) | 0x800000;
+          const uint32_t s = 126 - e; // 14 to 24
+          uint32_t h = m >> s;
+          const uint32_t rest = m & ( ( 1u << s ) - 1 ), half = 1u << ( s - 1 );
+          if ( rest > half || ( rest == half && ( h & 1 ) ) ) ++h;
+          return sign | h;
+        }
+      uint32_t h = ( x - 0x38000000 ) >> 13;
+      const uint32_t rest = x & 0x1FFF;
+      if ( rest > 0x1000 || ( rest == 0x1000 && ( h & 1 ) ) ) ++h;
+      return sign | h;
+    }
+
+    /// @return the float of half float \a h.
+    static float toFloat( uint16_t h )
+    {
+      const uint32_t sign = ( h & 0x8000u ) << 16;
+      uint32_t e = ( h >> 10 ) & 0x1F, m = h & 0x3FF, x;
+      if ( e == 0x1F ) x = sign | 0x7F800000 | ( m << 13 );
+      else if ( e != 0 ) x = sign | ( ( e + 112 ) << 23 ) | ( m << 13 );
+      else if ( m == 0 ) x = sign;
+      else
+        { // subnormal: normalizes it.
+          e = 113;
+          while ( ( m & 0x400 ) == 0 ) { m <<= 1; --e; }
+          x = sign | ( e << 23 ) | ( ( m & 0x3FF ) << 13 );
+        }
+      float f;
+      std::memcpy( &f, &x, sizeof( f ) );
+      return f;
+    }
+  };
+
+  /// A color stored as 3 mantissas sharing one exponent (4 bytes), as
+  /// in Radiance HDR images: about 1% precision relative to the
+  /// largest channel, over a huge range. Negative values become 0.
+  struct RGBEColor {
+    unsigned char rgbe[ 4 ];
+
+    RGBEColor() { rgbe[ 0 ] = rgbe[ 1 ] = rgbe[ 2 ] = rgbe[ 3 ] = 0; }
+    explicit RGBEColor( const Color& c )
+    {
+      const float v = c.max();
+      if ( ! ( v >= 1e-32f ) ) { rgbe[ 0 ] = rgbe[ 1 ] = rgbe[ 2 ] = rgbe[ 3 ] = 0; return; }
+      int e;
+      const float s = std::frexp( v, &e ) * 256.0f / v;
+      rgbe[ 0 ] = (unsigned char) ( std::max( 0.0f, c.r() ) * s );
+      rgbe[ 1 ] = (unsigned char) ( std::max( 0.0f, c.g() ) * s );
+      rgbe[ 2 ] = (unsigned char) ( std::max( 0.0f, c.b() ) * s );
+      rgbe[ 3 ] = (unsigned char) ( e + 128 );
+    }
+    Color color() const
+    {
+      if ( rgbe[ 3 ] == 0 ) return Color( 0.0f, 0.0f, 0.0f );
+      const float f = std::ldexp( 1.0f, (int) rgbe[ 3 ] - ( 128 + 8 ) );
+      return Color( ( rgbe[ 0 ] + 0.5f ) * f, ( rgbe[ 1 ] + 0.5f ) * f,
+                    ( rgbe[ 2 ] + 0.5f ) * f );
+    }
+  };
+
+  /// A color stored as 3 bytes encoded with the sRGB curve, for final
+  /// images: values are clamped to [0,1]. Dark colors keep more
+  /// precision than with the linear quantization of Image2DWriter.
+  struct SRGBColor {
+    unsigned char rgb[ 3 ];
+
+    SRGBColor() { rgb[ 0 ] = rgb[ 1 ] = rgb[ 2 ] = 0; }
+    explicit SRGBColor( const Color& c )
+    {
+      rgb[ 0 ] = encode( c.r() ); rgb[ 1 ] = encode( c.g() ); rgb[ 2 ] = encode( c.b() );
+    }
+    Color color() const
+    {
+      const float* t = table();
+      return Color( t[ rgb[ 0 ] ], t[ rgb[ 1 ] ], t[ rgb[ 2 ] ] );
+    }
+
+    /// @return the sRGB byte of the linear value \a v.
+    static unsigned char encode( float v )
+    {
+      if ( ! ( v > 0.0f ) ) return 0;
+      if ( v >= 1.0f ) return 255;
+      const float s = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow( v, 1.0f / 2.4f ) - 0.055f;
+      return (unsigned char) ( s * 255.0f + 0.5f );
+    }
+    /// @return the linear values of the 256 sRGB bytes.
+    static const float* table()
+    {
+      static const std::vector< float > t = [] () {
+        std::vector< float > values( 256 );
+        for ( int i = 0; i < 256; ++i )
+          {
+            const float s = i / 255.0f;
+            values[ i ] = s <= 0.04045f ? s / 12.92f : std::pow( ( s + 0.055f ) / 1.055f, 2.4f );
+          }
+        return values;
+      } ();
+      return t.data();
+    }
+  };
+
+  /// Accessor (see Image2D::GenericIterator) that reads and writes a
+  /// pixel of storage type \a TStorage as a Color, converting it on
+  /// the fly. \a TStorage must be constructible from a Color and have
+  /// a method color().
+  template <typename TStorage>
+  struct ColorConverter {
+    typedef TStorage Argument;
+    typedef Color    Value;
+    /// Writing through a reference converts the color.
+    struct Reference {
+      Argument& arg;
+      Reference& operator=( const Value& c ) { arg = Argument( c ); return *this; }
+      operator Value() const { return arg.color(); }
+    };
+    static Value     access( const Argument& arg ) { return arg.color(); }
+    static Reference access( Argument& arg )       { return Reference{ arg }; }
+  };
+
+  /// Accessor of Color pixels as Color (no conversion).
+  struct ColorAccessor {
+    typedef Color  Argument;
+    typedef Color  Value;
+    typedef Color& Reference;
+    static Value     access( const Argument& arg ) { return arg; }
+    static Reference access( Argument& arg )       { return arg; }
+  };
+
+  /// The accessor that reads and writes pixels of type \a TValue as
+  /// colors: Renderer::render works with any image whose pixels have
+  /// one.
+  template <typename TValue>
+  struct PixelFormat { typedef ColorConverter< TValue > Accessor; };
+  template <>
+  struct PixelFormat< Color > { typedef ColorAccessor Accessor; };
+
+  /// Copies \a src into \a dst, converting pixels through colors.
+  template <typename TIn, typename TOut>
+  void convertImage( const Image2D< TIn >& src, Image2D< TOut >& dst )
+  {
+    typedef typename PixelFormat< TIn >::Accessor  InAccessor;
+    typedef typename PixelFormat< TOut >::Accessor OutAccessor;
+    dst = Image2D< TOut >( src.w(), src.h() );
+    auto out = dst.template begin< OutAccessor >();
+    for ( auto it = src.template begin< InAccessor >(), itE = src.template end< InAccessor >();
+          it != itE; ++it, ++out )
+      *out = *it;
+  }
+
+  static_assert( sizeof( HalfColor ) == 6, "HalfColor must be 3 packed half floats" );
+  static_assert( sizeof( RGBEColor ) == 4, "RGBEColor must be 4 packed bytes" );
+  static_assert( sizeof( SRGBColor ) == 3, "SRGBColor must be 3 packed bytes" );
+
+} // namespace rt
+
+#endif // #define _PIXEL_FORMATS_H_
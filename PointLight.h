@@ -6,8 +6,11 @@
 #ifndef _POINT_LIGHT_H_
 #define _POINT_LIGHT_H_
 
+#ifndef RT_HEADLESS
 #include <QGLViewer/manipulatedFrame.h>
+#endif
 #include "Light.h"
+#include "Material.h"
 
 /// Namespace RayTracer
 namespace rt {
@@ -16,7 +19,7 @@ namespace rt {
   /// infinite distance. Such light does not suffer from any
   /// attenuation. One can also draw it in order to be
   /// displayed and manipulated.
-  struct PointLight : public Light {
+  struct PointLight final : public Light {
     /// Specifies which OpenGL light it is (necessary for draw())
     GLenum number; // GL_LIGHT0, GL_LIGHT1, etc
     /// The position of the light in homogeneous coordinates
@@ -25,8 +28,10 @@ namespace rt {
     Color emission;
     /// The material (global to the light).
     Material material;
+#ifndef RT_HEADLESS
     /// Used to store a manipulator to move the light in space.
     qglviewer::ManipulatedFrame* manipulator;
+#endif
 
     /// Constructor. \a light_number must be different for every light
     /// (GL_LIGHT0, GL_LIGHT1, etc).
@@ -37,10 +42,13 @@ namespace rt {
                 Color diffuse_color  = Color( 1.0, 1.0, 1.0 ),
                 Color specular_color = Color( 1.0, 1.0, 1.0 ) )
       : number( light_number ), position( pos ), emission( emission_color ),
-        material( ambient_color, diffuse_color, specular_color ),
-        manipulator( 0 )
+        material( ambient_color, diffuse_color, specular_color )
+#ifndef RT_HEADLESS
+      , manipulator( 0 )
+#endif
     {}
     
+#ifndef RT_HEADLESS
     /// Destructor.
     ~PointLight()
     {
@@ -81,11 +89,24 @@ namespace rt {
           pos[1] = float(pos2.y);
           pos[2] = float(pos2.z);
           pos[3] = 1.0f;
-          position = pos;
+          // Written only when it moves, since the scene may be
+          // rendered meanwhile (see Viewer::draw).
+          if ( pos != position ) position = pos;
         }
       glLightfv( number, GL_POSITION, pos);
     }
 
+    /// @return 'true' if the manipulator is no longer at the position
+    /// of the light.
+    bool moved() const
+    {
+      if ( manipulator == 0 ) return false;
+      qglviewer::Vec pos2 = manipulator->position();
+      return position[ 3 ] != 1.0f
+        || position[ 0 ] != float(pos2.x) || position[ 1 ] != float(pos2.y)
+        || position[ 2 ] != float(pos2.z);
+    }
+
     /// This method is called by Scene::draw() at each frame to
     /// redisplay objects in the OpenGL window.
     void draw( Viewer& viewer )
@@ -95,6 +116,14 @@ namespace rt {
       else
 	viewer.drawSomeLight( number );
     }
+#else
+    /// Nothing to initialize without OpenGL window.
+    void init( Viewer& /* viewer */ ) {}
+    /// Nothing to set without OpenGL window.
+    void light( Viewer& /* viewer */ ) {}
+    /// Nothing to draw without OpenGL window.
+    void draw( Viewer& /* viewer */ ) {}
+#endif
 
     /// Given the point \a p, returns the normalized direction to this light.
     Vector3 direction( const Vector3& p ) const
@@ -106,6 +135,16 @@ namespace rt {
       return pos / pos.norm();
     }
 
+    /// @return the distance from \a p to this light (infinite if the
+    /// light is at infinity).
+    Real distance( const Vector3& p ) const
+    {
+      if ( position[ 3 ] == 0.0 ) return std::numeric_limits<Real>::infinity();
+      Vector3 pos( position.data() );
+      pos /= position[ 3 ];
+      return ( pos - p ).norm();
+    }
+
     /// @return the color of this light viewed from the given point \a p.
     Color color( const Vector3& /* p */ ) const
     {
@@ -0,0 +1,142 @@
+/**
+@file ProgressReporter.h
+@author JOL
+*/
+#pragma once
+#ifndef _PROGRESS_REPORTER_H_
+#define _PROGRESS_REPORTER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Reports the progress of a rendering: fraction of pixels done, rays
+  per second, elapsed time and estimated remaining time (ETA).
+
+  Rendering threads call add() after each tile. It costs two atomic
+  additions and a clock reading: the report itself is written by at
+  most one thread per interval, the one that wins the next report
+  date, so that threads never wait for each other.
+
+  The report is either a progress bar for a terminal (BAR) or, for
+  programs that poll the progress, one JSON object per line (JSON).
+  */
+  struct ProgressReporter {
+    /// The output formats.
+    enum Format { NONE, BAR, JSON };
+
+    /// Reports the progress of \a total_pixels pixels to \a out in
+    /// format \a format, at most once every \a interval seconds.
+    ProgressReporter( std::ostream& out, Format format, long total_pixels,
+                      double interval = 0.25 )
+      : output( out ), myFormat( format ),
+        myTotalPixels( total_pixels > 0 ? total_pixels : 1 ),
+        myInterval( (long long)( interval * 1e9 ) ),
+        myStart( std::chrono::steady_clock::now() ),
+        myPixels( 0 ), myRays( 0 ), myNextReport( 0 ), myRotation( 0 )
+    {}
+
+    /// Reads the name of a format (none, bar or json).
+    /// @param[out] ok 'false' if \a name is not a format.
+    static Format fromName( const std::string& name, bool& ok )
+    {
+      ok = true;
+      if ( name == "none" ) return NONE;
+      if ( name == "bar" )  return BAR;
+      if ( name == "json" ) return JSON;
+      ok = false;
+      return BAR;
+    }
+
+    /// Counts \a pixels more pixels done, for which \a rays rays were
+    /// traced. It may be called concurrently by several threads.
+    void add( long pixels, long rays )
+    {
+      myPixels += pixels;
+      myRays   += rays;
+      if ( myFormat == NONE ) return;
+      long long now  = nanoseconds();
+      long long next = myNextReport.load( std::memory_order_relaxed );
+      if ( now < next ) return;
+      if ( ! myNextReport.compare_exchange_strong( next, now + myInterval ) ) return;
+      report( now, false );
+    }
+
+    /// Writes the last report, once all pixels are done.
+    void finish()
+    {
+      if ( myFormat != NONE ) report( nanoseconds(), true );
+    }
+
+    /// Where the progress is written.
+    std::ostream& output;
+
+  private:
+    Format    myFormat;
+    long      myTotalPixels;
+    long long myInterval;   // in nanoseconds
+    std::chrono::steady_clock::time_point myStart;
+    std::atomic< long >      myPixels;
+    std::atomic< long >      myRays;
+    /// Date of the next report, in nanoseconds since myStart.
+    std::atomic< long long > myNextReport;
+    /// Serializes the reports (the last one may meet a late one).
+    std::mutex myMutex;
+    int        myRotation;
+
+    long long nanoseconds() const
+    {
+      return std::chrono::duration_cast< std::chrono::nanoseconds >
+        ( std::chrono::steady_clock::now() - myStart ).count();
+    }
+
+    void report( long long now, bool last )
+    {
+      static const int WIDTH = 60;
+      static const char* rotation_string = "|\\-/";
+      std::lock_guard< std::mutex > lock( myMutex );
+      const long   pixels   = myPixels.load();
+      const long   rays     = myRays.load();
+      const double elapsed  = now * 1e-9;
+      const double fraction = std::min( 1.0, (double) pixels / myTotalPixels );
+      const double rate     = elapsed > 0.0 ? rays / elapsed : 0.0;
+      const double eta      = pixels > 0 ? elapsed * ( 1.0 - fraction ) / fraction : -1.0;
+      if ( myFormat == JSON )
+        {
+          output << "{ \"progress\": " << fraction
+                 << ", \"pixels\": " << pixels
+                 << ", \"total_pixels\": " << myTotalPixels
+                 << ", \"rays\": " << rays
+                 << ", \"rays_per_s\": " << rate
+                 << ", \"elapsed_s\": " << elapsed
+                 << ", \"eta_s\": ";
+          if ( eta < 0.0 ) output << "null";
+          else output << eta;
+          output << ", \"done\": " << ( last ? "true" : "false" ) << " }" << std::endl;
+          return;
+        }
+      int dotz = static_cast<int>( floor( fraction * WIDTH ) );
+      output << "[";
+      for ( int i = 0; i < WIDTH; ++i ) output << ( i < dotz ? '#' : ' ' );
+      myRotation = ( myRotation + 1 ) % 4;
+      output << "] " << ( last ? ' ' : rotation_string[ myRotation ] )
+             << " " << (int)( fraction * 100 ) << "% "
+             << floor( rate * 1e-4 + 0.5 ) / 100.0 << " Mrays/s, "
+             << (int) elapsed << " s";
+      if ( ! last && eta >= 0.0 ) output << ", ETA " << (int) ceil( eta ) << " s";
+      output << "        " << ( last ? "\n" : "\r" );
+      output.flush();
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _PROGRESS_REPORTER_H_
@@ -0,0 +1,165 @@
+/**
+@file ProgressiveRenderer.h
+@author JOL
+*/
+#pragma once
+#ifndef _PROGRESSIVE_RENDERER_H_
+#define _PROGRESSIVE_RENDERER_H_
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "GBuffer.h"
+#include "Image2D.h"
+#include "PixelFilter.h"
+#include "Renderer.h"
+#include "Scene.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Renders a view of a scene in a background thread, by successive
+  passes of increasing quality: first with coarse pixels (1/8, 1/4,
+  1/2 of the resolution), then at full resolution with 1 to 5 x 5
+  samples per pixel. The last finished pass is available at any time
+  (see latest), and a new view cancels the passes in progress.
+
+  Passes of at most MAX_GBUFFER_SAMPLES samples keep a G-buffer, so
+  that they are only relit when nothing but lights changed since
+  they were last rendered (see GBuffer).
+
+  The scene must not change while passes are rendered, lights
+  included: call stop() before moving them.
+  */
+  struct ProgressiveRenderer {
+    /// Number of passes.
+    static const int NB_PASSES = 8;
+    /// Maximal number of samples of a pass with a G-buffer.
+    static const long MAX_GBUFFER_SAMPLES = 1L << 17;
+    /// Maximal number of rays per sample in a G-buffer.
+    static const int GBUFFER_RECORDS = 16;
+
+    /// What is rendered: camera (see Renderer::setViewBox), final
+    /// resolution and depth of rays.
+    struct View {
+      Point3  origin;
+      Vector3 dirUL, dirUR, dirLL, dirLR;
+      int     width, height;
+      int     max_depth;
+
+      bool operator==( const View& other ) const
+      {
+        return origin == other.origin && dirUL == other.dirUL && dirUR == other.dirUR
+          && dirLL == other.dirLL && dirLR == other.dirLR && width == other.width
+          && height == other.height && max_depth == other.max_depth;
+      }
+      bool operator!=( const View& other ) const { return ! ( *this == other ); }
+    };
+
+    /// Constructor. Nothing is rendered.
+    ProgressiveRenderer( Scene& scene )
+      : ptrScene( &scene ), myCancel( false ), myPass( -1 ),
+        myGBuffers( NB_PASSES, GBuffer( GBUFFER_RECORDS ) )
+    {
+      myView.width = myView.height = myView.max_depth = 0;
+    }
+
+    /// Destructor. Stops the rendering.
+    ~ProgressiveRenderer() { stop(); }
+
+    /// Gets the resolution divisor and the number of samples (per
+    /// axis) of pass \a k.
+    static void pass( int k, int& divisor, int& samples )
+    {
+      divisor = k < 3 ? 8 >> k : 1;
+      samples = k < 3 ? 1 : k - 2;
+    }
+
+    /// Stops the current passes and starts rendering \a view.
+    void start( const View& view )
+    {
+      stop();
+      if ( ! ptrScene->hasValidBVH() ) ptrScene->buildBVH();
+      myView   = view;
+      myPass   = -1;
+      myCancel = false;
+      myThread = std::thread( &ProgressiveRenderer::run, this );
+    }
+
+    /// Cancels the current passes, and waits for the thread to stop.
+    void stop()
+    {
+      myCancel = true;
+      if ( myThread.joinable() ) myThread.join();
+    }
+
+    /// @return the view that is (or was last) rendered.
+    const View& view() const { return myView; }
+
+    /// @return the last finished pass (-1 if none).
+    int lastPass() const { return myPass; }
+
+    /// @return 'true' if all passes of the view are finished.
+    bool finished() const { return myPass == NB_PASSES - 1; }
+
+    /// Copies the image of the last finished pass into \a image if it
+    /// is newer than pass \a pass, which becomes its number.
+    /// @return 'true' if \a image was copied.
+    bool latest( Image2D<Color>& image, int& pass )
+    {
+      std::lock_guard< std::mutex > lock( myMutex );
+      if ( myPass <= pass ) return false;
+      image = myImage;
+      pass  = myPass;
+      return true;
+    }
+
+  private:
+    Scene*            ptrScene;
+    View              myView;
+    std::thread       myThread;
+    std::atomic<bool> myCancel;
+    /// Protects myImage and myPass.
+    std::mutex        myMutex;
+    Image2D<Color>    myImage;
+    std::atomic<int>  myPass;
+    /// The G-buffers of the passes (only used by the thread).
+    std::vector< GBuffer > myGBuffers;
+
+    /// Renders the passes, until cancelled.
+    void run()
+    {
+      Renderer renderer( *ptrScene );
+      renderer.setViewBox( myView.origin, myView.dirUL, myView.dirUR,
+                           myView.dirLL, myView.dirLR );
+      renderer.setProgress( ProgressReporter::NONE );
+      renderer.setCancel( &myCancel );
+      // Keeps one core for the window.
+      renderer.setThreads( std::max( 1, renderer.nbThreads() - 1 ) );
+      Image2D<Color> image;
+      for ( int k = 0; k < NB_PASSES && ! myCancel; ++k )
+        {
+          int divisor, samples;
+          pass( k, divisor, samples );
+          const int w = std::max( 2, myView.width / divisor );
+          const int h = std::max( 2, myView.height / divisor );
+          renderer.setResolution( w, h );
+          renderer.setGBuffer( (long) w * h * samples * samples <= MAX_GBUFFER_SAMPLES
+                               ? &myGBuffers[ k ] : 0 );
+          renderer.setSupersampling( samples, PixelFilter( samples > 1
+                                                           ? PixelFilter::TENT
+                                                           : PixelFilter::BOX ) );
+          renderer.render( image, myView.max_depth );
+          if ( myCancel ) break;
+          std::lock_guard< std::mutex > lock( myMutex );
+          myImage = image;
+          myPass  = k;
+        }
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _PROGRESSIVE_RENDERER_H_
@@ -0,0 +1,72 @@
+/**
+@file RayPacket.h
+@author JOL
+*/
+#pragma once
+#ifndef _RAY_PACKET_H_
+#define _RAY_PACKET_H_
+
+#include <limits>
+#include "Ray.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A packet of up to 8 coherent rays (typically neighbouring camera
+  /// rays), stored as a structure of arrays so that one SIMD register
+  /// holds one coordinate of all rays. Lanes beyond size() are inactive.
+  struct RayPacket {
+    /// Maximal number of rays in a packet (one AVX2 register).
+    static const int SIZE = 8;
+
+    /// The rays themselves.
+    Ray  rays[ SIZE ];
+    /// Origins.
+    Real ox[ SIZE ], oy[ SIZE ], oz[ SIZE ];
+    /// Unit directions.
+    Real dx[ SIZE ], dy[ SIZE ], dz[ SIZE ];
+    /// Inverse directions, for the slab tests.
+    Real ix[ SIZE ], iy[ SIZE ], iz[ SIZE ];
+    /// Distance of the closest hit so far (for each ray).
+    Real tmax[ SIZE ];
+    /// Index of the closest sphere so far (for each ray), -1 if none.
+    int  sphere[ SIZE ];
+    /// Number of active rays.
+    int  nb;
+
+    /// Default constructor. The packet is empty.
+    RayPacket() : nb( 0 ) {}
+
+    /// @return the number of active rays.
+    int size() const { return nb; }
+
+    /// Adds the ray \a ray to the packet (which must not be full).
+    void add( const Ray& ray )
+    {
+      int i = nb++;
+      rays[ i ] = ray;
+      ox[ i ] = ray.origin[ 0 ];    oy[ i ] = ray.origin[ 1 ];    oz[ i ] = ray.origin[ 2 ];
+      dx[ i ] = ray.direction[ 0 ]; dy[ i ] = ray.direction[ 1 ]; dz[ i ] = ray.direction[ 2 ];
+      ix[ i ] = 1.0f / dx[ i ];     iy[ i ] = 1.0f / dy[ i ];     iz[ i ] = 1.0f / dz[ i ];
+      tmax[ i ]   = std::numeric_limits<Real>::max();
+      sphere[ i ] = -1;
+    }
+
+    /// Fills inactive lanes with copies of the first ray that can never
+    /// hit anything, so that kernels may process all lanes blindly.
+    void pad()
+    {
+      for ( int i = nb; i < SIZE; ++i )
+        {
+          ox[ i ] = ox[ 0 ]; oy[ i ] = oy[ 0 ]; oz[ i ] = oz[ 0 ];
+          dx[ i ] = dx[ 0 ]; dy[ i ] = dy[ 0 ]; dz[ i ] = dz[ 0 ];
+          ix[ i ] = ix[ 0 ]; iy[ i ] = iy[ 0 ]; iz[ i ] = iz[ 0 ];
+          tmax[ i ]   = -1.0f;
+          sphere[ i ] = -1;
+        }
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _RAY_PACKET_H_
@@ -0,0 +1,66 @@
+/**
+@file RayQueue.h
+@author JOL
+*/
+#pragma once
+#ifndef _RAY_QUEUE_H_
+#define _RAY_QUEUE_H_
+
+#include <vector>
+#include "Color.h"
+#include "Ray.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// The rays of one stage of the wavefront mode of Renderer, stored
+  /// as a structure of arrays. Each ray has the weight of its color in
+  /// the color of its camera sample, the index of this sample and its
+  /// budget of rays (see Renderer::setRayBudget).
+  struct RayQueue {
+    std::vector< Ray >   rays;
+    std::vector< Color > weights;
+    std::vector< int >   samples;
+    std::vector< int >   budgets;
+
+    /// @return the number of rays.
+    int size() const { return (int) rays.size(); }
+
+    /// Removes all rays (the memory is kept for the next stage).
+    void clear()
+    {
+      rays.clear();
+      weights.clear();
+      samples.clear();
+      budgets.clear();
+    }
+
+    /// Adds a ray at the end of the queue.
+    void push( const Ray& ray, const Color& weight, int sample, int budget )
+    {
+      rays.push_back( ray );
+      weights.push_back( weight );
+      samples.push_back( sample );
+      budgets.push_back( budget );
+    }
+  };
+
+  /// The light of one light source reflected at a hit, before shadows:
+  /// the diffuse term must be multiplied by the light that reaches
+  /// the hit along the shadow ray (see Scene::occlusion).
+  struct LightSample {
+    /// The ray from the hit toward the light.
+    Ray   shadow_ray;
+    /// The distance from the hit to the light.
+    Real  distance;
+    /// The color of the light at the hit.
+    Color color;
+    /// The diffuse term, without shadow.
+    Color diffuse;
+    /// The specular term.
+    Color specular;
+  };
+
+} // namespace rt
+
+#endif // #define _RAY_QUEUE_H_
@@ -0,0 +1,76 @@
+/**
+@file RayStack.h
+@author JOL
+*/
+#pragma once
+#ifndef _RAY_STACK_H_
+#define _RAY_STACK_H_
+
+#include <cassert>
+#include <climits>
+#include "Color.h"
+#include "Ray.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// The secondary rays that remain to be traced for one camera ray,
+  /// each with the weight of its color in the final color (the
+  /// product of the coefficients of the surfaces it comes from) and
+  /// the number of rays it may spawn (see Renderer::setRayBudget). It
+  /// replaces the recursion of Renderer::trace: each traced ray pushes
+  /// at most two rays of smaller depth, and the last pushed is traced
+  /// first, so that a ray of depth d never needs more than d + 1
+  /// entries. The stack lives on the stack of the rendering thread.
+  struct RayStack {
+    /// Maximal number of pending rays.
+    static const int CAPACITY = 64;
+
+    /// Maximal depth of camera rays, whose trees never need more than
+    /// CAPACITY entries. Depths given by the user are checked against it.
+    static const int MAX_DEPTH = CAPACITY - 2;
+
+    /// Budget of a ray whose tree of rays is not limited.
+    static const int NO_LIMIT = INT_MAX;
+
+    /// A ray waiting to be traced.
+    struct Entry {
+      Ray   ray;
+      Color weight;
+      /// Maximal number of rays in the tree of this ray, itself included.
+      int   budget;
+    };
+
+    /// Default constructor. The stack is empty.
+    RayStack() : nb( 0 ) {}
+
+    /// @return 'true' if no ray remains.
+    bool empty() const { return nb == 0; }
+
+    /// @return the number of pending rays.
+    int size() const { return nb; }
+
+    /// Adds \a ray with weight \a weight and budget \a budget. The
+    /// stack cannot overflow for depths up to MAX_DEPTH; beyond, rays
+    /// would be dropped.
+    void push( const Ray& ray, const Color& weight, int budget = NO_LIMIT )
+    {
+      assert( nb < CAPACITY && "ray deeper than RayStack::MAX_DEPTH" );
+      if ( nb == CAPACITY ) return;
+      entries[ nb ].ray    = ray;
+      entries[ nb ].weight = weight;
+      entries[ nb ].budget = budget;
+      ++nb;
+    }
+
+    /// Removes and returns the last pushed ray.
+    const Entry& pop() { return entries[ --nb ]; }
+
+  private:
+    Entry entries[ CAPACITY ];
+    int   nb;
+  };
+
+} // namespace rt
+
+#endif // #define _RAY_STACK_H_
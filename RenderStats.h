@@ -0,0 +1,249 @@
+/**
+@file RenderStats.h
+@author JOL
+*/
+#pragma once
+#ifndef _RENDER_STATS_H_
+#define _RENDER_STATS_H_
+
+#include <algorithm>
+#include <chrono>
+#include <ostream>
+#include <vector>
+#include "TileScheduler.h"
+
+/// Counts what a rendering costs, when the program is compiled with
+/// RT_STATS defined (see STATS_FLAGS in ray-tracer.pro). Otherwise
+/// RT_STAT expands to nothing and the timers are empty, so that the
+/// counters cost nothing at all.
+#ifdef RT_STATS
+#define RT_STAT( statement )                                            \
+  do { if ( rt::RenderStats* rt_stats = rt::RenderStats::current() )    \
+      rt_stats->statement; } while ( 0 )
+#else
+#define RT_STAT( statement ) do {} while ( 0 )
+#endif
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  The statistics of a rendering. Each rendering thread counts in its
+  own RenderStats, the one returned by current(), without any
+  synchronization; Renderer merges them when the threads are done.
+
+  Times are summed over threads, except the time of Stage TILES,
+  which is the wall time of the tiles.
+  */
+  struct RenderStats {
+    /// 'true' if the program is compiled with RT_STATS.
+#ifdef RT_STATS
+    static const bool ENABLED = true;
+#else
+    static const bool ENABLED = false;
+#endif
+
+    /// The kinds of rays.
+    enum Kind { PRIMARY, REFLECTION, REFRACTION, SHADOW, NB_KINDS };
+    /// The timed stages: BVH construction, tiles, output to an image
+    /// sink, and the stages of the wavefront mode.
+    enum Stage { BUILD, TILES, SINK, INTERSECTION, SHADING, SHADOWS, ACCUMULATION,
+                 NB_STAGES };
+    /// Number of bins of the depth histogram (the last one gathers
+    /// the deeper rays).
+    static const int NB_DEPTHS = 64;
+    /// Number of slowest tiles that are kept.
+    static const int NB_SLOWEST = 8;
+
+    /// A tile with its rendering time.
+    struct TileTime {
+      Tile   tile;
+      double seconds;
+      bool operator<( const TileTime& other ) const { return seconds > other.seconds; }
+    };
+
+    /// The depth of camera rays, given to reset.
+    int    max_depth;
+    /// Number of rays traced of each kind.
+    long   rays[ NB_KINDS ];
+    /// Number of primitives tested against a ray or a packet of rays
+    /// (i.e. in the visited leaves of the hierarchies).
+    long   primitive_tests;
+    /// Number of nodes of the hierarchies visited by a ray or a packet.
+    long   node_visits;
+    /// Number of reflected or refracted rays culled for their small
+    /// weight (see Renderer::setCulling).
+    long   culled_rays;
+    /// Number of rays (shadow rays excepted) per number of bounces
+    /// since the camera.
+    long   depths[ NB_DEPTHS ];
+    /// Time spent in each stage, in seconds.
+    double stage_seconds[ NB_STAGES ];
+    /// Number of rendered tiles.
+    long   nb_tiles;
+    /// Total, shortest and longest times of the tiles, in seconds.
+    double tile_seconds, tile_min, tile_max;
+    /// The slowest tiles, the slowest first.
+    std::vector< TileTime > slowest;
+
+    /// Constructor. All counters are zero.
+    RenderStats( int depth = 0 ) { reset( depth ); }
+
+    /// Sets all counters to zero, for a rendering of depth \a depth.
+    void reset( int depth )
+    {
+      max_depth = depth;
+      std::fill( rays, rays + NB_KINDS, 0L );
+      primitive_tests = 0;
+      node_visits     = 0;
+      culled_rays     = 0;
+      std::fill( depths, depths + NB_DEPTHS, 0L );
+      std::fill( stage_seconds, stage_seconds + NB_STAGES, 0.0 );
+      nb_tiles     = 0;
+      tile_seconds = tile_min = tile_max = 0.0;
+      slowest.clear();
+    }
+
+    /// Counts a ray of kind \a kind that has still \a depth bounces
+    /// to go (see Ray::depth).
+    void ray( Kind kind, int depth )
+    {
+      ++rays[ kind ];
+      if ( kind == SHADOW ) return;
+      int d = std::max( 0, std::min( max_depth - depth, NB_DEPTHS - 1 ) );
+      ++depths[ d ];
+    }
+
+    /// Counts \a tile, rendered in \a seconds.
+    void tile( const Tile& t, double seconds )
+    {
+      tile_min = nb_tiles == 0 ? seconds : std::min( tile_min, seconds );
+      tile_max = std::max( tile_max, seconds );
+      tile_seconds += seconds;
+      ++nb_tiles;
+      keepSlowest( TileTime{ t, seconds } );
+    }
+
+    /// Adds the counters of \a other to these ones.
+    void merge( const RenderStats& other )
+    {
+      for ( int k = 0; k < NB_KINDS; ++k ) rays[ k ] += other.rays[ k ];
+      primitive_tests += other.primitive_tests;
+      node_visits     += other.node_visits;
+      culled_rays     += other.culled_rays;
+      for ( int d = 0; d < NB_DEPTHS; ++d ) depths[ d ] += other.depths[ d ];
+      for ( int s = 0; s < NB_STAGES; ++s ) stage_seconds[ s ] += other.stage_seconds[ s ];
+      if ( other.nb_tiles > 0 )
+        {
+          tile_min = nb_tiles == 0 ? other.tile_min : std::min( tile_min, other.tile_min );
+          tile_max = std::max( tile_max, other.tile_max );
+        }
+      nb_tiles     += other.nb_tiles;
+      tile_seconds += other.tile_seconds;
+      for ( const TileTime& t : other.slowest ) keepSlowest( t );
+    }
+
+    /// @return the number of rays of all kinds.
+    long totalRays() const
+    {
+      long n = 0;
+      for ( int k = 0; k < NB_KINDS; ++k ) n += rays[ k ];
+      return n;
+    }
+
+    /// Writes the statistics to \a output as a JSON object.
+    void writeJSON( std::ostream& output ) const
+    {
+      static const char* kinds[]  = { "primary", "reflection", "refraction", "shadow" };
+      static const char* stages[] = { "build", "tiles", "sink", "intersection",
+                                      "shading", "shadows", "accumulation" };
+      output << "{\n"
+             << "  \"max_depth\": " << max_depth << ",\n"
+             << "  \"rays\": {";
+      for ( int k = 0; k < NB_KINDS; ++k )
+        output << " \"" << kinds[ k ] << "\": " << rays[ k ] << ",";
+      output << " \"total\": " << totalRays() << " },\n"
+             << "  \"primitive_tests\": " << primitive_tests << ",\n"
+             << "  \"node_visits\": " << node_visits << ",\n"
+             << "  \"culled_rays\": " << culled_rays << ",\n"
+             << "  \"depth_histogram\": [";
+      int last = NB_DEPTHS - 1;
+      while ( last > 0 && depths[ last ] == 0 ) --last;
+      for ( int d = 0; d <= last; ++d )
+        output << ( d == 0 ? " " : ", " ) << depths[ d ];
+      output << " ],\n"
+             << "  \"stage_seconds\": {";
+      for ( int s = 0; s < NB_STAGES; ++s )
+        output << ( s == 0 ? " \"" : ", \"" ) << stages[ s ] << "\": " << stage_seconds[ s ];
+      output << " },\n"
+             << "  \"tiles\": {\n"
+             << "    \"count\": " << nb_tiles << ",\n"
+             << "    \"total_s\": " << tile_seconds << ",\n"
+             << "    \"min_s\": " << tile_min << ",\n"
+             << "    \"max_s\": " << tile_max << ",\n"
+             << "    \"mean_s\": " << ( nb_tiles > 0 ? tile_seconds / nb_tiles : 0.0 ) << ",\n"
+             << "    \"slowest\": [";
+      for ( std::size_t i = 0; i < slowest.size(); ++i )
+        {
+          const Tile& t = slowest[ i ].tile;
+          output << ( i == 0 ? "\n" : ",\n" )
+                 << "      { \"x0\": " << t.x0 << ", \"y0\": " << t.y0
+                 << ", \"x1\": " << t.x1 << ", \"y1\": " << t.y1
+                 << ", \"s\": " << slowest[ i ].seconds << " }";
+        }
+      output << ( slowest.empty() ? "]\n" : "\n    ]\n" )
+             << "  }\n"
+             << "}\n";
+    }
+
+    /// @return the statistics of the calling thread (0 if it has none).
+    static RenderStats*& current()
+    {
+      static thread_local RenderStats* ptr = 0;
+      return ptr;
+    }
+
+    /// Makes \a stats the statistics of the calling thread as long as
+    /// it lives.
+    struct Scope {
+      Scope( RenderStats& stats ) : previous( current() ) { current() = &stats; }
+      ~Scope() { current() = previous; }
+      RenderStats* previous;
+    };
+
+    /// Measures the time of stages. Without RT_STATS, it does nothing.
+    struct Timer {
+#ifdef RT_STATS
+      Timer() : start( std::chrono::steady_clock::now() ) {}
+      /// @return the time since the last call (or the construction), in seconds.
+      double lap()
+      {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double s = std::chrono::duration< double >( now - start ).count();
+        start = now;
+        return s;
+      }
+      /// Adds the time since the last lap to stage \a stage of \a stats.
+      void lap( RenderStats& stats, Stage stage ) { stats.stage_seconds[ stage ] += lap(); }
+      /// Same as lap( stats, stage ) for the statistics of the calling thread.
+      void lap( Stage stage ) { if ( current() != 0 ) lap( *current(), stage ); }
+      std::chrono::steady_clock::time_point start;
+#else
+      double lap() { return 0.0; }
+      void lap( RenderStats&, Stage ) {}
+      void lap( Stage ) {}
+#endif
+    };
+
+  private:
+    void keepSlowest( const TileTime& t )
+    {
+      if ( (int) slowest.size() == NB_SLOWEST && ! ( t < slowest.back() ) ) return;
+      slowest.insert( std::upper_bound( slowest.begin(), slowest.end(), t ), t );
+      if ( (int) slowest.size() > NB_SLOWEST ) slowest.pop_back();
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _RENDER_STATS_H_
@@ -6,48 +6,33 @@
 #ifndef _RENDERER_H_
 #define _RENDERER_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "Color.h"
+#include "GBuffer.h"
 #include "Image2D.h"
+#include "ImageSink.h"
+#include "PixelFilter.h"
+#include "PixelFormats.h"
+#include "ProgressReporter.h"
 #include "Ray.h"
+#include "RayPacket.h"
+#include "RayQueue.h"
+#include "RayStack.h"
+#include "RenderStats.h"
+#include "Scene.h"
+#include "TileScheduler.h"
 #include <math.h> 
 
 /// Namespace RayTracer
 namespace rt {
 
-  inline void progressBar( std::ostream& output,
-                           const double currentValue, const double maximumValue)
-  {
-    static const int PROGRESSBARWIDTH = 60;
-    static int myProgressBarRotation = 0;
-    static int myProgressBarCurrent = 0;
-    // how wide you want the progress meter to be
-    double fraction = currentValue /maximumValue;
-    
-    // part of the progressmeter that's already "full"
-    int dotz = static_cast<int>(floor(fraction * PROGRESSBARWIDTH));
-    if (dotz > PROGRESSBARWIDTH) dotz = PROGRESSBARWIDTH;
-    
-    // if the fullness hasn't changed skip display
-    if (dotz == myProgressBarCurrent) return;
-    myProgressBarCurrent = dotz;
-    myProgressBarRotation++;
-    
-    // create the "meter"
-    int ii=0;
-    output << "[";
-    // part  that's full already
-    for ( ; ii < dotz;ii++) output<< "#";
-    // remaining part (spaces)
-    for ( ; ii < PROGRESSBARWIDTH;ii++) output<< " ";
-    static const char* rotation_string = "|\\-/";
-    myProgressBarRotation %= 4;
-    output << "] " << rotation_string[myProgressBarRotation]
-           << " " << (int)(fraction*100)<<"/100\r";
-    output.flush();
-  
-  }
-
-  
   struct Background {
     virtual Color backgroundColor( const Ray& ray ) = 0;
   };
@@ -104,10 +89,60 @@ namespace rt {
 
     int myWidth;
     int myHeight;
-
-    Renderer() : ptrScene( 0 ) {}
-    Renderer( Scene& scene ) : ptrScene( &scene ) {
-      ptrBackground = new MyBackground();
+    /// The number of rendering threads (0 means one per hardware thread).
+    int myNbThreads;
+    /// The size of the square tiles handed out to rendering threads.
+    int myTileSize;
+    /// When 'true', camera rays are intersected by packets of neighbouring pixels.
+    bool myUsePackets;
+    /// Each pixel is sampled by mySamples x mySamples camera rays.
+    int myNbSamples;
+    /// The filter weighting the samples of a pixel.
+    PixelFilter myFilter;
+    /// The maximal number of rays traced for one camera ray (0: no limit).
+    int myRayBudget;
+    /// Rays whose weight is below this threshold are culled (see setCulling).
+    Real myCullThreshold;
+    /// When 'true', culled rays are rouletted instead of dropped.
+    bool myRoulette;
+    /// When 'true', tiles are rendered in wavefront mode.
+    bool myWavefront;
+    /// The statistics of the last rendering (see RenderStats).
+    RenderStats myStats;
+    /// Where the statistics are written at the end of render (if not 0).
+    std::ostream* ptrStatsOutput;
+    /// How the progress of render is reported, and where.
+    ProgressReporter::Format myProgressFormat;
+    std::ostream* ptrProgressOutput;
+    /// When it becomes 'true', render stops as soon as possible (if not 0).
+    const std::atomic<bool>* ptrCancel;
+    /// The G-buffer filled or used by render (if not 0).
+    GBuffer* ptrGBuffer;
+    /// What the current rendering does with the G-buffer.
+    enum GBufferMode { NO_GBUFFER, FILL_GBUFFER, RELIGHT_GBUFFER };
+    GBufferMode myGBufferMode;
+
+    Renderer() : ptrScene( 0 ), ptrBackground( 0 ),
+                 myNbThreads( 0 ), myTileSize( 16 ), myUsePackets( true ),
+                 myNbSamples( 1 ), myRayBudget( 0 ), myCullThreshold( 0.0f ),
+                 myRoulette( false ), myWavefront( false ), ptrStatsOutput( 0 ),
+                 myProgressFormat( ProgressReporter::BAR ), ptrProgressOutput( &std::cout ),
+                 ptrCancel( 0 ), ptrGBuffer( 0 ), myGBufferMode( NO_GBUFFER ) {}
+    Renderer( Scene& scene ) : ptrScene( &scene ),
+                               myNbThreads( 0 ), myTileSize( 16 ), myUsePackets( true ),
+                               myNbSamples( 1 ), myRayBudget( 0 ), myCullThreshold( 0.0f ),
+                               myRoulette( false ), myWavefront( false ), ptrStatsOutput( 0 ), myProgressFormat( ProgressReporter::BAR ),
+                               ptrProgressOutput( &std::cout ), ptrCancel( 0 ),
+                               ptrGBuffer( 0 ), myGBufferMode( NO_GBUFFER ) {
+      ptrBackground = &defaultBackground();
+    }
+    /// @return the background of renderers built from a scene. It has
+    /// no state, hence it is shared by all of them instead of being
+    /// allocated (and leaked) by each one.
+    static MyBackground& defaultBackground()
+    {
+      static MyBackground background;
+      return background;
     }
     void setScene( rt::Scene& aScene ) { ptrScene = &aScene; }
     
@@ -121,36 +156,533 @@ namespace rt {
       myDirLR = dirLR;
     }
 
+    /// Sets the size of the rendered image, in pixels.
     void setResolution( int width , int height )
     {
-      myWidth  = width * 5;
-      myHeight = height * 5;
+      myWidth  = width;
+      myHeight = height;
+    }
+
+    /// Supersampling: each pixel is the average of \a n x \a n
+    /// stratified samples weighted by \a filter (n=1 takes one sample
+    /// at the pixel center). Samples are accumulated directly in the
+    /// final image, whose size does not depend on \a n.
+    void setSupersampling( int n, PixelFilter filter = PixelFilter() )
+    {
+      myNbSamples = std::max( 1, n );
+      myFilter    = filter;
+    }
+
+    /// Sets the number of rendering threads (0 means one per hardware
+    /// thread) and the size of the tiles they render.
+    void setThreads( int nb_threads, int tile_size = 16 )
+    {
+      myNbThreads = nb_threads;
+      myTileSize  = tile_size;
+    }
+
+    /// Chooses whether camera rays are traced by packets (the image
+    /// is the same either way).
+    void setPackets( bool use_packets ) { myUsePackets = use_packets; }
+
+    /// Chooses the wavefront mode (see renderTileWavefront), where
+    /// each tile is traced as one batch of rays: larger tiles (see
+    /// setThreads) give larger batches.
+    void setWavefront( bool wavefront ) { myWavefront = wavefront; }
+
+    /// Limits to \a nb the number of rays traced for each camera ray,
+    /// reflected and refracted rays included (0 means no limit). The
+    /// budget of a ray, minus one for itself, is shared between its
+    /// reflected and refracted rays in proportion to their weights, so
+    /// that the rays that matter least are cut.
+    void setRayBudget( int nb ) { myRayBudget = std::max( 0, nb ); }
+
+    /// Culls the reflected and refracted rays whose weight (the
+    /// product of the coefficients of the surfaces met since the
+    /// camera, see spawn) is below \a threshold in all channels (0
+    /// culls nothing). If \a roulette is 'true', such a ray of weight w
+    /// is kept with probability w / threshold, its weight being then
+    /// divided by this probability, which culls as many rays without
+    /// changing the expected image (Russian roulette). The choice
+    /// depends only on the ray, so that the image does not depend on
+    /// the threads.
+    void setCulling( Real threshold, bool roulette = false )
+    {
+      myCullThreshold = std::max( 0.0f, threshold );
+      myRoulette      = roulette;
     }
 
+    /// @return the budget of a camera ray (see setRayBudget).
+    int rayBudget() const { return myRayBudget == 0 ? RayStack::NO_LIMIT : myRayBudget; }
 
-    /// The main rendering routine
-    void render( Image2D<Color>& image, int max_depth )
+    /// @return the budget of the rays spawned by a ray of budget \a budget.
+    static int spawnBudget( int budget )
     {
-      std::cout << "Rendering into image ... might take a while." << std::endl;
-      image = Image2D<Color>( myWidth, myHeight );
-      for ( int y = 0; y < myHeight; ++y ) 
+      return budget == RayStack::NO_LIMIT ? budget : budget - 1;
+    }
+
+    /// Writes the statistics of each rendering to \a output as JSON
+    /// (0: they are not written). They are only counted when the
+    /// program is compiled with RT_STATS (see RenderStats).
+    void setStatsOutput( std::ostream* output ) { ptrStatsOutput = output; }
+
+    /// Reports the progress of render to \a output in format \a
+    /// format (see ProgressReporter). Rays are camera rays, or all rays
+    /// if the program is compiled with RT_STATS. The bar comes with a
+    /// message at the start and the end of render, so that JSON lines
+    /// stay alone on \a output. With NONE, render writes nothing.
+    void setProgress( ProgressReporter::Format format, std::ostream& output = std::cout )
+    {
+      myProgressFormat  = format;
+      ptrProgressOutput = &output;
+    }
+
+    /// Makes render stop after the tiles being rendered as soon as \a
+    /// cancel is 'true' (0: render always finishes). The image is then
+    /// incomplete.
+    void setCancel( const std::atomic<bool>* cancel ) { ptrCancel = cancel; }
+
+    /// Makes render( image, max_depth ) keep the trees of rays of the
+    /// camera samples in \a gbuffer (0: none is kept). The next
+    /// renderings of the same view then only compute illumination and
+    /// shadows (see GBuffer), which is enough when only lights moved.
+    /// It is not used in wavefront mode.
+    void setGBuffer( GBuffer* gbuffer ) { ptrGBuffer = gbuffer; }
+
+    /// @return what the G-buffer of a rendering of depth \a max_depth
+    /// depends on.
+    GBuffer::Key gbufferKey( int max_depth ) const
+    {
+      return GBuffer::Key{ myOrigin, myDirUL, myDirUR, myDirLL, myDirLR,
+                           myWidth, myHeight, myNbSamples, std::max( 1, myTileSize ),
+                           max_depth, rayBudget(), myCullThreshold, myRoulette };
+    }
+
+    /// @return 'true' if the rendering is cancelled (see setCancel).
+    bool cancelled() const
+    {
+      return ptrCancel != 0 && ptrCancel->load( std::memory_order_relaxed );
+    }
+
+    /// @return the statistics of the last rendering (see setStatsOutput).
+    const RenderStats& stats() const { return myStats; }
+
+    /// @return the number of threads used by render.
+    int nbThreads() const
+    {
+      if ( myNbThreads > 0 ) return myNbThreads;
+      return std::max( 1, (int) std::thread::hardware_concurrency() );
+    }
+
+    /// The main rendering routine. The image is cut into tiles that
+    /// are rendered by nbThreads() threads. The result does not depend
+    /// on the number of threads. Samples are accumulated as colors, and
+    /// pixels are stored in the format of \a image (e.g. HalfColor or
+    /// RGBEColor, see PixelFormats.h) as soon as they are finished.
+    template <typename TValue>
+    void render( Image2D<TValue>& image, int max_depth )
+    {
+      if ( myProgressFormat == ProgressReporter::BAR )
+        *ptrProgressOutput << "Rendering into image ... might take a while." << std::endl;
+      image = Image2D<TValue>( myWidth, myHeight );
+      myStats.reset( max_depth );
+      RenderStats::Timer timer;
+      if ( ! ptrScene->hasValidBVH() ) ptrScene->buildBVH();
+      timer.lap( myStats, RenderStats::BUILD );
+      ProgressReporter progress( *ptrProgressOutput, myProgressFormat,
+                                 (long) myWidth * myHeight );
+      myGBufferMode = NO_GBUFFER;
+      if ( ptrGBuffer != 0 && ! myWavefront )
         {
-          Real    ty   = (Real) y / (Real)(myHeight-1);
-          progressBar( std::cout, ty, 1.0 );
-          Vector3 dirL = (1.0f - ty) * myDirUL + ty * myDirLL;
-          Vector3 dirR = (1.0f - ty) * myDirUR + ty * myDirLR;
-          dirL        /= dirL.norm();
-          dirR        /= dirR.norm();
-          for ( int x = 0; x < myWidth; ++x ) 
+          const GBuffer::Key key = gbufferKey( max_depth );
+          myGBufferMode = ptrGBuffer->matches( key ) ? RELIGHT_GBUFFER : FILL_GBUFFER;
+          if ( myGBufferMode == FILL_GBUFFER ) ptrGBuffer->reset( key );
+        }
+      renderRows( image, 0, myHeight, max_depth, progress );
+      if ( myGBufferMode == FILL_GBUFFER && cancelled() ) ptrGBuffer->invalidate();
+      myGBufferMode = NO_GBUFFER;
+      timer.lap( myStats, RenderStats::TILES );
+      progress.finish();
+      if ( myProgressFormat == ProgressReporter::BAR )
+        *ptrProgressOutput << "Done." << std::endl;
+      writeStats();
+    }
+
+    /// Same as render, but the image is rendered by bands of rows that
+    /// are handed to \a sink as soon as they are finished, from top to
+    /// bottom. Only one band is in memory at a time. A band is made of
+    /// enough rows of tiles to keep all threads busy.
+    /// @return 'false' if the sink failed.
+    bool render( ImageSink& sink, int max_depth )
+    {
+      if ( myProgressFormat == ProgressReporter::BAR )
+        *ptrProgressOutput << "Rendering into sink ... might take a while." << std::endl;
+      myStats.reset( max_depth );
+      RenderStats::Timer timer;
+      if ( ! ptrScene->hasValidBVH() ) ptrScene->buildBVH();
+      timer.lap( myStats, RenderStats::BUILD );
+      if ( ! sink.begin( myWidth, myHeight ) ) return false;
+      const int tile_size     = std::max( 1, myTileSize );
+      const int tiles_per_row = ( myWidth + tile_size - 1 ) / tile_size;
+      const int tile_rows     = ( 4 * nbThreads() + tiles_per_row - 1 ) / tiles_per_row;
+      const int band_height   = std::min( myHeight, tile_rows * tile_size );
+      ProgressReporter progress( *ptrProgressOutput, myProgressFormat,
+                                 (long) myWidth * myHeight );
+      Image2D<Color> band( myWidth, band_height );
+      bool ok = true;
+      for ( int y = 0; y < myHeight && ok && ! cancelled(); y += band_height )
+        {
+          int nb_rows = std::min( band_height, myHeight - y );
+          timer.lap();
+          renderRows( band, y, nb_rows, max_depth, progress );
+          timer.lap( myStats, RenderStats::TILES );
+          ok = sink.write( band.data(), y, nb_rows );
+          timer.lap( myStats, RenderStats::SINK );
+        }
+      ok = sink.end() && ok;
+      timer.lap( myStats, RenderStats::SINK );
+      progress.finish();
+      if ( myProgressFormat == ProgressReporter::BAR )
+        *ptrProgressOutput << "Done." << std::endl;
+      writeStats();
+      return ok;
+    }
+
+    /// Renders rows [y0, y0 + \a nb_rows[ of the image into \a image,
+    /// whose first row is row \a y0, with nbThreads() threads. Each
+    /// thread counts its own statistics, added to myStats at the end.
+    template <typename TValue>
+    void renderRows( Image2D<TValue>& image, int y0, int nb_rows, int max_depth,
+                     ProgressReporter& progress )
+    {
+      TileScheduler scheduler( myWidth, nb_rows, myTileSize, nbThreads() );
+      std::mutex    stats_mutex;
+      auto worker = [&] ( int i ) {
+        RenderStats        stats( max_depth );
+        RenderStats::Scope scope( stats );
+        long nb_rays = 0; // already reported
+        Tile tile;
+        while ( ! cancelled() && scheduler.next( i, tile ) )
+          {
+            tile.y0 += y0; tile.y1 += y0;
+            RenderStats::Timer timer;
+            if ( myWavefront ) renderTileWavefront( image, tile, max_depth, y0 );
+            else renderTile( image, tile, max_depth, y0 );
+            if ( RenderStats::ENABLED ) stats.tile( tile, timer.lap() );
+            long pixels = ( tile.x1 - tile.x0 ) * ( tile.y1 - tile.y0 );
+            long rays   = pixels * myNbSamples * myNbSamples;
+            if ( RenderStats::ENABLED )
+              {
+                rays     = stats.totalRays() - nb_rays;
+                nb_rays += rays;
+              }
+            progress.add( pixels, rays );
+          }
+        std::lock_guard< std::mutex > lock( stats_mutex );
+        myStats.merge( stats );
+      };
+      std::vector< std::thread > threads;
+      for ( int i = 1; i < scheduler.size(); ++i )
+        threads.emplace_back( worker, i );
+      worker( 0 );
+      for ( std::thread& t : threads ) t.join();
+    }
+
+    /// Renders the pixels of \a tile into \a image. Several tiles may
+    /// be rendered concurrently since tracing does not modify the
+    /// renderer nor the scene. The samples of a row of the tile are
+    /// accumulated in a buffer of the width of the tile, and camera
+    /// rays are traced by packets of RayPacket::SIZE consecutive
+    /// samples if myUsePackets is 'true'. The first row of \a image is
+    /// row \a y0 of the rendered image. The trees of rays of the
+    /// samples are kept in, or taken from, the G-buffer (see
+    /// setGBuffer) according to myGBufferMode.
+    template <typename TValue>
+    void renderTile( Image2D<TValue>& image, const Tile& tile, int max_depth,
+                     int y0 = 0 )
+    {
+      typedef typename PixelFormat< TValue >::Accessor Accessor;
+      const int n = myNbSamples;
+      const std::vector< Real > weights = myFilter.weights( n );
+      std::vector< Color >   row( tile.x1 - tile.x0 );
+      std::vector< Vector3 > dirL( n ), dirR( n );
+      RayPacket packet;
+      int       pixel[ RayPacket::SIZE ];  // index in row of each ray of the packet
+      Real      weight[ RayPacket::SIZE ]; // and weight of its sample
+      int       index[ RayPacket::SIZE ];  // and index of its sample in the tile
+      const int nb_samples = ( tile.x1 - tile.x0 ) * ( tile.y1 - tile.y0 ) * n * n;
+      GBuffer::Block* block = myGBufferMode != NO_GBUFFER ? &ptrGBuffer->block( tile ) : 0;
+      GBuffer::Recorder recorder( block, ptrGBuffer != 0 ? ptrGBuffer->max_records : 0 );
+      GBuffer::Recorder* rec = myGBufferMode == FILL_GBUFFER ? &recorder : 0;
+      auto flush = [&] () {
+        Hit  hit[ RayPacket::SIZE ];
+        Real ri[ RayPacket::SIZE ];
+        ptrScene->rayIntersection( packet, hit, ri );
+        for ( int k = 0; k < packet.size(); ++k )
+          {
+            const Ray& eye_ray = packet.rays[ k ];
+            if ( rec != 0 ) rec->begin( index[ k ], nb_samples );
+            if ( rec != 0 && ri[ k ] >= 0.0f ) rec->escape( eye_ray, Color( 1.0, 1.0, 1.0 ) );
+            Color result = ri[ k ] >= 0.0f
+              ? background( eye_ray )
+              : shade( eye_ray, hit[ k ], rec );
+            if ( rec != 0 ) rec->end();
+            row[ pixel[ k ] ] += result.clamp() * weight[ k ];
+          }
+        packet.nb = 0;
+      };
+      for ( int y = tile.y0; y < tile.y1; ++y ) 
+        {
+          for ( int j = 0; j < n; ++j )
             {
-              Real    tx   = (Real) x / (Real)(myWidth-1);
-              Vector3 dir  = (1.0f - tx) * dirL + tx * dirR;
-              Ray eye_ray  = Ray( myOrigin, dir, max_depth );
-              Color result = trace( eye_ray );
-              image.at( x, y ) = result.clamp();
+              Real ty  = ( y + PixelFilter::offset( j, n ) ) / (Real)(myHeight-1);
+              dirL[ j ] = (1.0f - ty) * myDirUL + ty * myDirLL;
+              dirR[ j ] = (1.0f - ty) * myDirUR + ty * myDirLR;
+              dirL[ j ] /= dirL[ j ].norm();
+              dirR[ j ] /= dirR[ j ].norm();
             }
+          std::fill( row.begin(), row.end(), Color() );
+          for ( int x = tile.x0; x < tile.x1; ++x ) 
+            for ( int j = 0; j < n; ++j )
+              for ( int i = 0; i < n; ++i )
+                {
+                  Real    tx   = ( x + PixelFilter::offset( i, n ) ) / (Real)(myWidth-1);
+                  Vector3 dir  = (1.0f - tx) * dirL[ j ] + tx * dirR[ j ];
+                  Ray eye_ray  = Ray( myOrigin, dir, max_depth );
+                  RT_STAT( ray( RenderStats::PRIMARY, max_depth ) );
+                  const int s = ( ( y - tile.y0 ) * ( tile.x1 - tile.x0 ) + x - tile.x0 ) * n * n
+                    + j * n + i;
+                  if ( myGBufferMode == RELIGHT_GBUFFER && block->count[ s ] >= 0 )
+                    {
+                      Color result = relight( &block->records[ block->first[ s ] ],
+                                              block->count[ s ] );
+                      row[ x - tile.x0 ] += result.clamp() * weights[ j * n + i ];
+                      continue;
+                    }
+                  if ( ! myUsePackets )
+                    {
+                      if ( rec != 0 ) rec->begin( s, nb_samples );
+                      Color result = trace( eye_ray, rec );
+                      if ( rec != 0 ) rec->end();
+                      row[ x - tile.x0 ] += result.clamp() * weights[ j * n + i ];
+                      continue;
+                    }
+                  pixel[ packet.size() ]  = x - tile.x0;
+                  weight[ packet.size() ] = weights[ j * n + i ];
+                  index[ packet.size() ]  = s;
+                  packet.add( eye_ray );
+                  if ( packet.size() == RayPacket::SIZE ) flush();
+                }
+          if ( packet.size() > 0 ) flush();
+          auto it = image.template start< Accessor >( tile.x0, y - y0 );
+          for ( int x = tile.x0; x < tile.x1; ++x, ++it )
+            *it = row[ x - tile.x0 ];
         }
-      std::cout << "Done." << std::endl;
+    }
+
+    /// Same as renderTile, in wavefront mode: the samples of the tile
+    /// are traced together, one generation of rays after the other,
+    /// each generation going through separate stages: intersection
+    /// (by packets for camera rays, sorted by direction otherwise),
+    /// shading sorted by material (which gives the shadow rays and the
+    /// next generation), then shadow rays. The contributions of the
+    /// rays of a sample are summed at the end, depth first as in
+    /// trace: float sums depend on their order, and the image is thus
+    /// the same as in the other modes.
+    template <typename TValue>
+    void renderTileWavefront( Image2D<TValue>& image, const Tile& tile, int max_depth,
+                              int y0 = 0 )
+    {
+      typedef typename PixelFormat< TValue >::Accessor Accessor;
+      const int n         = myNbSamples;
+      const int width     = tile.x1 - tile.x0;
+      const int nb_lights = (int) ptrScene->myLights.size();
+      const std::vector< Real > weights = myFilter.weights( n );
+      std::vector< Vector3 > dirL( n ), dirR( n );
+      // Camera rays, sample after sample of pixel after pixel.
+      RayQueue queue, next;
+      for ( int y = tile.y0; y < tile.y1; ++y ) 
+        {
+          for ( int j = 0; j < n; ++j )
+            {
+              Real ty  = ( y + PixelFilter::offset( j, n ) ) / (Real)(myHeight-1);
+              dirL[ j ] = (1.0f - ty) * myDirUL + ty * myDirLL;
+              dirR[ j ] = (1.0f - ty) * myDirUR + ty * myDirLR;
+              dirL[ j ] /= dirL[ j ].norm();
+              dirR[ j ] /= dirR[ j ].norm();
+            }
+          for ( int x = tile.x0; x < tile.x1; ++x ) 
+            for ( int j = 0; j < n; ++j )
+              for ( int i = 0; i < n; ++i )
+                {
+                  Real    tx   = ( x + PixelFilter::offset( i, n ) ) / (Real)(myWidth-1);
+                  Vector3 dir  = (1.0f - tx) * dirL[ j ] + tx * dirR[ j ];
+                  queue.push( Ray( myOrigin, dir, max_depth ), Color( 1.0, 1.0, 1.0 ),
+                              queue.size(), rayBudget() );
+                  RT_STAT( ray( RenderStats::PRIMARY, max_depth ) );
+                }
+        }
+      std::vector< Color >           colors( queue.size() ); // of the samples
+      // The trees of rays of the samples: the weighted color of each
+      // ray traced and its children, the first ones being the camera
+      // rays. id gives the rays of queue.
+      std::vector< Color >           contributions( queue.size() );
+      std::vector< int >             first_child( queue.size(), 0 );
+      std::vector< int >             nb_child( queue.size(), 0 );
+      std::vector< int >             id( queue.size() ), next_id;
+      for ( int k = 0; k < queue.size(); ++k ) id[ k ] = k;
+      std::vector< Hit >             hits;
+      std::vector< Real >            ri;
+      std::vector< int >             order;
+      std::vector< std::pair< const Material*, int > > by_material;
+      std::vector< LightSample >     light_samples;
+      std::vector< Color >           shadows;
+      std::vector< RayStack::Entry > children;
+      std::vector< int >             nb_children;
+      RayPacket packet;
+      RenderStats::Timer timer;
+      for ( bool camera_rays = true; queue.size() > 0; camera_rays = false )
+        {
+          const int nb = queue.size();
+          // Intersection. Camera rays are coherent and go by packets;
+          // the packet traversal does not pay for the other rays.
+          hits.resize( nb );
+          ri.resize( nb );
+          if ( ! camera_rays )
+            {
+              sortByOctant( queue, order );
+              for ( int k : order ) ri[ k ] = ptrScene->rayIntersection( queue.rays[ k ], hits[ k ] );
+            }
+          else for ( int k = 0; k < nb; k += RayPacket::SIZE )
+            {
+              Hit  hit[ RayPacket::SIZE ];
+              Real r[ RayPacket::SIZE ];
+              packet.nb = 0;
+              for ( int l = k; l < std::min( nb, k + RayPacket::SIZE ); ++l )
+                packet.add( queue.rays[ l ] );
+              ptrScene->rayIntersection( packet, hit, r );
+              for ( int l = 0; l < packet.size(); ++l )
+                {
+                  hits[ k + l ] = hit[ l ];
+                  ri[ k + l ]   = r[ l ];
+                }
+            }
+          timer.lap( RenderStats::INTERSECTION );
+          // Shading, by material: light samples and next generation.
+          by_material.clear();
+          for ( int k = 0; k < nb; ++k )
+            if ( ri[ k ] < 0.0f ) by_material.push_back( std::make_pair( &hits[ k ].material(), k ) );
+          std::sort( by_material.begin(), by_material.end() );
+          order.clear();
+          for ( const auto& mk : by_material ) order.push_back( mk.second );
+          light_samples.resize( nb * nb_lights );
+          children.resize( 2 * nb );
+          nb_children.assign( nb, 0 );
+          for ( int k : order )
+            {
+              for ( int l = 0; l < nb_lights; ++l )
+                lightSample( l, queue.rays[ k ], hits[ k ], light_samples[ k * nb_lights + l ] );
+              nb_children[ k ] = spawn( queue.rays[ k ], hits[ k ], queue.weights[ k ],
+                                        spawnBudget( queue.budgets[ k ] ), &children[ 2 * k ] );
+            }
+          timer.lap( RenderStats::SHADING );
+          // Shadow rays.
+          shadows.resize( nb * nb_lights );
+          for ( int k : order )
+            for ( int l = k * nb_lights; l < ( k + 1 ) * nb_lights; ++l )
+              {
+                const LightSample& ls = light_samples[ l ];
+                shadows[ l ] = shadow( ls.shadow_ray, ls.color, ls.distance );
+              }
+          timer.lap( RenderStats::SHADOWS );
+          // Contributions of the rays (as in illumination and scatter)
+          // and next generation, in the order of the queue.
+          const int base = (int) contributions.size();
+          next.clear();
+          next_id.clear();
+          for ( int k = 0; k < nb; ++k )
+            {
+              const Color& weight = queue.weights[ k ];
+              const int    sample = queue.samples[ k ];
+              const int    r      = id[ k ];
+              if ( ri[ k ] >= 0.0f )
+                {
+                  contributions[ r ] = weight * background( queue.rays[ k ] );
+                  continue;
+                }
+              const Material& m = hits[ k ].material();
+              Color C = Color(0.0, 0.0, 0.0);
+              for ( int l = k * nb_lights; l < ( k + 1 ) * nb_lights; ++l )
+                {
+                  C += (light_samples[ l ].diffuse * shadows[ l ]);
+                  C += light_samples[ l ].specular;
+                }
+              C += m.ambient;
+              contributions[ r ] = weight * ( C * m.coef_diffusion );
+              first_child[ r ]   = base + next.size();
+              nb_child[ r ]      = nb_children[ k ];
+              for ( int c = 2 * k; c < 2 * k + nb_children[ k ]; ++c )
+                {
+                  next_id.push_back( base + next.size() );
+                  next.push( children[ c ].ray, children[ c ].weight, sample, children[ c ].budget );
+                }
+            }
+          contributions.resize( base + next.size() );
+          first_child.resize( base + next.size(), 0 );
+          nb_child.resize( base + next.size(), 0 );
+          std::swap( queue, next );
+          std::swap( id, next_id );
+          timer.lap( RenderStats::ACCUMULATION );
+        }
+      // Colors of the samples, summed in the order of RayStack (the
+      // first child, pushed last, is traced first).
+      std::vector< int > stack;
+      for ( int s = 0; s < (int) colors.size(); ++s )
+        {
+          Color result = Color( 0.0, 0.0, 0.0 );
+          stack.push_back( s );
+          while ( ! stack.empty() )
+            {
+              const int r = stack.back();
+              stack.pop_back();
+              result += contributions[ r ];
+              for ( int c = nb_child[ r ] - 1; c >= 0; --c )
+                stack.push_back( first_child[ r ] + c );
+            }
+          colors[ s ] = result;
+        }
+      timer.lap( RenderStats::ACCUMULATION );
+      // Pixels, as in renderTile.
+      for ( int y = tile.y0; y < tile.y1; ++y ) 
+        {
+          auto it = image.template start< Accessor >( tile.x0, y - y0 );
+          for ( int x = tile.x0; x < tile.x1; ++x, ++it ) 
+            {
+              const int first = ( ( y - tile.y0 ) * width + x - tile.x0 ) * n * n;
+              Color     pixel;
+              for ( int k = 0; k < n * n; ++k )
+                pixel += colors[ first + k ].clamp() * weights[ k ];
+              *it = pixel;
+            }
+        }
+    }
+
+    /// Fills \a order with the indices of the rays of \a queue, sorted
+    /// by the octant of their direction (a counting sort, which keeps
+    /// the order of the queue within an octant).
+    static void sortByOctant( const RayQueue& queue, std::vector< int >& order )
+    {
+      int count[ 9 ] = { 0 };
+      std::vector< unsigned char > octants( queue.size() );
+      for ( int k = 0; k < queue.size(); ++k )
+        {
+          const Vector3& d = queue.rays[ k ].direction;
+          octants[ k ] = ( d[ 0 ] < 0.0f ) | ( ( d[ 1 ] < 0.0f ) << 1 ) | ( ( d[ 2 ] < 0.0f ) << 2 );
+          ++count[ octants[ k ] + 1 ];
+        }
+      for ( int o = 0; o < 8; ++o ) count[ o + 1 ] += count[ o ];
+      order.resize( queue.size() );
+      for ( int k = 0; k < queue.size(); ++k ) order[ count[ octants[ k ] ]++ ] = k;
     }
 
     Color background( const Ray& ray )
@@ -172,45 +704,175 @@ namespace rt {
 
 
 
-    /// The rendering routine for one ray.
+    /// The rendering routine for one ray. The traced rays are given
+    /// to \a rec, if not 0 (see GBuffer).
     /// @return the color for the given ray.
-    Color trace( const Ray& ray )
+    Color trace( const Ray& ray, GBuffer::Recorder* rec = 0 )
+    {
+      RayStack stack;
+      stack.push( ray, Color( 1.0, 1.0, 1.0 ), rayBudget() );
+      return integrate( stack, Color( 0.0, 0.0, 0.0 ), rec );
+    }
+
+    /// @return the color seen along \a ray, which makes the hit \a hit.
+    Color shade( const Ray& ray, const Hit& hit, GBuffer::Recorder* rec = 0 )
+    {
+      RayStack stack;
+      if ( rec != 0 ) rec->hit( ray, Color( 1.0, 1.0, 1.0 ), hit );
+      Color result = scatter( ray, hit, Color( 1.0, 1.0, 1.0 ), spawnBudget( rayBudget() ),
+                              stack );
+      return integrate( stack, result, rec );
+    }
+
+    /// @return the color of a sample from the \a n records of its tree
+    /// of rays (see GBuffer): the same as trace, in the same order,
+    /// without tracing anything but shadow rays.
+    Color relight( const GBuffer::Record* r, int n )
     {
-      assert( ptrScene != 0 );
       Color result = Color( 0.0, 0.0, 0.0 );
-      GraphicalObject* obj_i = 0; // pointer to intersected object
-      Point3           p_i;       // point of intersection
-
-      // Look for intersection in this direction.
-      Real ri = ptrScene->rayIntersection( ray, obj_i, p_i );
-      // Nothing was intersected
-      if ( ri >= 0.0f ){
-        return this->background(ray); //some background color
-      }
+      Hit   hit;
+      for ( const GBuffer::Record* rE = r + n; r != rE; ++r )
+        {
+          if ( r->material == 0 )
+            {
+              result += r->weight * this->background( r->ray );
+              continue;
+            }
+          hit.point  = r->point;
+          hit.normal = r->normal;
+          hit.setMaterial( *r->material );
+          Color finalColor = illumination( r->ray, hit );
+          finalColor = finalColor * r->material->coef_diffusion;
+          result += r->weight * finalColor;
+        }
+      return result;
+    }
+
+    /// Traces the rays of \a stack, and those they spawn, which are
+    /// given to \a rec if not 0.
+    /// @return \a result plus the weighted colors of the traced rays.
+    Color integrate( RayStack& stack, Color result, GBuffer::Recorder* rec = 0 )
+    {
+      assert( ptrScene != 0 );
+      while ( ! stack.empty() )
+        {
+          RayStack::Entry e = stack.pop();
+          Hit hit; // everything about the intersection
+
+          // Look for intersection in this direction.
+          Real ri = ptrScene->rayIntersection( e.ray, hit );
+          // Nothing was intersected
+          if ( ri >= 0.0f )
+            {
+              if ( rec != 0 ) rec->escape( e.ray, e.weight );
+              result += e.weight * this->background( e.ray ); //some background color
+            }
+          else
+            {
+              if ( rec != 0 ) rec->hit( e.ray, e.weight, hit );
+              result += scatter( e.ray, hit, e.weight, spawnBudget( e.budget ), stack );
+            }
+        }
+      return result;
+    }
+
+    /// Pushes on \a stack the reflected and refracted rays of \a ray
+    /// at hit \a hit, \a weight being the weight of \a ray (see spawn).
+    /// @return the weighted color of the light reflected at \a hit.
+    Color scatter( const Ray& ray, const Hit& hit, const Color& weight, int budget,
+                   RayStack& stack )
+    {
+      RayStack::Entry children[ 2 ];
+      // The reflected ray is pushed last to be traced first.
+      for ( int k = spawn( ray, hit, weight, budget, children ) - 1; k >= 0; --k )
+        stack.push( children[ k ].ray, children[ k ].weight, children[ k ].budget );
 
-      Material m = obj_i->getMaterial(p_i);
+      Color finalColor = illumination(ray, hit);
+      finalColor = finalColor * hit.material().coef_diffusion;
+
+      return weight * finalColor;
+    }
+
+    /// Computes the reflected and the refracted rays of \a ray at hit
+    /// \a hit, with their weights (\a weight being the weight of \a
+    /// ray), except those that are culled (see setCulling). The \a
+    /// budget of rays they may spawn is shared between them in
+    /// proportion to their weights.
+    /// @return the number of rays written in \a children, the
+    /// reflected one first.
+    int spawn( const Ray& ray, const Hit& hit, const Color& weight, int budget,
+               RayStack::Entry children[ 2 ] )
+    {
+      const Material& m      = hit.material();
+      const Point3&   p_i    = hit.point;
+      Color w_refr = weight * m.diffuse * m.coef_refraction;
+      Color w_refl = weight * m.specular * m.coef_reflexion;
+      const bool      refraction = ray.depth > 0 && m.coef_refraction != 0
+        && survives( w_refr, ray, 1 );
+      const bool      reflexion  = ray.depth > 0 && m.coef_reflexion != 0
+        && survives( w_refl, ray, 0 );
+      int   b_refr = refraction ? budget : 0;
+      int   b_refl = reflexion  ? budget : 0;
+      if ( refraction && reflexion && budget != RayStack::NO_LIMIT )
+        {
+          Real a = w_refl.max(), b = w_refr.max();
+          b_refl = a + b > 0.0f ? (int) floor( budget * a / ( a + b ) + 0.5f ) : budget / 2;
+          b_refr = budget - b_refl;
+        }
+      int nb = 0;
 
-      if(ray.depth > 0 && m.coef_reflexion != 0){
+      if(b_refl > 0){
           int profondeur = ray.depth - 1;
-          Vector3 directionReflect = reflect(ray.direction, obj_i->getNormal(p_i));
+          Vector3 directionReflect = reflect(ray.direction, hit.normal);
           Vector3 pt = p_i + directionReflect * 0.01f; //On ne veut pas un point pile dessus pour éviter dessus.
-          Ray rayRefl = Ray(pt, directionReflect, profondeur);
-          Color C_refl = trace(rayRefl);
-          result += C_refl * m.specular * m.coef_reflexion;
+          children[ nb ].ray    = Ray(pt, directionReflect, profondeur);
+          children[ nb ].weight = w_refl;
+          children[ nb ].budget = b_refl;
+          RT_STAT( ray( RenderStats::REFLECTION, profondeur ) );
+          ++nb;
       }
 
-      if(ray.depth > 0 && m.coef_refraction != 0){
-          Ray rayRefr = refractionRay(ray, p_i, obj_i->getNormal(p_i),m );
-          Color c_refract = trace(rayRefr);
-          result += c_refract * m.diffuse * m.coef_refraction;
+      if(b_refr > 0){
+          children[ nb ].ray    = refractionRay(ray, p_i, hit.normal, m );
+          children[ nb ].weight = w_refr;
+          children[ nb ].budget = b_refr;
+          RT_STAT( ray( RenderStats::REFRACTION, ray.depth - 1 ) );
+          ++nb;
       }
+      return nb;
+    }
 
-      Color finalColor = illumination(ray, obj_i, p_i);
-      finalColor = finalColor * obj_i->getMaterial(p_i).coef_diffusion;
-
-      result += finalColor;
+    /// @return 'false' if the ray of weight \a w spawned by \a ray
+    /// (the \a k-th one) is culled (see setCulling). If it is kept by
+    /// the roulette, \a w is divided by the probability to keep it.
+    bool survives( Color& w, const Ray& ray, int k ) const
+    {
+      if ( myCullThreshold <= 0.0f ) return true;
+      const Real w_max = w.max();
+      if ( w_max >= myCullThreshold ) return true;
+      if ( myRoulette && w_max > 0.0f )
+        {
+          const Real p = w_max / myCullThreshold;
+          if ( uniform( ray, k ) < p ) { w = w * ( 1.0f / p ); return true; }
+        }
+      RT_STAT( culled_rays++ );
+      return false;
+    }
 
-      return result;
+    /// @return a number in [0,1[ that only depends on \a ray and \a k.
+    static Real uniform( const Ray& ray, int k )
+    {
+      uint64_t h = 0x9E3779B97F4A7C15ull * (uint64_t)( k + 1 );
+      for ( int i = 0; i < 3; ++i )
+        {
+          uint32_t o, d;
+          std::memcpy( &o, &ray.origin[ i ], sizeof( o ) );
+          std::memcpy( &d, &ray.direction[ i ], sizeof( d ) );
+          h = ( h ^ o ) * 0xBF58476D1CE4E5B9ull;
+          h = ( h ^ d ) * 0x94D049BB133111EBull;
+          h ^= h >> 31;
+        }
+      return ( h >> 40 ) * ( 1.0f / 16777216.0f );
     }
 
     Vector3 reflect( const Vector3& V, Vector3 N ) const{
@@ -218,70 +880,82 @@ namespace rt {
       return W;
     }
 
-    Color illumination( const Ray& ray, GraphicalObject* obj, Point3 p ){
-      Material m = obj->getMaterial(p);
+    Color illumination( const Ray& ray, const Hit& hit ){
+      const Material& m = hit.material();
       Color C = Color(0.0, 0.0, 0.0);
       
-
-      for(std::vector<Light*>::const_iterator it = this->ptrScene->myLights.begin() , itE=this->ptrScene->myLights.end();it!=itE;it++){
-        
-        Vector3 lightDirection = (*it)->direction(ray.direction);
-        Vector3 normalP = obj->getNormal(p);
-        Color lightColor = (*it)->color(p); //B
-
-        //calcul des ombres
-        Ray ObjLight = Ray(p, lightDirection,1);
-        Color colorShadow = shadow(ObjLight, lightColor);
-
-
-        //Diffuse
-        Real coeffDiffuse = lightDirection.dot(normalP) / (lightDirection.norm() * normalP.norm()); //kd
-        if(coeffDiffuse < 0){
-          coeffDiffuse = 0;
-        }
-        C += (m.diffuse * lightColor * coeffDiffuse * colorShadow); // C <-- C +kdD * B    //(+ les ombres)
-
-        //Specular
-        Vector3 W = reflect(ray.direction, normalP);
-        Real cosBeta = W.dot(lightDirection) / (lightDirection.norm() * W.norm());
-        if(cosBeta < 0){
-           cosBeta = 0;
-        } 
-        Real coeffSpecular = std::pow(cosBeta, m.shinyness);
-        C+= (lightColor * m.specular * coeffSpecular);
-
-        //C += shadow(ray,C);
-        
+      const std::vector<Light*>& lights = this->ptrScene->myLights;
+      for ( int i = 0, n = (int) lights.size(); i < n; ++i ){
+        LightSample ls;
+        lightSample( i, ray, hit, ls );
+
+        //calcul des ombres (jusqu'à la lumière seulement)
+        Color colorShadow = shadow(ls.shadow_ray, ls.color, ls.distance);
+        C += (ls.diffuse * colorShadow); // C <-- C +kdD * B    //(+ les ombres)
+        C += ls.specular;
       }
       C += m.ambient; //On ajoute à C la couleur ambiente 
 
       return C;
     }
 
+    /// Fills \a ls with the light of the \a i-th light of the scene
+    /// that is reflected toward the origin of \a ray at hit \a hit.
+    void lightSample( int i, const Ray& ray, const Hit& hit, LightSample& ls )
+    {
+      // The light is passed with its own type (see Scene::LightTypes).
+      LightSampler sampler = { this, &ray, &hit, &ls };
+      Scene::LightTypes::apply( ptrScene->lightType( i ), ptrScene->myLights[ i ], sampler );
+    }
+
+    /// Same as lightSample for light \a light. The calls to \a light
+    /// are static when L is a final type of light.
+    template <typename L>
+    void lightSample( const L& light, const Ray& ray, const Hit& hit, LightSample& ls ){
+      const Material& m       = hit.material();
+      const Point3&   p       = hit.point;
+      const Vector3&  normalP = hit.normal;
+
+      Vector3 lightDirection = light.direction(p);
+      Color lightColor = light.color(p); //B
+      ls.color         = lightColor;
+      ls.shadow_ray    = Ray(p, lightDirection,1);
+      ls.distance      = light.distance(p);
+
+      //Diffuse
+      Real coeffDiffuse = lightDirection.dot(normalP) / (lightDirection.norm() * normalP.norm()); //kd
+      if(coeffDiffuse < 0){
+        coeffDiffuse = 0;
+      }
+      ls.diffuse = m.diffuse * lightColor * coeffDiffuse;
+
+      //Specular
+      Vector3 W = reflect(ray.direction, normalP);
+      Real cosBeta = W.dot(lightDirection) / (lightDirection.norm() * W.norm());
+      if(cosBeta < 0){
+         cosBeta = 0;
+      } 
+      Real coeffSpecular = std::pow(cosBeta, m.shinyness);
+      ls.specular = lightColor * m.specular * coeffSpecular;
+    }
+
     /// Calcule la couleur de la lumière (donnée par light_color) dans la
     /// direction donnée par le rayon. Si aucun objet n'est traversé,
     /// retourne light_color, sinon si un des objets traversés est opaque,
     /// retourne du noir, et enfin si les objets traversés sont
-    /// transparents, attenue la couleur.
-    Color shadow( const Ray& ray, Color light_color ){
-      GraphicalObject *obj; 
-      Point3 p;
-      Point3 p2 = ray.origin;
-
-
-      while (light_color.max() > 0.003f){
-        Point3 pDecale = p2 + ray.direction * 0.0001f;
-        Ray ray2 = Ray(pDecale, ray.direction, ray.depth);
-        Real r = ptrScene->rayIntersection(ray2, obj, p);
-        if(r>= 0.0f){
-          return light_color;
-        }
-        Material m = obj->getMaterial(p);
-        light_color = light_color * m.diffuse * m.coef_refraction;
-        p2 = p;
+    /// transparents, attenue la couleur. Seuls les objets situés à moins
+    /// de max_distance (distance à la lumière) sont pris en compte.
+    Color shadow( const Ray& ray, Color light_color,
+                  Real max_distance = std::numeric_limits<Real>::infinity() ){
+      RT_STAT( ray( RenderStats::SHADOW, ray.depth ) );
+      return ptrScene->occlusion( ray, max_distance, light_color );
+    }
 
-      }
-      return light_color;
+    /// Writes myStats to ptrStatsOutput, if any (and if they are counted).
+    void writeStats() const
+    {
+      if ( RenderStats::ENABLED && ptrStatsOutput != 0 )
+        myStats.writeJSON( *ptrStatsOutput );
     }
 
     Ray refractionRay( const Ray& aRay, const Point3& p, Vector3 N, const Material& m ){
@@ -307,6 +981,17 @@ namespace rt {
       return Ray(p + aRay.direction * 0.0001f, Vrefract, aRay.depth - 1);
     }
 
+  private:
+    /// Calls lightSample with a light of its own type (see Scene::LightTypes).
+    struct LightSampler {
+      Renderer*    renderer;
+      const Ray*   ray;
+      const Hit*   hit;
+      LightSample* ls;
+
+      template <typename L>
+      void operator()( L* light ) { renderer->lightSample( *light, *ray, *hit, *ls ); }
+    };
   };
 
 } // namespace rt
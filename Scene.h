@@ -10,27 +10,49 @@
 #include <vector>
 #include "GraphicalObject.h"
 #include "Light.h"
+#include "PointLight.h"
+#include "BVH.h"
+#include "Sphere.h"
+#include "SphereSet.h"
+#include "SphereCloud.h"
+#include "TriangleMesh.h"
+#include "Instance.h"
+#include "ObjectGroup.h"
+#include "RenderStats.h"
+#include "TypeSwitch.h"
 
 /// Namespace RayTracer
 namespace rt {
 
   /**
-  Models a scene, i.e. a collection of lights and graphical objects
-  (could be a tree, but we keep a list for now for the sake of
-  simplicity).
+  Models a scene, i.e. a collection of lights and graphical objects.
+  Objects are kept in a list, and acceleration structures may be
+  built over them with buildBVH() to speed up ray intersection:
+  spheres are packed in a SphereSet intersected by SIMD kernels (with
+  its own BVH when they are numerous), other objects are grouped by
+  type (see Primitives), each group with its BVH. Lights are likewise
+  dispatched to their type (see LightTypes).
 
   @note Once the scene receives a new object, it owns the object and
   is thus responsible for its deallocation.
   */
 
   struct Scene {
+    /// The types of objects, besides spheres, whose methods are
+    /// called statically during intersection. Other types are called
+    /// through the virtual methods of GraphicalObject.
+    typedef ObjectGroups< TriangleMesh, SphereCloud, Instance > Primitives;
+    /// The types of lights whose methods are called statically by the
+    /// renderer (see lightType).
+    typedef TypeSwitch< Light, PointLight > LightTypes;
+
     /// The list of lights modelled as a vector.
     std::vector< Light* > myLights;
     /// The list of objects modelled as a vector.
     std::vector< GraphicalObject* > myObjects;
 
     /// Default constructor. Nothing to do.
-    Scene() {}
+    Scene() : myBVHIsValid( false ) {}
 
     /// Destructor. Frees objects.
     ~Scene() 
@@ -64,49 +86,294 @@ namespace rt {
       for ( Light* light : myLights )
         light->light( viewer );
     }
+    /// @return 'true' if the next call to light() moves a light.
+    bool lightsMoved() const
+    {
+      for ( Light* light : myLights )
+        if ( light->moved() ) return true;
+      return false;
+    }
 
     /// Adds a new object to the scene.
     void addObject( GraphicalObject* anObject )
     {
       myObjects.push_back( anObject );
+      myBVHIsValid = false;
     }
 
     /// Adds a new light to the scene.
     void addLight( Light* aLight )
     {
       myLights.push_back( aLight );
+      myLightTypes.push_back( LightTypes::index( *aLight ) );
+    }
+
+    /// @return the index in LightTypes of the type of the \a i-th light.
+    int lightType( int i ) const { return myLightTypes[ i ]; }
+    
+    /// Below this number of spheres, they are simply scanned by the
+    /// SIMD kernel without BVH.
+    static const int FLAT_SPHERES = 16;
+    /// Maximal number of spheres in a leaf of the BVH of spheres (one
+    /// AVX2 register).
+    static const int SPHERE_LEAF_SIZE = 8;
+
+    /// (Re)builds the acceleration structures over the objects of the
+    /// scene. Must be called again whenever objects are added or moved.
+    void buildBVH()
+    {
+      std::vector< BoundingBox > sphere_boxes;
+      mySpheres.clear();
+      myOthers.clear();
+      for ( GraphicalObject* obj : myObjects )
+        {
+          Sphere* sphere = dynamic_cast< Sphere* >( obj );
+          if ( sphere != 0 )
+            {
+              mySpheres.add( sphere->center, sphere->radius, sphere );
+              sphere_boxes.push_back( sphere->boundingBox() );
+            }
+          else myOthers.add( obj );
+        }
+      if ( (int) sphere_boxes.size() > FLAT_SPHERES )
+        mySphereBVH.build( sphere_boxes, SPHERE_LEAF_SIZE );
+      else
+        mySphereBVH = BVH();
+      std::vector< int > order = mySphereBVH.indices();
+      if ( mySphereBVH.empty() )
+        {
+          order.resize( sphere_boxes.size() );
+          std::iota( order.begin(), order.end(), 0 );
+        }
+      mySpheres.finalize( order );
+      myOthers.build();
+      myBVHIsValid = true;
     }
+
+    /// @return 'true' if the BVH is up to date with the objects.
+    bool hasValidBVH() const { return myBVHIsValid; }
     
-    /// returns the closest object intersected by the given ray.
+    /// returns the closest object intersected by the given ray. Uses
+    /// the acceleration structures if they are valid, otherwise tests
+    /// every object.
     Real
     rayIntersection( const Ray& ray,GraphicalObject*& object, Point3& p )
     {
+      int part;
+      return rayIntersection( ray, object, p, part );
+    }
+
+    /// Same as rayIntersection, also giving the \a part of \a object
+    /// that is hit (see GraphicalObject).
+    Real
+    rayIntersection( const Ray& ray,GraphicalObject*& object, Point3& p, int& part )
+    {
+      Hit  hit;
+      Real result = closestHit( ray, hit );
+      if ( result < 0.0f )
+        {
+          object = hit.object;
+          p      = hit.point;
+          part   = hit.part;
+        }
+      return result;
+    }
+
+    /// Same as rayIntersection, but fills \a hit with everything the
+    /// renderer needs about the closest hit, normals and material
+    /// included (see GraphicalObject::surface).
+    Real
+    rayIntersection( const Ray& ray, Hit& hit )
+    {
+      Real result = closestHit( ray, hit );
+      if ( result < 0.0f ) hit.object->surface( hit );
+      return result;
+    }
+
+    /// Same as rayIntersection for every ray of \a packet: the i-th
+    /// ray gives \a hit[ i ] and \a result[ i ]. Spheres are
+    /// intersected by the whole packet at once, which pays when rays
+    /// are coherent (e.g. neighbouring camera rays).
+    void
+    rayIntersection( RayPacket& packet, Hit hit[], Real result[] )
+    {
+      if ( ! myBVHIsValid )
+        {
+          for ( int k = 0; k < packet.size(); ++k )
+            result[ k ] = rayIntersection( packet.rays[ k ], hit[ k ] );
+          return;
+        }
+      // Spheres, by packets of spheres and rays.
+      if ( mySphereBVH.empty() )
+        {
+          RT_STAT( primitive_tests += mySpheres.size() );
+          mySpheres.closestHits( packet, 0, mySpheres.size() );
+        }
+      else
+        {
+          auto leaf = [&] ( int first, int count ) {
+            mySpheres.closestHits( packet, first, first + count );
+          };
+          mySphereBVH.traversePacketLeaves( packet, leaf );
+        }
+      // Other objects, one ray at a time.
+      for ( int k = 0; k < packet.size(); ++k )
+        {
+          const Ray& ray         = packet.rays[ k ];
+          Real       distanceMin = -1.0f;
+          if ( packet.sphere[ k ] >= 0 )
+            sphereHit( ray, packet.sphere[ k ], packet.tmax[ k ], distanceMin, hit[ k ] );
+          closestOther( ray, packet.tmax[ k ], distanceMin, hit[ k ] );
+          result[ k ] = -distanceMin;
+          if ( distanceMin >= 0.0f ) hit[ k ].object->surface( hit[ k ] );
+        }
+    }
+
+    /// Computes the light that reaches the end of the segment
+    /// [ray.origin, ray.origin + \a max_distance * ray.direction] when
+    /// \a light_color is emitted from the other end, e.g. a shadow ray
+    /// toward a light. Every surface crossed by the segment attenuates
+    /// the light by its diffuse color times its refraction coefficient.
+    /// All crossings are collected in a single traversal, which stops
+    /// as soon as an opaque object is met or the light is too dim.
+    ///
+    /// @note Crossings closer than \a epsilon are ignored, so that the
+    /// surface the ray starts from does not shadow itself.
+    Color
+    occlusion( const Ray& ray, Real max_distance, Color light_color,
+               Real epsilon = 0.0001f )
+    {
+      Real tmax = max_distance;
+      // Attenuates light_color by a surface of material m.
+      auto attenuate = [&] ( const Material& m ) {
+        light_color = light_color * m.diffuse * m.coef_refraction;
+        return light_color.max() > 0.003f;
+      };
+      if ( ! myBVHIsValid )
+        {
+          for ( GraphicalObject* obj : myObjects )
+            {
+              Real t = epsilon;
+              int  part;
+              while ( obj->nextIntersection( ray, t, max_distance, t, part ) )
+                if ( ! attenuate( obj->getMaterial( ray.origin + ray.direction * t, part ) ) )
+                  return light_color;
+            }
+          return light_color;
+        }
+      // Spheres
+      auto transmitSpheres = [&] ( int first, int count, Real& t_stop ) {
+        Real t[ 2 ];
+        for ( int i = first, iE = first + count; i < iE && t_stop >= 0.0f; ++i )
+          for ( int k = 0, n = mySpheres.crossings( ray, i, epsilon, max_distance, t );
+                k < n; ++k )
+            if ( ! attenuate( mySpheres.object( i )->getMaterial( ray.origin + ray.direction * t[ k ], 0 ) ) )
+              { t_stop = -1.0f; break; }
+      };
+      if ( mySphereBVH.empty() )
+        {
+          RT_STAT( primitive_tests += mySpheres.size() );
+          transmitSpheres( 0, mySpheres.size(), tmax );
+        }
+      else mySphereBVH.traverseLeaves( ray, tmax, transmitSpheres );
+      if ( tmax < 0.0f ) return light_color;
+      // Other objects
+      myOthers.transmit( ray, epsilon, max_distance, attenuate );
+      return light_color;
+    }
+
+  private:
+    /// Copy constructor is forbidden.
+    Scene( const Scene& ) = delete;
+    /// Assigment is forbidden.
+    Scene& operator=( const Scene& ) = delete;
+
+    /// Looks for the closest hit of \a ray and fills the distance, the
+    /// point, the object and the part of \a hit (not its surface).
+    /// Uses the acceleration structures if they are valid, otherwise
+    /// tests every object.
+    /// @return minus the squared distance of the hit, or 1 if there is none.
+    Real
+    closestHit( const Ray& ray, Hit& hit )
+    {
+      if ( myBVHIsValid ) return closestHitBVH( ray, hit );
      Real distanceMin = -1.0f;
       Point3 pOther;
+      int    partOther;
       for(std::vector<GraphicalObject*>::iterator it = this->myObjects.begin(), itE = this->myObjects.end(); it!=itE; it++){
-        if( (*it)->rayIntersection(ray,pOther) < 0 ){
+        if( (*it)->rayIntersection(ray,pOther,partOther) < 0 ){
 
           Real distance = (pOther - ray.origin).dot(pOther - ray.origin);
-          if(distanceMin == -1.0f){
-            distanceMin = distance;
-              p = pOther;
-              object = *(it);
-          }
-          else if(distance < distanceMin){
+          if(distanceMin == -1.0f || distance < distanceMin){
             distanceMin = distance;
-            p = pOther;
-            object = *(it);
+            hit.point  = pOther;
+            hit.object = *(it);
+            hit.part   = partOther;
           }
         };
       }
+      if ( distanceMin >= 0.0f ) hit.distance = sqrt( distanceMin );
       return -distanceMin;
     }
 
-  private:
-    /// Copy constructor is forbidden.
-    Scene( const Scene& ) = delete;
-    /// Assigment is forbidden.
-    Scene& operator=( const Scene& ) = delete;
+    /// Same as closestHit, with the acceleration structures.
+    /// BVHs are visited from near to far and stop at the closest hit.
+    Real
+    closestHitBVH( const Ray& ray, Hit& hit )
+    {
+      Real distanceMin = -1.0f; // squared distance, as in closestHit
+      Real tmax        = std::numeric_limits<Real>::max();
+      // Spheres, by packets.
+      int  sphere      = -1;
+      if ( mySphereBVH.empty() )
+        {
+          RT_STAT( primitive_tests += mySpheres.size() );
+          sphere = mySpheres.closestHit( ray, 0, mySpheres.size(), tmax );
+        }
+      else
+        {
+          auto leaf = [&] ( int first, int count, Real& t ) {
+            int i = mySpheres.closestHit( ray, first, first + count, t );
+            if ( i >= 0 ) sphere = i;
+          };
+          mySphereBVH.traverseLeaves( ray, tmax, leaf );
+        }
+      if ( sphere >= 0 ) sphereHit( ray, sphere, tmax, distanceMin, hit );
+      closestOther( ray, tmax, distanceMin, hit );
+      return -distanceMin;
+    }
+
+    /// Fills \a hit with sphere \a i of mySpheres, hit by \a ray at
+    /// distance \a t, and \a distanceMin with its squared distance.
+    void
+    sphereHit( const Ray& ray, int i, Real t, Real& distanceMin, Hit& hit )
+    {
+      hit.point    = ray.origin + ray.direction * t;
+      hit.distance = t;
+      hit.object   = mySpheres.object( i );
+      hit.part     = 0;
+      distanceMin  = (hit.point - ray.origin).dot(hit.point - ray.origin);
+    }
+
+    /// Looks for a hit of \a ray with an object of myOthers closer than
+    /// \a tmax (and whose squared distance is below \a distanceMin,
+    /// unless it is -1). Updates \a distanceMin and \a hit if one is found.
+    void
+    closestOther( const Ray& ray, Real tmax, Real& distanceMin, Hit& hit )
+    {
+      myOthers.closestHit( ray, tmax, distanceMin, hit );
+    }
+
+    /// The spheres of myObjects, stored for SIMD kernels.
+    SphereSet mySpheres;
+    /// The hierarchy over mySpheres (empty if there are few spheres).
+    BVH mySphereBVH;
+    /// The objects of myObjects that are not spheres, by type.
+    Primitives myOthers;
+    /// The index in LightTypes of the type of each light.
+    std::vector< int > myLightTypes;
+    /// 'true' if the structures above correspond to myObjects.
+    bool myBVHIsValid;
   };
 
 } // namespace rt
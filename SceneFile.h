@@ -0,0 +1,421 @@
+/**
+@file SceneFile.h
+@author JOL
+*/
+#pragma once
+#ifndef _SCENE_FILE_H_
+#define _SCENE_FILE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <type_traits>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#define RT_SCENE_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "BVH.h"
+#include "Material.h"
+#include "PointLight.h"
+#include "Scene.h"
+#include "SceneReader.h"
+#include "Sphere.h"
+#include "SphereCloud.h"
+#include "SphereSet.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// Light as stored in a binary scene file.
+  struct SceneFileLight {
+    Real position[ 4 ];
+    Real emission[ 3 ];
+    Real ambient[ 3 ];
+    Real diffuse[ 3 ];
+    Real specular[ 3 ];
+  };
+
+  /// SceneSettings as stored in a binary scene file.
+  struct SceneFileSettings {
+    int32_t has_camera;
+    Real    position[ 3 ];
+    Real    direction[ 3 ];
+    Real    up[ 3 ];
+    Real    field_of_view;
+    int32_t width;
+    int32_t height;
+    int32_t depth;
+    int32_t samples;
+    int32_t filter;
+  };
+
+  /// Header of a binary scene file. Every section starts at a multiple
+  /// of 64 bytes from the beginning of the file.
+  struct SceneFileHeader {
+    /// The sections, in the order of the file.
+    enum Section {
+      CX, CY, CZ, R2,  ///< sphere arrays, padded as in SphereSet (Real)
+      MATERIAL_INDEX,  ///< material of each sphere (uint32_t), padded too
+      MATERIALS,       ///< material table (Material)
+      LIGHTS,          ///< lights (SceneFileLight)
+      NODES,           ///< BVH of the spheres (BVHNode), may be empty
+      NB_SECTIONS
+    };
+    char              magic[ 8 ];  ///< "RTSCENE", null terminated
+    uint32_t          version;
+    uint32_t          byte_order;  ///< BYTE_ORDER_MARK as written
+    uint32_t          nb_spheres;
+    uint32_t          nb_materials;
+    uint32_t          nb_lights;
+    uint32_t          nb_nodes;
+    uint64_t          offset[ NB_SECTIONS ];
+    SceneFileSettings settings;
+  };
+
+  /**
+  Reads and writes scenes made of spheres in a binary format that is
+  loaded without any parsing: the file is mapped in memory and its
+  sphere arrays, material table and BVH are used in place by a
+  SphereCloud. Only the pages actually touched by rays are read from
+  the disk, so that even huge scenes are ready to render at once.
+  Hence loading only checks the header and the bounds of the sections:
+  the indices of materials and nodes are checked where they are used
+  (see SphereCloud and BVH), so that a corrupted file renders wrongly
+  but never makes the renderer read out of the mapping.
+
+  The file has a header (SceneFileHeader) followed by sections whose
+  offsets it gives. The spheres are stored in the order of the leaves
+  of their BVH, as SphereSet stores them. Numbers are stored in the
+  byte order of the machine that wrote the file, which must be the
+  one that reads it. Files are written by the tool ray-tracer-convert
+  from the text format of SceneReader; readScene recognizes both
+  formats by the magic string of binary files.
+  */
+  class SceneFile {
+  public:
+    /// Current version of the format.
+    static const uint32_t VERSION = 1;
+    /// Written as is, to check the byte order when reading.
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+    /// Alignment of sections.
+    static const uint64_t ALIGNMENT = 64;
+
+    static_assert( sizeof( Real ) == 4, "binary scenes store 32-bit reals" );
+    static_assert( std::is_trivially_copyable< Material >::value
+                   && sizeof( Material ) == 15 * sizeof( Real ),
+                   "materials are stored as they are in memory" );
+    static_assert( std::is_trivially_copyable< BVHNode >::value
+                   && sizeof( BVHNode ) == 8 * 4,
+                   "BVH nodes are stored as they are in memory" );
+
+    /// @return 'true' if \a data (of \a size bytes) starts as a binary scene.
+    static bool isBinary( const char* data, std::size_t size )
+    {
+      return size >= 8 && memcmp( data, "RTSCENE", 8 ) == 0;
+    }
+
+    /// Writes the spheres and point lights of \a scene with \a settings
+    /// into file \a filename, with the BVH of the spheres unless \a
+    /// with_bvh is 'false' (smaller files, the BVH is then built when
+    /// loading).
+    /// @return 'false' in case of error, described by error().
+    bool write( const std::string& filename, const Scene& scene,
+                const SceneSettings& settings, bool with_bvh = true )
+    {
+      myError.clear();
+      // Spheres and their materials, without duplicates.
+      std::vector< const Sphere* >    spheres;
+      std::vector< Material >         materials;
+      std::vector< uint32_t >         index;
+      std::map< std::string, uint32_t > known;
+      for ( GraphicalObject* obj : scene.myObjects )
+        {
+          const Sphere* s = dynamic_cast< const Sphere* >( obj );
+          if ( s == 0 ) return fail( "only spheres can be stored in a binary scene" );
+          std::string key( (const char*) &s->material, sizeof( Material ) );
+          auto it = known.find( key );
+          if ( it == known.end() )
+            {
+              it = known.insert( std::make_pair( key, (uint32_t) materials.size() ) ).first;
+              materials.push_back( s->material );
+            }
+          spheres.push_back( s );
+          index.push_back( it->second );
+        }
+      std::vector< SceneFileLight > lights;
+      for ( Light* light : scene.myLights )
+        {
+          const PointLight* l = dynamic_cast< const PointLight* >( light );
+          if ( l == 0 ) return fail( "only point lights can be stored in a binary scene" );
+          SceneFileLight r;
+          for ( int k = 0; k < 4; ++k ) r.position[ k ] = l->position[ k ];
+          for ( int k = 0; k < 3; ++k )
+            {
+              r.emission[ k ] = l->emission[ k ];
+              r.ambient[ k ]  = l->material.ambient[ k ];
+              r.diffuse[ k ]  = l->material.diffuse[ k ];
+              r.specular[ k ] = l->material.specular[ k ];
+            }
+          lights.push_back( r );
+        }
+      // The BVH gives the order of the spheres.
+      const int n = (int) spheres.size();
+      BVH bvh;
+      std::vector< int > order( n );
+      std::iota( order.begin(), order.end(), 0 );
+      if ( with_bvh && n > 0 )
+        {
+          std::vector< BoundingBox > boxes;
+          for ( const Sphere* s : spheres ) boxes.push_back( s->boundingBox() );
+          bvh.build( boxes, Scene::SPHERE_LEAF_SIZE );
+          order = bvh.indices();
+        }
+      std::vector< Real >     cx, cy, cz, r2;
+      std::vector< uint32_t > sorted_index;
+      for ( int i : order )
+        {
+          cx.push_back( spheres[ i ]->center[ 0 ] );
+          cy.push_back( spheres[ i ]->center[ 1 ] );
+          cz.push_back( spheres[ i ]->center[ 2 ] );
+          r2.push_back( spheres[ i ]->radius * spheres[ i ]->radius );
+          sorted_index.push_back( index[ i ] );
+        }
+      // Dummy spheres have a negative squared radius and are never hit.
+      for ( int k = 0; k < SphereSet::PADDING; ++k )
+        {
+          cx.push_back( 0.0f ); cy.push_back( 0.0f ); cz.push_back( 0.0f );
+          r2.push_back( -1e30f );
+          sorted_index.push_back( 0 );
+        }
+
+      SceneFileHeader header;
+      memset( &header, 0, sizeof( header ) );
+      memcpy( header.magic, "RTSCENE", 8 );
+      header.version      = VERSION;
+      header.byte_order   = BYTE_ORDER_MARK;
+      header.nb_spheres   = n;
+      header.nb_materials = materials.size();
+      header.nb_lights    = lights.size();
+      header.nb_nodes     = bvh.size();
+      header.settings     = store( settings );
+      const void* data[ SceneFileHeader::NB_SECTIONS ] = {
+        cx.data(), cy.data(), cz.data(), r2.data(), sorted_index.data(),
+        materials.data(), lights.data(), bvh.data() };
+      uint64_t size[ SceneFileHeader::NB_SECTIONS ] = {
+        cx.size() * sizeof( Real ), cy.size() * sizeof( Real ),
+        cz.size() * sizeof( Real ), r2.size() * sizeof( Real ),
+        sorted_index.size() * sizeof( uint32_t ),
+        materials.size() * sizeof( Material ), lights.size() * sizeof( SceneFileLight ),
+        header.nb_nodes * sizeof( BVHNode ) };
+      uint64_t pos = align( sizeof( header ) );
+      for ( int s = 0; s < SceneFileHeader::NB_SECTIONS; ++s )
+        {
+          header.offset[ s ] = pos;
+          pos = align( pos + size[ s ] );
+        }
+
+      std::ofstream output( filename.c_str(), std::ios::binary );
+      if ( ! output.good() ) return fail( "unable to create " + filename );
+      const char zeros[ ALIGNMENT ] = {};
+      output.write( (const char*) &header, sizeof( header ) );
+      pos = sizeof( header );
+      for ( int s = 0; s < SceneFileHeader::NB_SECTIONS; ++s )
+        {
+          output.write( zeros, header.offset[ s ] - pos );
+          output.write( (const char*) data[ s ], size[ s ] );
+          pos = header.offset[ s ] + size[ s ];
+        }
+      if ( ! output.good() ) return fail( "unable to write " + filename );
+      return true;
+    }
+
+    /// Maps file \a filename, adds its spheres (as one SphereCloud) and
+    /// its lights to \a scene and fills \a settings.
+    /// @return 'false' in case of error, described by error().
+    bool read( const std::string& filename, Scene& scene, SceneSettings& settings )
+    {
+      myError.clear();
+      std::shared_ptr< void > storage;
+      std::size_t size;
+      if ( ! map( filename, storage, size ) ) return false;
+      const char* base = (const char*) storage.get();
+      SceneFileHeader h;
+      if ( size < sizeof( h ) || ! isBinary( base, size ) )
+        return fail( filename + " is not a binary scene" );
+      memcpy( &h, base, sizeof( h ) );
+      if ( h.version != VERSION ) return fail( filename + ": unsupported version" );
+      if ( h.byte_order != BYTE_ORDER_MARK )
+        return fail( filename + " was written on a machine of another byte order" );
+      const uint64_t nb_padded = (uint64_t) h.nb_spheres + SphereSet::PADDING;
+      const uint64_t count[ SceneFileHeader::NB_SECTIONS ] = {
+        nb_padded * sizeof( Real ), nb_padded * sizeof( Real ),
+        nb_padded * sizeof( Real ), nb_padded * sizeof( Real ),
+        nb_padded * sizeof( uint32_t ), h.nb_materials * sizeof( Material ),
+        h.nb_lights * sizeof( SceneFileLight ), h.nb_nodes * sizeof( BVHNode ) };
+      for ( int s = 0; s < SceneFileHeader::NB_SECTIONS; ++s )
+        if ( h.offset[ s ] % ALIGNMENT != 0 || h.offset[ s ] > size
+             || count[ s ] > size - h.offset[ s ] )
+          return fail( filename + " is truncated or corrupted" );
+      if ( h.nb_spheres > (uint32_t) std::numeric_limits< int >::max()
+           || h.nb_nodes > (uint32_t) std::numeric_limits< int >::max() )
+        return fail( filename + ": too many spheres" );
+      if ( h.nb_spheres > 0 && h.nb_materials == 0 )
+        return fail( filename + ": spheres without materials" );
+      if ( scene.myLights.size() + h.nb_lights > 8 )
+        return fail( filename + ": at most 8 lights are supported" );
+
+      // Mapped sections.
+      const Real*     cx    = (const Real*)( base + h.offset[ SceneFileHeader::CX ] );
+      const Real*     cy    = (const Real*)( base + h.offset[ SceneFileHeader::CY ] );
+      const Real*     cz    = (const Real*)( base + h.offset[ SceneFileHeader::CZ ] );
+      const Real*     r2    = (const Real*)( base + h.offset[ SceneFileHeader::R2 ] );
+      const uint32_t* index = (const uint32_t*)( base + h.offset[ SceneFileHeader::MATERIAL_INDEX ] );
+      const Material* materials = (const Material*)( base + h.offset[ SceneFileHeader::MATERIALS ] );
+      const SceneFileLight* lights = (const SceneFileLight*)( base + h.offset[ SceneFileHeader::LIGHTS ] );
+      const BVHNode*  nodes = (const BVHNode*)( base + h.offset[ SceneFileHeader::NODES ] );
+      // Nothing is read from the sections here (see the class comment).
+      if ( h.nb_spheres > 0 )
+        scene.addObject( new SphereCloud( h.nb_spheres, SphereArrays{ cx, cy, cz, r2 },
+                                          index, materials, h.nb_materials,
+                                          nodes, h.nb_nodes, storage ) );
+      for ( uint32_t i = 0; i < h.nb_lights; ++i )
+        {
+          const SceneFileLight& l = lights[ i ];
+          scene.addLight( new PointLight( GL_LIGHT0 + scene.myLights.size(),
+                                          Point4( l.position ),
+                                          Color( l.emission[ 0 ], l.emission[ 1 ], l.emission[ 2 ] ),
+                                          Color( l.ambient[ 0 ], l.ambient[ 1 ], l.ambient[ 2 ] ),
+                                          Color( l.diffuse[ 0 ], l.diffuse[ 1 ], l.diffuse[ 2 ] ),
+                                          Color( l.specular[ 0 ], l.specular[ 1 ], l.specular[ 2 ] ) ) );
+        }
+      settings = load( h.settings );
+      return true;
+    }
+
+    /// @return the description of the last error.
+    const std::string& error() const { return myError; }
+
+  private:
+    std::string myError;
+
+    bool fail( const std::string& msg )
+    {
+      myError = msg;
+      return false;
+    }
+
+    static uint64_t align( uint64_t pos )
+    {
+      return ( pos + ALIGNMENT - 1 ) / ALIGNMENT * ALIGNMENT;
+    }
+
+    /// Maps the whole file \a filename in memory, in \a storage, which
+    /// unmaps it when it is released.
+    bool map( const std::string& filename, std::shared_ptr< void >& storage,
+              std::size_t& size )
+    {
+#ifdef RT_SCENE_FILE_MMAP
+      int fd = open( filename.c_str(), O_RDONLY );
+      if ( fd < 0 ) return fail( "unable to open " + filename );
+      struct stat st;
+      if ( fstat( fd, &st ) != 0 || st.st_size == 0 )
+        {
+          close( fd );
+          return fail( "unable to read " + filename );
+        }
+      size = st.st_size;
+      void* data = mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+      close( fd ); // the mapping stays valid
+      if ( data == MAP_FAILED ) return fail( "unable to map " + filename );
+      storage = std::shared_ptr< void >( data, [size] ( void* p ) { munmap( p, size ); } );
+#else
+      // No mapping: the file is read in a buffer aligned as the sections.
+      std::ifstream input( filename.c_str(), std::ios::binary | std::ios::ate );
+      if ( ! input.good() ) return fail( "unable to open " + filename );
+      size = (std::size_t) input.tellg();
+      std::shared_ptr< std::vector< uint64_t > > buffer
+        = std::make_shared< std::vector< uint64_t > >( ( size + 7 ) / 8 + ALIGNMENT / 8 );
+      char* data = (char*) buffer->data();
+      data += ( ALIGNMENT - (std::size_t) data % ALIGNMENT ) % ALIGNMENT;
+      input.seekg( 0 );
+      if ( ! input.read( data, size ) ) return fail( "unable to read " + filename );
+      storage = std::shared_ptr< void >( data, [buffer] ( void* ) {} );
+#endif
+      return true;
+    }
+
+    static SceneFileSettings store( const SceneSettings& s )
+    {
+      SceneFileSettings r;
+      r.has_camera = s.has_camera;
+      for ( int k = 0; k < 3; ++k )
+        {
+          r.position[ k ]  = s.camera.position[ k ];
+          r.direction[ k ] = s.camera.direction[ k ];
+          r.up[ k ]        = s.camera.up[ k ];
+        }
+      r.field_of_view = s.camera.fieldOfView;
+      r.width   = s.width;
+      r.height  = s.height;
+      r.depth   = s.depth;
+      r.samples = s.samples;
+      r.filter  = s.filter.type();
+      return r;
+    }
+
+    static SceneSettings load( const SceneFileSettings& s )
+    {
+      SceneSettings r;
+      r.has_camera = s.has_camera != 0;
+      for ( int k = 0; k < 3; ++k )
+        {
+          r.camera.position[ k ]  = s.position[ k ];
+          r.camera.direction[ k ] = s.direction[ k ];
+          r.camera.up[ k ]        = s.up[ k ];
+        }
+      r.camera.fieldOfView = s.field_of_view;
+      r.width   = s.width;
+      r.height  = s.height;
+      r.depth   = s.depth;
+      r.samples = s.samples;
+      if ( s.filter == PixelFilter::TENT || s.filter == PixelFilter::GAUSSIAN )
+        r.filter = PixelFilter( (PixelFilter::Type) s.filter );
+      return r;
+    }
+  };
+
+  /// Reads file \a filename, which is either a binary scene (see
+  /// SceneFile) or a text one (see SceneReader), into \a scene and \a
+  /// settings.
+  /// @return 'false' in case of error, described by \a error.
+  inline bool readScene( const std::string& filename, Scene& scene,
+                         SceneSettings& settings, std::string& error )
+  {
+    char magic[ 8 ] = {};
+    std::ifstream input( filename.c_str(), std::ios::binary );
+    input.read( magic, sizeof( magic ) );
+    if ( SceneFile::isBinary( magic, input.gcount() ) )
+      {
+        SceneFile file;
+        if ( file.read( filename, scene, settings ) ) return true;
+        error = file.error();
+        return false;
+      }
+    SceneReader reader;
+    if ( reader.read( filename, scene, settings ) ) return true;
+    error = reader.error();
+    return false;
+  }
+
+} // namespace rt
+
+#endif // #define _SCENE_FILE_H_
@@ -0,0 +1,476 @@
+/**
+@file SceneReader.h
+@author JOL
+*/
+#pragma once
+#ifndef _SCENE_READER_H_
+#define _SCENE_READER_H_
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Camera.h"
+#include "Instance.h"
+#include "Material.h"
+#include "ParseReal.h"
+#include "PixelFilter.h"
+#include "PointLight.h"
+#include "RayStack.h"
+#include "Scene.h"
+#include "Scenes.h"
+#include "Sphere.h"
+#include "SphereCloud.h"
+#include "Transform.h"
+#include "TriangleMesh.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// Camera and rendering settings that a scene file may specify.
+  /// Integers are negative when the file does not give them.
+  struct SceneSettings {
+    /// 'true' if the file has a camera statement.
+    bool        has_camera;
+    Camera      camera;
+    int         width;
+    int         height;
+    int         depth;
+    int         samples;
+    PixelFilter filter;
+
+    SceneSettings()
+      : has_camera( false ), width( -1 ), height( -1 ), depth( -1 ), samples( -1 ) {}
+  };
+
+  /**
+  Reads scenes described in a text file. Each line is one statement,
+  '#' starts a comment:
+
+  @code
+  material <name> <base> [<field> <values>]...  # base is a preset or "none"
+  sphere   <x> <y> <z> <radius> <material>
+  bubble   <x> <y> <z> <radius> <material>       # as addBubble
+  mesh     <file.obj> <material>                 # see MeshData::readOBJ
+  geometry <name> <file.obj> <material>          # a mesh only seen through instances
+  geometry <name> begin                          # the spheres and bubbles up to
+  end                                            # 'end' form a SphereCloud
+  instance <name> [material <m>] [translate <x> <y> <z>] [scale <s> | <sx> <sy> <sz>]
+           [rotate <x> <y> <z> <degrees>]        # see Instance
+  light    <x> <y> <z> <w> <r> <g> <b>           # w = 0: light at infinity
+  camera   [position <x> <y> <z>] [direction <x> <y> <z>] [at <x> <y> <z>]
+           [up <x> <y> <z>] [fov <degrees>]
+  size     <width> <height>
+  depth    <max depth>                           # at most RayStack::MAX_DEPTH
+  samples  <n> [box|tent|gaussian]
+  @endcode
+
+  Material fields are named as in Material: ambient, diffuse and
+  specular take 3 reals, shinyness, coef_diffusion, coef_reflexion,
+  coef_refraction, in_refractive_index and out_refractive_index take
+  one. The presets whitePlastic, redPlastic, bronze, emerald and glass
+  may be used everywhere a material is expected. OBJ files are looked
+  for relatively to the directory of the scene file. The
+  transformations of an instance are applied in the order of the line.
+
+  The whole file is read at once and parsed in place: tokens are
+  never copied, so that scenes with millions of spheres load quickly.
+  */
+  class SceneReader {
+  public:
+    /// Reads file \a filename, adds its objects and lights to \a
+    /// scene and fills \a settings.
+    /// @return 'false' in case of error, described by error().
+    bool read( const std::string& filename, Scene& scene, SceneSettings& settings )
+    {
+      myName = filename;
+      std::ifstream input( filename.c_str(), std::ios::binary | std::ios::ate );
+      if ( ! input.good() ) return fail( "unable to open " + filename );
+      std::string text( (std::size_t) input.tellg(), '\0' );
+      input.seekg( 0 );
+      if ( ! input.read( &text[ 0 ], text.size() ) ) return fail( "unable to read " + filename );
+      return parse( text, scene, settings );
+    }
+
+    /// Same as read, from the text \a text.
+    bool parse( const std::string& text, Scene& scene, SceneSettings& settings )
+    {
+      // parseReal needs a terminating character, which std::string provides.
+      myCur  = text.c_str();
+      myEnd  = myCur + text.size();
+      myLine = 1;
+      myError.clear();
+      myMaterials.clear();
+      myGeometries.clear();
+      myInCluster = false;
+      myNbLights = (int) scene.myLights.size();
+      while ( skipBlank() )
+        {
+          const char* w; int n;
+          if ( ! word( w, n ) ) return fail( "expected a statement" );
+          bool ok;
+          if      ( is( w, n, "sphere" ) )   ok = sphere( scene, false );
+          else if ( is( w, n, "bubble" ) )   ok = sphere( scene, true );
+          else if ( is( w, n, "mesh" ) )     ok = mesh( scene );
+          else if ( is( w, n, "geometry" ) ) ok = geometry();
+          else if ( is( w, n, "end" ) )      ok = endCluster();
+          else if ( is( w, n, "instance" ) ) ok = instance( scene );
+          else if ( is( w, n, "material" ) ) ok = material();
+          else if ( is( w, n, "light" ) )    ok = light( scene );
+          else if ( is( w, n, "camera" ) )   ok = camera( settings );
+          else if ( is( w, n, "size" ) )
+            ok = integer( settings.width ) && integer( settings.height )
+              && settings.width > 1 && settings.height > 1;
+          else if ( is( w, n, "depth" ) )
+            ok = integer( settings.depth ) && settings.depth >= 0
+              && settings.depth <= RayStack::MAX_DEPTH;
+          else if ( is( w, n, "samples" ) )  ok = samples( settings );
+          else return fail( "unknown statement " + std::string( w, n ) );
+          if ( ! ok ) return myError.empty() ? fail( "invalid statement" ) : false;
+          if ( ! endOfLine() ) return fail( "unexpected characters at end of line" );
+        }
+      if ( myInCluster ) return fail( "missing end of geometry " + myClusterName );
+      return true;
+    }
+
+    /// @return the description of the last error, as "file:line: message".
+    const std::string& error() const { return myError; }
+
+  private:
+    const char* myCur;
+    const char* myEnd;
+    int         myLine;
+    int         myNbLights;
+    std::string myName;
+    std::string myError;
+    /// Declared materials and their names.
+    std::vector< std::pair< std::string, Material > > myMaterials;
+    /// Declared geometries, by name.
+    std::map< std::string, std::shared_ptr< GraphicalObject > > myGeometries;
+    /// 'true' between "geometry <name> begin" and "end", where spheres
+    /// are gathered in the following vectors.
+    bool                    myInCluster;
+    std::string             myClusterName;
+    std::vector< Point3 >   myClusterCenters;
+    std::vector< Real >     myClusterRadii;
+    std::vector< Material > myClusterMaterials;
+
+    bool fail( const std::string& msg )
+    {
+      std::ostringstream s;
+      s << ( myName.empty() ? "<scene>" : myName ) << ":" << myLine << ": " << msg;
+      myError = s.str();
+      return false;
+    }
+
+    static bool isBlank( char c ) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    /// Skips blanks, comments and empty lines.
+    /// @return 'false' at the end of the text.
+    bool skipBlank()
+    {
+      for ( ; myCur < myEnd; ++myCur )
+        {
+          if ( *myCur == '#' )
+            while ( myCur < myEnd && *myCur != '\n' ) ++myCur;
+          if ( myCur == myEnd ) break;
+          if ( *myCur == '\n' ) ++myLine;
+          else if ( ! isBlank( *myCur ) ) return true;
+        }
+      return false;
+    }
+
+    /// Skips blanks and comments on the current line.
+    /// @return 'true' if the line ends there (the newline is not consumed).
+    bool endOfLine()
+    {
+      while ( myCur < myEnd && isBlank( *myCur ) ) ++myCur;
+      if ( myCur < myEnd && *myCur == '#' )
+        while ( myCur < myEnd && *myCur != '\n' ) ++myCur;
+      return myCur == myEnd || *myCur == '\n';
+    }
+
+    /// Reads the next word of the current line as a pointer \a w and a length \a n.
+    bool word( const char*& w, int& n )
+    {
+      if ( endOfLine() ) return false;
+      w = myCur;
+      while ( myCur < myEnd && ! isBlank( *myCur ) && *myCur != '\n' && *myCur != '#' )
+        ++myCur;
+      n = (int)( myCur - w );
+      return true;
+    }
+
+    static bool is( const char* w, int n, const char* keyword )
+    {
+      return (int) strlen( keyword ) == n && memcmp( w, keyword, n ) == 0;
+    }
+
+    bool real( Real& x )
+    {
+      if ( endOfLine() ) return false;
+      char* next;
+      x = parseReal( myCur, &next );
+      if ( next == myCur ) return fail( "expected a number" );
+      myCur = next;
+      return true;
+    }
+
+    bool integer( int& x )
+    {
+      if ( endOfLine() ) return false;
+      char* next;
+      x = (int) strtol( myCur, &next, 10 );
+      if ( next == myCur ) return fail( "expected an integer" );
+      myCur = next;
+      return true;
+    }
+
+    bool point( Point3& p )  { return real( p[ 0 ] ) && real( p[ 1 ] ) && real( p[ 2 ] ); }
+    bool color( Color& c )   { return real( c.r() ) && real( c.g() ) && real( c.b() ); }
+
+    /// Finds the material called \a w among the declared ones and the presets.
+    bool findMaterial( const char* w, int n, Material& m )
+    {
+      // The last declaration wins.
+      for ( auto it = myMaterials.rbegin(); it != myMaterials.rend(); ++it )
+        if ( (int) it->first.size() == n && memcmp( w, it->first.data(), n ) == 0 )
+          { m = it->second; return true; }
+      if      ( is( w, n, "whitePlastic" ) ) m = Material::whitePlastic();
+      else if ( is( w, n, "redPlastic" ) )   m = Material::redPlastic();
+      else if ( is( w, n, "bronze" ) )       m = Material::bronze();
+      else if ( is( w, n, "emerald" ) )      m = Material::emerald();
+      else if ( is( w, n, "glass" ) )        m = Material::glass();
+      else return fail( "unknown material " + std::string( w, n ) );
+      return true;
+    }
+
+    bool material()
+    {
+      const char* w; int n;
+      if ( ! word( w, n ) ) return false;
+      std::string name( w, n );
+      Material m;
+      if ( ! word( w, n ) ) return false;
+      if ( is( w, n, "none" ) ) m = Material( Color(), Color(), Color() );
+      else if ( ! findMaterial( w, n, m ) ) return false;
+      while ( word( w, n ) )
+        {
+          bool ok;
+          if      ( is( w, n, "ambient" ) )   ok = color( m.ambient );
+          else if ( is( w, n, "diffuse" ) )   ok = color( m.diffuse );
+          else if ( is( w, n, "specular" ) )  ok = color( m.specular );
+          else if ( is( w, n, "shinyness" ) ) ok = real( m.shinyness );
+          else if ( is( w, n, "coef_diffusion" ) )  ok = real( m.coef_diffusion );
+          else if ( is( w, n, "coef_reflexion" ) )  ok = real( m.coef_reflexion );
+          else if ( is( w, n, "coef_refraction" ) ) ok = real( m.coef_refraction );
+          else if ( is( w, n, "in_refractive_index" ) )  ok = real( m.in_refractive_index );
+          else if ( is( w, n, "out_refractive_index" ) ) ok = real( m.out_refractive_index );
+          else return fail( "unknown material field " + std::string( w, n ) );
+          if ( ! ok ) return false;
+        }
+      myMaterials.push_back( std::make_pair( name, m ) );
+      return true;
+    }
+
+    bool sphere( Scene& scene, bool bubble )
+    {
+      Point3 c;
+      Real   r;
+      const char* w; int n;
+      Material m;
+      if ( ! ( point( c ) && real( r ) && word( w, n ) && findMaterial( w, n, m ) ) )
+        return false;
+      if ( r <= 0.0f ) return fail( "the radius must be positive" );
+      if ( myInCluster )
+        {
+          myClusterCenters.push_back( c );
+          myClusterRadii.push_back( r );
+          myClusterMaterials.push_back( m );
+          if ( bubble )
+            { // as addBubble
+              std::swap( m.in_refractive_index, m.out_refractive_index );
+              myClusterCenters.push_back( c );
+              myClusterRadii.push_back( r - 0.02f );
+              myClusterMaterials.push_back( m );
+            }
+        }
+      else if ( bubble ) addBubble( scene, c, r, m );
+      else               scene.addObject( new Sphere( c, r, m ) );
+      return true;
+    }
+
+    /// @return the path of file \a file, relative to the scene file.
+    std::string path( const std::string& file ) const
+    {
+      std::string::size_type slash = myName.find_last_of( '/' );
+      if ( file[ 0 ] != '/' && slash != std::string::npos )
+        return myName.substr( 0, slash + 1 ) + file;
+      return file;
+    }
+
+    bool geometry()
+    {
+      const char* w; int n;
+      if ( myInCluster ) return fail( "geometries cannot be nested" );
+      if ( ! word( w, n ) ) return false;
+      std::string name( w, n );
+      if ( ! word( w, n ) ) return false;
+      if ( is( w, n, "begin" ) )
+        {
+          myInCluster   = true;
+          myClusterName = name;
+          myClusterCenters.clear();
+          myClusterRadii.clear();
+          myClusterMaterials.clear();
+          return true;
+        }
+      std::string file( w, n );
+      Material m;
+      if ( ! ( word( w, n ) && findMaterial( w, n, m ) ) ) return false;
+      std::shared_ptr< MeshData > data = std::make_shared< MeshData >();
+      std::string error;
+      if ( ! data->readOBJ( path( file ), error ) ) return fail( error );
+      myGeometries[ name ] = std::make_shared< TriangleMesh >( data, m );
+      return true;
+    }
+
+    bool endCluster()
+    {
+      if ( ! myInCluster ) return fail( "end without geometry" );
+      if ( myClusterCenters.empty() ) return fail( "empty geometry " + myClusterName );
+      myInCluster = false;
+      myGeometries[ myClusterName ] = std::shared_ptr< GraphicalObject >
+        ( SphereCloud::make( myClusterCenters, myClusterRadii, myClusterMaterials ) );
+      return true;
+    }
+
+    /// Reads a real if the next word is a number, without error otherwise.
+    bool optionalReal( Real& x )
+    {
+      if ( endOfLine() ) return false;
+      char* next;
+      Real  y = parseReal( myCur, &next );
+      if ( next == myCur ) return false;
+      x     = y;
+      myCur = next;
+      return true;
+    }
+
+    bool instance( Scene& scene )
+    {
+      const char* w; int n;
+      if ( ! word( w, n ) ) return false;
+      auto it = myGeometries.find( std::string( w, n ) );
+      if ( it == myGeometries.end() ) return fail( "unknown geometry " + std::string( w, n ) );
+      Transform t;
+      Material  m;
+      bool      has_material = false;
+      while ( word( w, n ) )
+        {
+          Vector3 v;
+          Real    angle;
+          bool    ok = true;
+          if ( is( w, n, "material" ) )
+            ok = has_material = word( w, n ) && findMaterial( w, n, m );
+          else if ( is( w, n, "translate" ) )
+            {
+              ok = point( v );
+              t  = Transform::translation( v ) * t;
+            }
+          else if ( is( w, n, "rotate" ) )
+            {
+              ok = point( v ) && real( angle ) && v.dot( v ) > 0.0f;
+              t  = Transform::rotation( v, angle * M_PI / 180.0 ) * t;
+            }
+          else if ( is( w, n, "scale" ) )
+            {
+              ok = real( v[ 0 ] );
+              if ( ! optionalReal( v[ 1 ] ) ) v[ 1 ] = v[ 2 ] = v[ 0 ];
+              else ok = ok && real( v[ 2 ] );
+              ok = ok && v[ 0 ] * v[ 1 ] * v[ 2 ] != 0.0f;
+              t  = Transform::scaling( v ) * t;
+            }
+          else return fail( "unknown instance field " + std::string( w, n ) );
+          if ( ! ok ) return false;
+        }
+      if ( has_material ) scene.addObject( new Instance( it->second, t, m ) );
+      else                scene.addObject( new Instance( it->second, t ) );
+      return true;
+    }
+
+    bool mesh( Scene& scene )
+    {
+      const char* w; int n;
+      if ( ! word( w, n ) ) return false;
+      std::string file( w, n );
+      Material m;
+      if ( ! ( word( w, n ) && findMaterial( w, n, m ) ) ) return false;
+      std::shared_ptr< MeshData > data = std::make_shared< MeshData >();
+      std::string error;
+      if ( ! data->readOBJ( path( file ), error ) ) return fail( error );
+      scene.addObject( new TriangleMesh( data, m ) );
+      return true;
+    }
+
+    bool light( Scene& scene )
+    {
+      Point4 p;
+      Color  c;
+      if ( ! ( real( p[ 0 ] ) && real( p[ 1 ] ) && real( p[ 2 ] ) && real( p[ 3 ] )
+               && color( c ) ) )
+        return false;
+      if ( myNbLights >= 8 ) return fail( "at most 8 lights are supported" );
+      scene.addLight( new PointLight( GL_LIGHT0 + myNbLights++, p, c ) );
+      return true;
+    }
+
+    bool camera( SceneSettings& settings )
+    {
+      Camera& cam = settings.camera;
+      Vector3 dir = cam.direction;
+      Vector3 up  = cam.up;
+      Point3  target;
+      bool    at  = false;
+      const char* w; int n;
+      while ( word( w, n ) )
+        {
+          bool ok;
+          if      ( is( w, n, "position" ) )  ok = point( cam.position );
+          else if ( is( w, n, "direction" ) ) { ok = point( dir ); at = false; }
+          else if ( is( w, n, "at" ) )        { ok = point( target ); at = true; }
+          else if ( is( w, n, "up" ) )        ok = point( up );
+          else if ( is( w, n, "fov" ) )
+            {
+              ok = real( cam.fieldOfView );
+              cam.fieldOfView *= M_PI / 180.0;
+            }
+          else return fail( "unknown camera field " + std::string( w, n ) );
+          if ( ! ok ) return false;
+        }
+      if ( at ) cam.lookAt( target, up );
+      else      cam.setOrientation( dir, up );
+      settings.has_camera = true;
+      return true;
+    }
+
+    bool samples( SceneSettings& settings )
+    {
+      if ( ! integer( settings.samples ) || settings.samples < 1 ) return false;
+      const char* w; int n;
+      if ( ! word( w, n ) ) return true;
+      bool ok;
+      settings.filter = PixelFilter::fromName( std::string( w, n ), ok );
+      return ok || fail( "unknown filter " + std::string( w, n ) );
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _SCENE_READER_H_
@@ -0,0 +1,153 @@
+/**
+@file Scenes.h
+@author JOL
+*/
+#pragma once
+#ifndef _SCENES_H_
+#define _SCENES_H_
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include "Scene.h"
+#include "Sphere.h"
+#include "TriangleMesh.h"
+#include "Material.h"
+#include "PointLight.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// @return a triangulated sphere of center \a c and radius \a r,
+  /// with \a nlat latitudes and \a nlon longitudes, i.e. about 2 x
+  /// nlat x nlon triangles sharing their vertices.
+  inline std::shared_ptr< MeshData > makeSphereMesh( Point3 c, Real r, int nlat, int nlon )
+  {
+    std::shared_ptr< MeshData > mesh = std::make_shared< MeshData >();
+    mesh->vertices.push_back( c - Vector3( 0, r, 0 ) ); // south pole
+    for ( int i = 1; i < nlat; ++i )
+      {
+        double lat = M_PI * ( (double) i / nlat - 0.5 );
+        for ( int j = 0; j < nlon; ++j )
+          {
+            double lon = 2.0 * M_PI * j / nlon;
+            mesh->vertices.push_back( c + r * Vector3( cos( lat ) * cos( lon ), sin( lat ),
+                                                       cos( lat ) * sin( lon ) ) );
+          }
+      }
+    mesh->vertices.push_back( c + Vector3( 0, r, 0 ) ); // north pole
+    const int north = (int) mesh->vertices.size() - 1;
+    auto v = [nlon] ( int i, int j ) { return 1 + ( i - 1 ) * nlon + j % nlon; };
+    for ( int j = 0; j < nlon; ++j )
+      {
+        mesh->addTriangle( 0, v( 1, j + 1 ), v( 1, j ) );
+        mesh->addTriangle( north, v( nlat - 1, j ), v( nlat - 1, j + 1 ) );
+      }
+    for ( int i = 1; i + 1 < nlat; ++i )
+      for ( int j = 0; j < nlon; ++j )
+        {
+          mesh->addTriangle( v( i, j ), v( i, j + 1 ), v( i + 1, j + 1 ) );
+          mesh->addTriangle( v( i, j ), v( i + 1, j + 1 ), v( i + 1, j ) );
+        }
+    mesh->finalize();
+    return mesh;
+  }
+
+  /// Adds a transparent bubble, i.e. two concentric spheres where the
+  /// inner one has its refractive indices swapped.
+  inline void addBubble( Scene& scene, Point3 c, Real r, Material transp_m )
+  {
+    Material revert_m = transp_m;
+    std::swap( revert_m.in_refractive_index, revert_m.out_refractive_index );
+    Sphere* sphere_out = new Sphere( c, r, transp_m );
+    Sphere* sphere_in  = new Sphere( c, r-0.02f, revert_m );
+    scene.addObject( sphere_out );
+    scene.addObject( sphere_in );
+  }
+
+  /// Fills \a scene with three spheres, five glass bubbles and two lights.
+  inline void makeBubbleScene( Scene& scene )
+  {
+    // Light at infinity
+    Light* light0 = new PointLight( GL_LIGHT0, Point4( 0,0,1,0 ),
+                                    Color( 1.0, 1.0, 1.0 ) );
+    Light* light1 = new PointLight( GL_LIGHT1, Point4( -10,-4,2,1 ),
+                                    Color( 1.0, 1.0, 1.0 ) );
+    scene.addLight( light0 );
+    scene.addLight( light1 );
+    // Objects
+    Sphere* sphere1 = new Sphere( Point3( 0, 0, 0), 2.0, Material::bronze() );
+    Sphere* sphere2 = new Sphere( Point3( 0, 4, 0), 1.0, Material::emerald() );
+    Sphere* sphere3 = new Sphere( Point3( 6, 6, 0), 3.0, Material::whitePlastic() );
+    scene.addObject( sphere1 );
+    scene.addObject( sphere2 );
+    scene.addObject( sphere3 );
+    addBubble( scene, Point3( -5, 4, -1 ), 2.0, Material::glass() );
+    addBubble( scene, Point3( -10, 6, -2 ), 2.0, Material::glass() );
+    addBubble( scene, Point3( -10, 8, -5 ), 2.0, Material::glass() );
+    addBubble( scene, Point3( -14, 2, -3 ), 2.0, Material::glass() );
+    addBubble( scene, Point3( -20, 1, -10 ), 2.0, Material::glass() );
+  }
+
+  /// Fills \a scene with \a n small spheres scattered in the cube
+  /// [-8,8]^3 (one in ten is made of glass), lit as the bubble scene.
+  /// The scene only depends on \a n and \a seed, on every platform.
+  inline void makeSpheresScene( Scene& scene, int n, unsigned int seed = 1 )
+  {
+    scene.addLight( new PointLight( GL_LIGHT0, Point4( 0,0,1,0 ),
+                                    Color( 1.0, 1.0, 1.0 ) ) );
+    scene.addLight( new PointLight( GL_LIGHT1, Point4( -10,-4,2,1 ),
+                                    Color( 1.0, 1.0, 1.0 ) ) );
+    const Material materials[] = { Material::bronze(), Material::emerald(),
+                                   Material::whitePlastic(), Material::redPlastic(),
+                                   Material::bronze(), Material::emerald(),
+                                   Material::whitePlastic(), Material::redPlastic(),
+                                   Material::whitePlastic(), Material::glass() };
+    // mt19937 is fully specified, unlike the standard distributions.
+    std::mt19937 gen( seed );
+    auto uniform = [&] () { return (Real)( gen() >> 8 ) / 16777216.0f; };
+    for ( int i = 0; i < n; ++i )
+      {
+        Point3 c( 16.0f * uniform() - 8.0f, 16.0f * uniform() - 8.0f,
+                  16.0f * uniform() - 8.0f );
+        Real   r = 0.05f + 0.1f * uniform();
+        scene.addObject( new Sphere( c, r, materials[ gen() % 10 ] ) );
+      }
+  }
+
+  /// Fills \a scene with a stress case for refraction: ten nested
+  /// glass bubbles around a red ball, in front of a row of smaller
+  /// bubbles. The glass does not reflect, so that each camera ray is
+  /// refracted through up to a few tens of surfaces without branching
+  /// (render it with a large depth).
+  inline void makeRefractionScene( Scene& scene )
+  {
+    scene.addLight( new PointLight( GL_LIGHT0, Point4( 0,0,1,0 ),
+                                    Color( 1.0, 1.0, 1.0 ) ) );
+    scene.addLight( new PointLight( GL_LIGHT1, Point4( -10,-4,2,1 ),
+                                    Color( 1.0, 1.0, 1.0 ) ) );
+    Material glass = Material::glass();
+    glass.coef_reflexion = 0.0f;
+    for ( int i = 0; i < 10; ++i )
+      addBubble( scene, Point3( 0, 0, 0 ), 8.0f - 0.7f * i, glass );
+    for ( int i = 0; i < 8; ++i )
+      addBubble( scene, Point3( 4.0f + 2.0f * i, -4.0f - 2.0f * i, -2.0f + 0.5f * i ), 1.5f, glass );
+    scene.addObject( new Sphere( Point3( 0, 0, 0 ), 1.0f, Material::redPlastic() ) );
+  }
+
+  /// Fills \a scene with the scene called \a name.
+  /// @return 'true' if \a name is a known scene.
+  inline bool makeScene( Scene& scene, const std::string& name )
+  {
+    if      ( name == "bubbles" ) makeBubbleScene( scene );
+    else if ( name == "spheres" ) makeSpheresScene( scene, 100000 );
+    else if ( name == "refraction" ) makeRefractionScene( scene );
+    else return false;
+    return true;
+  }
+
+} // namespace rt
+
+#endif // #define _SCENES_H_
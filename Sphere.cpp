@@ -4,6 +4,11 @@
 #include <cmath>
 #include "Sphere.h"
 
+#ifdef RT_HEADLESS
+void
+rt::Sphere::draw( Viewer& /* viewer */ )
+{} // nothing to draw without OpenGL window.
+#else
 void
 rt::Sphere::draw( Viewer& /* viewer */ )
 {
@@ -60,6 +65,7 @@ rt::Sphere::draw( Viewer& /* viewer */ )
     }
   glEnd();
 }
+#endif
 
 rt::Point3
 rt::Sphere::localize( Real latitude, Real longitude ) const
@@ -88,6 +94,20 @@ rt::Sphere::getMaterial( Point3 /* p */ )
   return material; // the material is constant along the sphere.
 }
 
+void
+rt::Sphere::surface( Hit& hit )
+{
+  hit.normal = hit.geometric_normal = getNormal( hit.point );
+  hit.setMaterial( material );
+}
+
+rt::BoundingBox
+rt::Sphere::boundingBox() const
+{
+  Vector3 r( radius, radius, radius );
+  return BoundingBox( center - r, center + r );
+}
+
 rt::Real
 rt::Sphere::rayIntersection( const Ray& ray, Point3& p )
 {
@@ -100,29 +120,44 @@ rt::Sphere::rayIntersection( const Ray& ray, Point3& p )
     //                -   a
 
     Vector3 Pa = ray.origin - center;
+    Real    b  = ray.direction.dot(Pa);
 
-    Real delta = (ray.direction.dot(Pa) * ray.direction.dot(Pa)) - (Pa.dot(Pa) - (radius * radius));
+    Real delta = (b * b) - (Pa.dot(Pa) - (radius * radius));
 
     if(delta < 0){
       //pas de solution
       return 1.0f;
     }
-    else if (delta >= 0){
-      //x1 = (-b -racine(delta) )/2a) 
-      //x2 = (-b + racine (delta))/2a
-      //a = 1 car vecteur direction
-
-      Real x1 = - (ray.direction.dot(Pa) - sqrt(delta));
-      Real x2 = - (ray.direction.dot(Pa) + sqrt(delta));
+    //x1 = (-b -racine(delta) )/2a) 
+    //x2 = (-b + racine (delta))/2a
+    //a = 1 car vecteur direction
+    Real sq = sqrt(delta);
+    Real x1 = - b - sq;
+    Real x2 = - b + sq;
 
-      //L'intersection la plus proche de l'origine du rayon.
-      Real x_minimum = std::min(x1, x2);
-
-      //Si la sphere est devant l'origine du rayon
-      if(x_minimum >= 0){
-        p = ray.origin + ray.direction * x_minimum; //point d'intersection
-        //return -(p - ray.origin).norm(); //distance entre origine du rayon et le point d'intersection
-        return -x_minimum; //distance entre origine du rayon et le point d'intersection
-      }
+    //L'intersection la plus proche devant l'origine du rayon : x1 si la
+    //sphere est devant, x2 si l'origine est dans la sphere.
+    Real x = x1 > 0 ? x1 : x2;
+    if(x <= 0){
+      //la sphere est derriere l'origine du rayon
+      return 1.0f;
     }
+    p = ray.origin + ray.direction * x; //point d'intersection
+    return -x; //distance entre origine du rayon et le point d'intersection
+}
+
+bool
+rt::Sphere::nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t )
+{
+  // Same equation as in rayIntersection, but both roots are considered.
+  Vector3 Pa    = ray.origin - center;
+  Real    b     = ray.direction.dot( Pa );
+  Real    delta = ( b * b ) - ( Pa.dot( Pa ) - ( radius * radius ) );
+  if ( delta < 0.0f ) return false;
+  Real    sq    = sqrt( delta );
+  Real    x1    = - b - sq;
+  Real    x2    = - b + sq;
+  if ( x1 > tmin && x1 < tmax ) { t = x1; return true; }
+  if ( x2 > tmin && x2 < tmax ) { t = x2; return true; }
+  return false;
 }
@@ -57,6 +57,24 @@ namespace rt {
     /// kind of distance to the closest point of intersection.
     Real rayIntersection( const Ray& ray, Point3& p );
 
+    /// Looks for the first intersection of the ray with the sphere
+    /// strictly between distances \a tmin and \a tmax.
+    /// @return 'true' if there is one, at distance \a t.
+    bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t );
+
+    /// @return a box containing the sphere.
+    BoundingBox boundingBox() const;
+
+    /// Refers to the material of the sphere instead of copying it.
+    void surface( Hit& hit );
+
+    // A sphere has a single part: the variants with parts are the
+    // default ones of GraphicalObject.
+    using GraphicalObject::getNormal;
+    using GraphicalObject::getMaterial;
+    using GraphicalObject::rayIntersection;
+    using GraphicalObject::nextIntersection;
+
   public:
     /// The center of the sphere
     Point3 center;
@@ -0,0 +1,245 @@
+/**
+@file SphereCloud.h
+@author JOL
+*/
+#pragma once
+#ifndef _SPHERE_CLOUD_H_
+#define _SPHERE_CLOUD_H_
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <vector>
+#include "GraphicalObject.h"
+#include "BVH.h"
+#include "SphereSet.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  A single graphical object made of many spheres, whose arrays are not
+  owned by the object, e.g. because they are mapped from a binary scene
+  file (see SceneFile). Each sphere is a part of the object (see
+  GraphicalObject) and has a material given by an index in a table.
+
+  Spheres are stored as for SphereSet: a structure of arrays padded
+  with SphereSet::PADDING dummy spheres, in the order of the leaves of
+  their BVH, so that the SIMD kernels intersect the spheres of a leaf
+  at once.
+
+  Material indices and leaf ranges are checked when they are used, so
+  that arrays mapped from a corrupted file are never read out of
+  their bounds (see SceneFile): a wrong index gives the first
+  material, and a wrong leaf is ignored.
+  */
+  struct SphereCloud final : public GraphicalObject {
+
+    /// Constructor from \a nb spheres given by \a spheres, their
+    /// material indices \a material_index in the \a nb_materials
+    /// materials \a materials, and the \a nb_nodes nodes of their BVH. None of them is copied: \a storage
+    /// is kept alive as long as the object, and frees them at the end.
+    /// If \a nb_nodes is 0, the BVH is built, and the spheres copied in
+    /// its order, by the constructor.
+    SphereCloud( int nb, SphereArrays spheres, const uint32_t* material_index,
+                 const Material* materials, uint32_t nb_materials,
+                 const BVHNode* nodes, int nb_nodes, std::shared_ptr< void > storage )
+      : mySpheres( spheres ), ptrIndex( material_index ), ptrMaterials( materials ),
+        myNbMaterials( nb_materials ), myNb( nb ), myStorage( storage )
+    {
+      if ( nb_nodes > 0 ) myBVH.attach( nodes, nb_nodes );
+      else                buildBVH();
+    }
+
+    /// @return a cloud of the spheres of centers \a centers, radii \a
+    /// radii and materials \a materials, which it copies.
+    static SphereCloud* make( const std::vector< Point3 >& centers,
+                              const std::vector< Real >& radii,
+                              const std::vector< Material >& materials )
+    {
+      struct Spheres {
+        std::vector< Real >     cx, cy, cz, r2;
+        std::vector< uint32_t > index;
+        std::vector< Material > materials;
+      };
+      std::shared_ptr< Spheres > s = std::make_shared< Spheres >();
+      for ( size_t i = 0; i < centers.size(); ++i )
+        {
+          s->cx.push_back( centers[ i ][ 0 ] );
+          s->cy.push_back( centers[ i ][ 1 ] );
+          s->cz.push_back( centers[ i ][ 2 ] );
+          s->r2.push_back( radii[ i ] * radii[ i ] );
+          s->index.push_back( i );
+        }
+      s->materials = materials;
+      // Without nodes, the constructor builds the BVH and copies the
+      // spheres in its order.
+      return new SphereCloud( (int) centers.size(),
+                              SphereArrays{ s->cx.data(), s->cy.data(), s->cz.data(), s->r2.data() },
+                              s->index.data(), s->materials.data(),
+                              (uint32_t) s->materials.size(), 0, 0, s );
+    }
+
+    /// Nothing to precompute.
+    void init( Viewer& /* viewer */ ) {}
+
+    /// The cloud is not displayed: it has far too many spheres.
+    void draw( Viewer& /* viewer */ ) {}
+
+    /// @return the number of spheres.
+    int size() const { return myNb; }
+
+    /// The methods without part only make sense for simple objects:
+    /// the cloud answers them for its first sphere. Scene and Renderer
+    /// use the methods with parts.
+    Vector3 getNormal( Point3 p ) { return getNormal( p, 0 ); }
+    Material getMaterial( Point3 p ) { return getMaterial( p, 0 ); }
+    Real rayIntersection( const Ray& ray, Point3& p )
+    {
+      int part;
+      return rayIntersection( ray, p, part );
+    }
+    bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t )
+    {
+      int part;
+      return nextIntersection( ray, tmin, tmax, t, part );
+    }
+
+    /// @return the normal at point \a p of sphere \a part.
+    Vector3 getNormal( Point3 p, int part )
+    {
+      Vector3 u = p - Point3( mySpheres.cx[ part ], mySpheres.cy[ part ], mySpheres.cz[ part ] );
+      Real   l2 = u.dot( u );
+      if ( l2 != 0.0 ) u /= sqrt( l2 );
+      return u;
+    }
+
+    /// @return the material of sphere \a part.
+    Material getMaterial( Point3 /* p */, int part )
+    {
+      return material( part );
+    }
+
+    /// Refers to the material of the sphere that is hit.
+    void surface( Hit& hit )
+    {
+      hit.normal = hit.geometric_normal = getNormal( hit.point, hit.part );
+      hit.setMaterial( material( hit.part ) );
+    }
+
+    /// Closest hit among the spheres, found with their BVH.
+    /// @return -t if the sphere \a part is hit at distance t, 1 otherwise.
+    Real rayIntersection( const Ray& ray, Point3& p, int& part )
+    {
+      Real tmax   = std::numeric_limits<Real>::max();
+      int  sphere = -1;
+      SphereKernel kernel = sphereKernel();
+      auto leaf = [&] ( int first, int count, Real& t ) {
+        if ( ! validLeaf( first, count ) ) return;
+        int i = kernel( mySpheres, ray, first, first + count, t );
+        if ( i >= 0 ) sphere = i;
+      };
+      myBVH.traverseLeaves( ray, tmax, leaf );
+      if ( sphere < 0 ) return 1.0f;
+      p    = ray.origin + ray.direction * tmax;
+      part = sphere;
+      return -tmax;
+    }
+
+    /// First crossing of a sphere in ]tmin,tmax[.
+    bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t, int& part )
+    {
+      Real best   = tmax;
+      int  sphere = -1;
+      auto leaf = [&] ( int first, int count, Real& t_best ) {
+        if ( ! validLeaf( first, count ) ) return;
+        Real x[ 2 ];
+        for ( int i = first, iE = first + count; i < iE; ++i )
+          if ( sphereCrossings( mySpheres, ray, i, tmin, t_best, x ) > 0 )
+            { t_best = x[ 0 ]; sphere = i; }
+      };
+      myBVH.traverseLeaves( ray, best, leaf );
+      if ( sphere < 0 ) return false;
+      t    = best;
+      part = sphere;
+      return true;
+    }
+
+    /// @return the box of the root of the BVH.
+    BoundingBox boundingBox() const
+    {
+      return myBVH.empty() ? BoundingBox() : myBVH.data()[ 0 ].box;
+    }
+
+  private:
+    SphereArrays    mySpheres;
+    const uint32_t* ptrIndex;
+    const Material* ptrMaterials;
+    uint32_t        myNbMaterials;
+    int             myNb;
+    /// Keeps the arrays alive.
+    std::shared_ptr< void > myStorage;
+    BVH             myBVH;
+
+    /// @return the material of sphere \a part (the first one if its
+    /// index is invalid).
+    const Material& material( int part ) const
+    {
+      const uint32_t k = ptrIndex[ part ];
+      return ptrMaterials[ k < myNbMaterials ? k : 0 ];
+    }
+
+    /// @return 'true' if the leaf [first,first+count[ is within the spheres.
+    bool validLeaf( int first, int count ) const
+    {
+      return first >= 0 && first <= myNb && count <= myNb - first;
+    }
+
+    /// Spheres copied by buildBVH.
+    struct Copy {
+      std::vector< Real >     cx, cy, cz, r2;
+      std::vector< uint32_t > index;
+      /// The former storage, which still holds the materials.
+      std::shared_ptr< void > former;
+    };
+
+    /// Builds the BVH over the spheres and replaces the arrays by
+    /// copies in the order of its leaves.
+    void buildBVH()
+    {
+      std::vector< BoundingBox > boxes( myNb );
+      for ( int i = 0; i < myNb; ++i )
+        {
+          Real    r = sqrt( mySpheres.r2[ i ] ) * 1.00001f;
+          Vector3 v( r, r, r );
+          Point3  c( mySpheres.cx[ i ], mySpheres.cy[ i ], mySpheres.cz[ i ] );
+          boxes[ i ] = BoundingBox( c - v, c + v );
+        }
+      myBVH.build( boxes, 8 ); // one AVX2 register per leaf, as in Scene
+      std::shared_ptr< Copy > copy = std::make_shared< Copy >();
+      for ( int i : myBVH.indices() )
+        {
+          copy->cx.push_back( mySpheres.cx[ i ] );
+          copy->cy.push_back( mySpheres.cy[ i ] );
+          copy->cz.push_back( mySpheres.cz[ i ] );
+          copy->r2.push_back( mySpheres.r2[ i ] );
+          copy->index.push_back( ptrIndex[ i ] );
+        }
+      // Dummy spheres have a negative squared radius and are never hit.
+      for ( int k = 0; k < SphereSet::PADDING; ++k )
+        {
+          copy->cx.push_back( 0.0f ); copy->cy.push_back( 0.0f );
+          copy->cz.push_back( 0.0f ); copy->r2.push_back( -1e30f );
+        }
+      copy->former = myStorage;
+      mySpheres = SphereArrays{ copy->cx.data(), copy->cy.data(),
+                                copy->cz.data(), copy->r2.data() };
+      ptrIndex  = copy->index.data();
+      myStorage = copy;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _SPHERE_CLOUD_H_
@@ -0,0 +1,257 @@
+/**
+@file SphereSet.cpp
+*/
+#include <cmath>
+#include <limits>
+#include "SphereSet.h"
+#ifdef RT_SPHERE_SIMD
+#include <immintrin.h>
+#endif
+
+// All kernels compute exactly the same operations in the same order as
+// Sphere::rayIntersection (no fused multiply-add), so that they give
+// bit-identical distances.
+
+int
+rt::closestSphereScalar( const SphereArrays& s, const Ray& ray,
+                         int begin, int end, Real& tmax )
+{
+  int best = -1;
+  for ( int i = begin; i < end; ++i )
+    {
+      Real px    = ray.origin[ 0 ] - s.cx[ i ];
+      Real py    = ray.origin[ 1 ] - s.cy[ i ];
+      Real pz    = ray.origin[ 2 ] - s.cz[ i ];
+      Real b     = ray.direction[ 0 ] * px + ray.direction[ 1 ] * py + ray.direction[ 2 ] * pz;
+      Real delta = b * b - ( px * px + py * py + pz * pz - s.r2[ i ] );
+      if ( delta < 0.0f ) continue;
+      Real sq    = sqrt( delta );
+      Real x1    = - b - sq;
+      Real t     = x1 > 0.0f ? x1 : - b + sq;
+      if ( t > 0.0f && t < tmax ) { tmax = t; best = i; }
+    }
+  return best;
+}
+
+void
+rt::closestSpheresPacketScalar( const SphereArrays& s, RayPacket& packet,
+                                int begin, int end )
+{
+  for ( int k = 0; k < packet.size(); ++k )
+    {
+      int i = closestSphereScalar( s, packet.rays[ k ], begin, end, packet.tmax[ k ] );
+      if ( i >= 0 ) packet.sphere[ k ] = i;
+    }
+}
+
+#ifdef RT_SPHERE_SIMD
+
+int
+rt::closestSphereSSE( const SphereArrays& s, const Ray& ray,
+                      int begin, int end, Real& tmax )
+{
+  const __m128  ox   = _mm_set1_ps( ray.origin[ 0 ] );
+  const __m128  oy   = _mm_set1_ps( ray.origin[ 1 ] );
+  const __m128  oz   = _mm_set1_ps( ray.origin[ 2 ] );
+  const __m128  dx   = _mm_set1_ps( ray.direction[ 0 ] );
+  const __m128  dy   = _mm_set1_ps( ray.direction[ 1 ] );
+  const __m128  dz   = _mm_set1_ps( ray.direction[ 2 ] );
+  const __m128  zero = _mm_setzero_ps();
+  const __m128  sign = _mm_set1_ps( -0.0f );
+  const __m128  inf  = _mm_set1_ps( std::numeric_limits<Real>::infinity() );
+  const __m128i lane = _mm_setr_epi32( 0, 1, 2, 3 );
+  const __m128i last = _mm_set1_epi32( end );
+  int best = -1;
+  for ( int i = begin; i < end; i += 4 )
+    {
+      __m128 px    = _mm_sub_ps( ox, _mm_loadu_ps( s.cx + i ) );
+      __m128 py    = _mm_sub_ps( oy, _mm_loadu_ps( s.cy + i ) );
+      __m128 pz    = _mm_sub_ps( oz, _mm_loadu_ps( s.cz + i ) );
+      __m128 b     = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, px ), _mm_mul_ps( dy, py ) ),
+                                 _mm_mul_ps( dz, pz ) );
+      __m128 c     = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, px ), _mm_mul_ps( py, py ) ),
+                                             _mm_mul_ps( pz, pz ) ),
+                                 _mm_loadu_ps( s.r2 + i ) );
+      __m128 delta = _mm_sub_ps( _mm_mul_ps( b, b ), c );
+      __m128 sq    = _mm_sqrt_ps( _mm_max_ps( delta, zero ) );
+      __m128 nb    = _mm_xor_ps( b, sign );
+      __m128 x1    = _mm_sub_ps( nb, sq );
+      __m128 x2    = _mm_add_ps( nb, sq );
+      __m128 m1    = _mm_cmpgt_ps( x1, zero );
+      __m128 t     = _mm_or_ps( _mm_and_ps( m1, x1 ), _mm_andnot_ps( m1, x2 ) );
+      __m128 valid = _mm_castsi128_ps( _mm_cmplt_epi32( _mm_add_epi32( lane, _mm_set1_epi32( i ) ), last ) );
+      __m128 hit   = _mm_and_ps( _mm_and_ps( _mm_cmpge_ps( delta, zero ), _mm_cmpgt_ps( t, zero ) ), valid );
+      t            = _mm_or_ps( _mm_and_ps( hit, t ), _mm_andnot_ps( hit, inf ) );
+      // horizontal minimum
+      __m128 m     = _mm_min_ps( t, _mm_shuffle_ps( t, t, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+      m            = _mm_min_ps( m, _mm_shuffle_ps( m, m, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+      Real   tmin  = _mm_cvtss_f32( m );
+      if ( tmin < tmax )
+        {
+          tmax = tmin;
+          best = i + __builtin_ctz( _mm_movemask_ps( _mm_cmpeq_ps( t, m ) ) );
+        }
+    }
+  return best;
+}
+
+__attribute__((target("avx2")))
+int
+rt::closestSphereAVX2( const SphereArrays& s, const Ray& ray,
+                       int begin, int end, Real& tmax )
+{
+  const __m256  ox   = _mm256_set1_ps( ray.origin[ 0 ] );
+  const __m256  oy   = _mm256_set1_ps( ray.origin[ 1 ] );
+  const __m256  oz   = _mm256_set1_ps( ray.origin[ 2 ] );
+  const __m256  dx   = _mm256_set1_ps( ray.direction[ 0 ] );
+  const __m256  dy   = _mm256_set1_ps( ray.direction[ 1 ] );
+  const __m256  dz   = _mm256_set1_ps( ray.direction[ 2 ] );
+  const __m256  zero = _mm256_setzero_ps();
+  const __m256  sign = _mm256_set1_ps( -0.0f );
+  const __m256  inf  = _mm256_set1_ps( std::numeric_limits<Real>::infinity() );
+  const __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+  const __m256i last = _mm256_set1_epi32( end );
+  int best = -1;
+  for ( int i = begin; i < end; i += 8 )
+    {
+      __m256 px    = _mm256_sub_ps( ox, _mm256_loadu_ps( s.cx + i ) );
+      __m256 py    = _mm256_sub_ps( oy, _mm256_loadu_ps( s.cy + i ) );
+      __m256 pz    = _mm256_sub_ps( oz, _mm256_loadu_ps( s.cz + i ) );
+      __m256 b     = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( dx, px ), _mm256_mul_ps( dy, py ) ),
+                                    _mm256_mul_ps( dz, pz ) );
+      __m256 c     = _mm256_sub_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( px, px ),
+                                                                  _mm256_mul_ps( py, py ) ),
+                                                   _mm256_mul_ps( pz, pz ) ),
+                                    _mm256_loadu_ps( s.r2 + i ) );
+      __m256 delta = _mm256_sub_ps( _mm256_mul_ps( b, b ), c );
+      __m256 sq    = _mm256_sqrt_ps( _mm256_max_ps( delta, zero ) );
+      __m256 nb    = _mm256_xor_ps( b, sign );
+      __m256 x1    = _mm256_sub_ps( nb, sq );
+      __m256 x2    = _mm256_add_ps( nb, sq );
+      __m256 t     = _mm256_blendv_ps( x2, x1, _mm256_cmp_ps( x1, zero, _CMP_GT_OQ ) );
+      __m256 valid = _mm256_castsi256_ps( _mm256_cmpgt_epi32( last, _mm256_add_epi32( lane, _mm256_set1_epi32( i ) ) ) );
+      __m256 hit   = _mm256_and_ps( _mm256_and_ps( _mm256_cmp_ps( delta, zero, _CMP_GE_OQ ),
+                                                   _mm256_cmp_ps( t, zero, _CMP_GT_OQ ) ), valid );
+      t            = _mm256_blendv_ps( inf, t, hit );
+      // horizontal minimum
+      __m256 m     = _mm256_min_ps( t, _mm256_permute2f128_ps( t, t, 1 ) );
+      m            = _mm256_min_ps( m, _mm256_shuffle_ps( m, m, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+      m            = _mm256_min_ps( m, _mm256_shuffle_ps( m, m, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+      Real   tmin  = _mm256_cvtss_f32( m );
+      if ( tmin < tmax )
+        {
+          tmax = tmin;
+          best = i + __builtin_ctz( _mm256_movemask_ps( _mm256_cmp_ps( t, m, _CMP_EQ_OQ ) ) );
+        }
+    }
+  return best;
+}
+
+__attribute__((target("avx2")))
+void
+rt::closestSpheresPacketAVX2( const SphereArrays& s, RayPacket& packet,
+                              int begin, int end )
+{
+  packet.pad();
+  const __m256  ox   = _mm256_loadu_ps( packet.ox );
+  const __m256  oy   = _mm256_loadu_ps( packet.oy );
+  const __m256  oz   = _mm256_loadu_ps( packet.oz );
+  const __m256  dx   = _mm256_loadu_ps( packet.dx );
+  const __m256  dy   = _mm256_loadu_ps( packet.dy );
+  const __m256  dz   = _mm256_loadu_ps( packet.dz );
+  const __m256  zero = _mm256_setzero_ps();
+  const __m256  sign = _mm256_set1_ps( -0.0f );
+  __m256  tmax   = _mm256_loadu_ps( packet.tmax );
+  __m256i sphere = _mm256_loadu_si256( (const __m256i*) packet.sphere );
+  for ( int i = begin; i < end; ++i )
+    {
+      __m256 px    = _mm256_sub_ps( ox, _mm256_set1_ps( s.cx[ i ] ) );
+      __m256 py    = _mm256_sub_ps( oy, _mm256_set1_ps( s.cy[ i ] ) );
+      __m256 pz    = _mm256_sub_ps( oz, _mm256_set1_ps( s.cz[ i ] ) );
+      __m256 b     = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( dx, px ), _mm256_mul_ps( dy, py ) ),
+                                    _mm256_mul_ps( dz, pz ) );
+      __m256 c     = _mm256_sub_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( px, px ),
+                                                                  _mm256_mul_ps( py, py ) ),
+                                                   _mm256_mul_ps( pz, pz ) ),
+                                    _mm256_set1_ps( s.r2[ i ] ) );
+      __m256 delta = _mm256_sub_ps( _mm256_mul_ps( b, b ), c );
+      __m256 valid = _mm256_cmp_ps( delta, zero, _CMP_GE_OQ );
+      if ( _mm256_testz_ps( valid, valid ) ) continue; // missed by all rays
+      __m256 sq    = _mm256_sqrt_ps( _mm256_max_ps( delta, zero ) );
+      __m256 nb    = _mm256_xor_ps( b, sign );
+      __m256 x1    = _mm256_sub_ps( nb, sq );
+      __m256 x2    = _mm256_add_ps( nb, sq );
+      __m256 t     = _mm256_blendv_ps( x2, x1, _mm256_cmp_ps( x1, zero, _CMP_GT_OQ ) );
+      __m256 hit   = _mm256_and_ps( valid, _mm256_and_ps( _mm256_cmp_ps( t, zero, _CMP_GT_OQ ),
+                                                          _mm256_cmp_ps( t, tmax, _CMP_LT_OQ ) ) );
+      tmax         = _mm256_blendv_ps( tmax, t, hit );
+      sphere       = _mm256_castps_si256( _mm256_blendv_ps( _mm256_castsi256_ps( sphere ),
+                                                            _mm256_castsi256_ps( _mm256_set1_epi32( i ) ),
+                                                            hit ) );
+    }
+  _mm256_storeu_ps( packet.tmax, tmax );
+  _mm256_storeu_si256( (__m256i*) packet.sphere, sphere );
+}
+
+#endif // RT_SPHERE_SIMD
+
+namespace {
+  /// @return the widest kernel supported by the processor.
+  rt::SphereKernel bestKernel()
+  {
+#ifdef RT_SPHERE_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) ) return rt::closestSphereAVX2;
+    return rt::closestSphereSSE;
+#else
+    return rt::closestSphereScalar;
+#endif
+  }
+
+  /// The kernel currently used by rt::SphereSet.
+  rt::SphereKernel& currentKernel()
+  {
+    static rt::SphereKernel kernel = bestKernel();
+    return kernel;
+  }
+}
+
+rt::SphereKernel
+rt::sphereKernel()
+{
+  return currentKernel();
+}
+
+rt::SpherePacketKernel
+rt::spherePacketKernel()
+{
+#ifdef RT_SPHERE_SIMD
+  if ( sphereKernel() == closestSphereAVX2 ) return closestSpheresPacketAVX2;
+#endif
+  return closestSpheresPacketScalar;
+}
+
+std::string
+rt::sphereKernelName()
+{
+  SphereKernel kernel = sphereKernel();
+#ifdef RT_SPHERE_SIMD
+  if ( kernel == closestSphereAVX2 ) return "avx2";
+  if ( kernel == closestSphereSSE )  return "sse";
+#endif
+  return "scalar";
+}
+
+bool
+rt::selectSphereKernel( const std::string& name )
+{
+  SphereKernel& kernel = currentKernel();
+  if ( name == "auto" )   { kernel = bestKernel(); return true; }
+  if ( name == "scalar" ) { kernel = closestSphereScalar; return true; }
+#ifdef RT_SPHERE_SIMD
+  if ( name == "sse" )    { kernel = closestSphereSSE; return true; }
+  if ( name == "avx2" && __builtin_cpu_supports( "avx2" ) )
+    { kernel = closestSphereAVX2; return true; }
+#endif
+  return false;
+}
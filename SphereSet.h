@@ -0,0 +1,203 @@
+/**
+@file SphereSet.h
+@author JOL
+*/
+#pragma once
+#ifndef _SPHERE_SET_H_
+#define _SPHERE_SET_H_
+
+#include <string>
+#include <vector>
+#include "GraphicalObject.h"
+#include "RayPacket.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// Read-only view on spheres stored as a structure of arrays: the
+  /// coordinates of the centers and the squared radii are contiguous,
+  /// so that they can be loaded 4 or 8 at a time in SIMD registers.
+  struct SphereArrays {
+    const Real* cx;
+    const Real* cy;
+    const Real* cz;
+    const Real* r2;
+  };
+
+  /// Signature of the closest-hit kernels. Looks for the closest
+  /// intersection of \a ray with the spheres of indices [begin,end[, at
+  /// a distance in ]0,tmax[. As Sphere::rayIntersection, the first
+  /// root is taken if it is in front of the origin, otherwise the second one.
+  /// @param[in,out] tmax the distance of the closest hit so far.
+  /// @return the index of the closest sphere, or -1 if none is closer than \a tmax.
+  typedef int (*SphereKernel)( const SphereArrays& spheres, const Ray& ray,
+                               int begin, int end, Real& tmax );
+
+  /// Portable kernel, one sphere at a time.
+  int closestSphereScalar( const SphereArrays& spheres, const Ray& ray,
+                           int begin, int end, Real& tmax );
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define RT_SPHERE_SIMD 1
+  /// SSE2 kernel, 4 spheres at a time.
+  int closestSphereSSE( const SphereArrays& spheres, const Ray& ray,
+                        int begin, int end, Real& tmax );
+  /// AVX2 kernel, 8 spheres at a time.
+  int closestSphereAVX2( const SphereArrays& spheres, const Ray& ray,
+                         int begin, int end, Real& tmax );
+#endif
+
+  /// Signature of the packet kernels. Same as SphereKernel, for the
+  /// active rays of \a packet: packet.tmax and packet.sphere are
+  /// lowered and updated for the rays that hit one of the spheres.
+  typedef void (*SpherePacketKernel)( const SphereArrays& spheres, RayPacket& packet,
+                                      int begin, int end );
+
+  /// Portable packet kernel, one ray and one sphere at a time.
+  void closestSpheresPacketScalar( const SphereArrays& spheres, RayPacket& packet,
+                                   int begin, int end );
+#ifdef RT_SPHERE_SIMD
+  /// AVX2 packet kernel, one sphere against the 8 rays at a time.
+  void closestSpheresPacketAVX2( const SphereArrays& spheres, RayPacket& packet,
+                                 int begin, int end );
+#endif
+
+  /// Computes the distances where \a ray crosses the \a i-th sphere of
+  /// \a spheres, strictly between \a tmin and \a tmax.
+  /// @return the number of such crossings (0, 1 or 2), stored in \a t.
+  inline int sphereCrossings( const SphereArrays& spheres, const Ray& ray, int i,
+                              Real tmin, Real tmax, Real t[ 2 ] )
+  {
+    Real px    = ray.origin[ 0 ] - spheres.cx[ i ];
+    Real py    = ray.origin[ 1 ] - spheres.cy[ i ];
+    Real pz    = ray.origin[ 2 ] - spheres.cz[ i ];
+    Real b     = ray.direction[ 0 ] * px + ray.direction[ 1 ] * py + ray.direction[ 2 ] * pz;
+    Real delta = b * b - ( px * px + py * py + pz * pz - spheres.r2[ i ] );
+    if ( delta < 0.0f ) return 0;
+    Real sq    = sqrt( delta );
+    int  n     = 0;
+    Real x1    = - b - sq;
+    Real x2    = - b + sq;
+    if ( x1 > tmin && x1 < tmax ) t[ n++ ] = x1;
+    if ( x2 > tmin && x2 < tmax ) t[ n++ ] = x2;
+    return n;
+  }
+
+  /// @return the kernel used by SphereSet. By default, the widest one
+  /// supported by the processor.
+  SphereKernel sphereKernel();
+  /// @return the packet kernel used by SphereSet (the AVX2 one when
+  /// the AVX2 kernel is selected, the scalar one otherwise).
+  SpherePacketKernel spherePacketKernel();
+  /// @return the name of the kernel used by SphereSet.
+  std::string sphereKernelName();
+  /// Chooses the kernel used by SphereSet among "scalar", "sse",
+  /// "avx2" or "auto". Must not be called while rendering.
+  /// @return 'false' if this kernel is unknown or not supported.
+  bool selectSphereKernel( const std::string& name );
+
+  /// Stores many spheres as a structure of arrays for the SIMD kernels.
+  /// Each sphere remembers the graphical object it comes from, which
+  /// gives its material and normal. Arrays are padded so that kernels
+  /// may always load 8 consecutive spheres.
+  class SphereSet {
+  public:
+    /// Number of dummy spheres at the end of the arrays.
+    static const int PADDING = 8;
+
+    /// Default constructor. The set is empty.
+    SphereSet() {}
+
+    /// Removes all spheres.
+    void clear()
+    {
+      myCx.clear(); myCy.clear(); myCz.clear(); myR2.clear();
+      myObjects.clear();
+    }
+
+    /// Adds the sphere of center \a c and radius \a r, which belongs to \a obj.
+    void add( const Point3& c, Real r, GraphicalObject* obj )
+    {
+      myCx.push_back( c[ 0 ] );
+      myCy.push_back( c[ 1 ] );
+      myCz.push_back( c[ 2 ] );
+      myR2.push_back( r * r );
+      myObjects.push_back( obj );
+    }
+
+    /// Reorders the spheres so that the i-th one is the former \a order[ i ],
+    /// and pads the arrays. Must be called once all spheres are added.
+    void finalize( const std::vector< int >& order )
+    {
+      std::vector< Real > cx, cy, cz, r2;
+      std::vector< GraphicalObject* > objs;
+      for ( int i : order )
+        {
+          cx.push_back( myCx[ i ] ); cy.push_back( myCy[ i ] );
+          cz.push_back( myCz[ i ] ); r2.push_back( myR2[ i ] );
+          objs.push_back( myObjects[ i ] );
+        }
+      // Dummy spheres have a negative squared radius and are never hit.
+      for ( int k = 0; k < PADDING; ++k )
+        {
+          cx.push_back( 0.0f ); cy.push_back( 0.0f ); cz.push_back( 0.0f );
+          r2.push_back( -1e30f );
+        }
+      myCx.swap( cx ); myCy.swap( cy ); myCz.swap( cz ); myR2.swap( r2 );
+      myObjects.swap( objs );
+    }
+
+    /// @return the number of spheres.
+    int size() const { return (int) myObjects.size(); }
+
+    /// @return the graphical object of the \a i-th sphere.
+    GraphicalObject* object( int i ) const { return myObjects[ i ]; }
+
+    /// @return the center of the \a i-th sphere.
+    Point3 center( int i ) const { return Point3( myCx[ i ], myCy[ i ], myCz[ i ] ); }
+
+    /// @return a bounding box of the \a i-th sphere (slightly enlarged
+    /// since the radius is recomputed from its square).
+    BoundingBox boundingBox( int i ) const
+    {
+      Real    r = sqrt( myR2[ i ] ) * 1.00001f;
+      Vector3 v( r, r, r );
+      return BoundingBox( center( i ) - v, center( i ) + v );
+    }
+
+    /// @return the arrays, for kernels.
+    SphereArrays arrays() const
+    {
+      return SphereArrays{ myCx.data(), myCy.data(), myCz.data(), myR2.data() };
+    }
+
+    /// Closest hit among spheres [begin,end[ (see SphereKernel).
+    int closestHit( const Ray& ray, int begin, int end, Real& tmax ) const
+    {
+      return sphereKernel()( arrays(), ray, begin, end, tmax );
+    }
+
+    /// Closest hits of the rays of \a packet among spheres [begin,end[
+    /// (see SpherePacketKernel).
+    void closestHits( RayPacket& packet, int begin, int end ) const
+    {
+      spherePacketKernel()( arrays(), packet, begin, end );
+    }
+
+    /// Computes the distances where \a ray crosses the \a i-th sphere
+    /// (see sphereCrossings).
+    int crossings( const Ray& ray, int i, Real tmin, Real tmax, Real t[ 2 ] ) const
+    {
+      return sphereCrossings( arrays(), ray, i, tmin, tmax, t );
+    }
+
+  private:
+    std::vector< Real > myCx;
+    std::vector< Real > myCy;
+    std::vector< Real > myCz;
+    std::vector< Real > myR2;
+    std::vector< GraphicalObject* > myObjects;
+  };
+
+} // namespace rt
+
+#endif // #define _SPHERE_SET_H_
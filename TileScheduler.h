@@ -0,0 +1,83 @@
+/**
+@file TileScheduler.h
+@author JOL
+*/
+#pragma once
+#ifndef _TILE_SCHEDULER_H_
+#define _TILE_SCHEDULER_H_
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// A tile is the rectangle [x0,x1[ x [y0,y1[ of pixels of an image.
+  struct Tile {
+    int x0, y0, x1, y1;
+  };
+
+  /// Hands out the tiles of an image to a pool of worker threads with
+  /// work stealing. Each worker owns a queue of neighbouring tiles. It
+  /// takes tiles from the front of its own queue and, once it is empty,
+  /// steals tiles from the back of the queues of the other workers. An
+  /// expensive region of the image (e.g. full of glass bubbles) is thus
+  /// shared by all threads.
+  class TileScheduler {
+  public:
+    /// Cuts a \a width x \a height image into tiles of size \a
+    /// tile_size and distributes them among \a nb_workers queues.
+    TileScheduler( int width, int height, int tile_size, int nb_workers )
+    {
+      nb_workers = std::max( 1, nb_workers );
+      tile_size  = std::max( 1, tile_size );
+      std::vector< Tile > tiles;
+      for ( int y = 0; y < height; y += tile_size )
+        for ( int x = 0; x < width; x += tile_size )
+          tiles.push_back( Tile{ x, y, std::min( x + tile_size, width ),
+                                       std::min( y + tile_size, height ) } );
+      for ( int i = 0; i < nb_workers; ++i )
+        myQueues.emplace_back( new Queue );
+      // Contiguous chunks of tiles, so that each worker starts with a
+      // compact region of the image.
+      std::size_t n = tiles.size();
+      for ( std::size_t i = 0; i < n; ++i )
+        myQueues[ i * nb_workers / n ]->tiles.push_back( tiles[ i ] );
+    }
+
+    /// @return the number of worker queues.
+    int size() const { return (int) myQueues.size(); }
+
+    /// Gets the next tile to be rendered by worker \a worker.
+    /// @return 'false' when there is no tile left anywhere.
+    bool next( int worker, Tile& tile )
+    {
+      int n = size();
+      for ( int k = 0; k < n; ++k )
+        {
+          Queue& q = *myQueues[ ( worker + k ) % n ];
+          std::lock_guard< std::mutex > lock( q.mutex );
+          if ( q.tiles.empty() ) continue;
+          if ( k == 0 ) { tile = q.tiles.front(); q.tiles.pop_front(); }
+          else          { tile = q.tiles.back();  q.tiles.pop_back();  }
+          return true;
+        }
+      return false;
+    }
+
+  private:
+    /// The tiles owned by one worker.
+    struct Queue {
+      std::mutex mutex;
+      std::deque< Tile > tiles;
+    };
+    /// One queue per worker.
+    std::vector< std::unique_ptr< Queue > > myQueues;
+  };
+
+} // namespace rt
+
+#endif // #define _TILE_SCHEDULER_H_
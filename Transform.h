@@ -0,0 +1,139 @@
+/**
+@file Transform.h
+@author JOL
+*/
+#pragma once
+#ifndef _TRANSFORM_H_
+#define _TRANSFORM_H_
+
+#include <cmath>
+#include "PointVector.h"
+#include "BoundingBox.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// An affine transformation of space, stored as a 3x4 matrix: the
+  /// linear part m[i][0..2] and the translation m[i][3].
+  struct Transform {
+    Real m[ 3 ][ 4 ];
+
+    /// Default constructor. The identity.
+    Transform()
+    {
+      for ( int i = 0; i < 3; ++i )
+        for ( int j = 0; j < 4; ++j )
+          m[ i ][ j ] = i == j ? 1.0f : 0.0f;
+    }
+
+    /// @return the translation by \a v.
+    static Transform translation( const Vector3& v )
+    {
+      Transform t;
+      for ( int i = 0; i < 3; ++i ) t.m[ i ][ 3 ] = v[ i ];
+      return t;
+    }
+
+    /// @return the scaling by \a s[ i ] along axis i.
+    static Transform scaling( const Vector3& s )
+    {
+      Transform t;
+      for ( int i = 0; i < 3; ++i ) t.m[ i ][ i ] = s[ i ];
+      return t;
+    }
+
+    /// @return the rotation of \a angle radians around \a axis.
+    static Transform rotation( Vector3 axis, Real angle )
+    {
+      axis /= axis.norm();
+      const Real c = std::cos( angle ), s = std::sin( angle ), k = 1.0f - c;
+      const Real x = axis[ 0 ], y = axis[ 1 ], z = axis[ 2 ];
+      Transform t;
+      t.m[ 0 ][ 0 ] = c + x * x * k;     t.m[ 0 ][ 1 ] = x * y * k - z * s; t.m[ 0 ][ 2 ] = x * z * k + y * s;
+      t.m[ 1 ][ 0 ] = y * x * k + z * s; t.m[ 1 ][ 1 ] = c + y * y * k;     t.m[ 1 ][ 2 ] = y * z * k - x * s;
+      t.m[ 2 ][ 0 ] = z * x * k - y * s; t.m[ 2 ][ 1 ] = z * y * k + x * s; t.m[ 2 ][ 2 ] = c + z * z * k;
+      return t;
+    }
+
+    /// @return the composition of this and \a other, \a other being applied first.
+    Transform operator*( const Transform& other ) const
+    {
+      Transform t;
+      for ( int i = 0; i < 3; ++i )
+        for ( int j = 0; j < 4; ++j )
+          {
+            Real x = j == 3 ? m[ i ][ 3 ] : 0.0f;
+            for ( int k = 0; k < 3; ++k ) x += m[ i ][ k ] * other.m[ k ][ j ];
+            t.m[ i ][ j ] = x;
+          }
+      return t;
+    }
+
+    /// @return the image of point \a p.
+    Point3 point( const Point3& p ) const
+    {
+      return Point3( m[ 0 ][ 0 ] * p[ 0 ] + m[ 0 ][ 1 ] * p[ 1 ] + m[ 0 ][ 2 ] * p[ 2 ] + m[ 0 ][ 3 ],
+                     m[ 1 ][ 0 ] * p[ 0 ] + m[ 1 ][ 1 ] * p[ 1 ] + m[ 1 ][ 2 ] * p[ 2 ] + m[ 1 ][ 3 ],
+                     m[ 2 ][ 0 ] * p[ 0 ] + m[ 2 ][ 1 ] * p[ 1 ] + m[ 2 ][ 2 ] * p[ 2 ] + m[ 2 ][ 3 ] );
+    }
+
+    /// @return the image of vector \a v (the translation does not apply).
+    Vector3 vector( const Vector3& v ) const
+    {
+      return Vector3( m[ 0 ][ 0 ] * v[ 0 ] + m[ 0 ][ 1 ] * v[ 1 ] + m[ 0 ][ 2 ] * v[ 2 ],
+                      m[ 1 ][ 0 ] * v[ 0 ] + m[ 1 ][ 1 ] * v[ 1 ] + m[ 1 ][ 2 ] * v[ 2 ],
+                      m[ 2 ][ 0 ] * v[ 0 ] + m[ 2 ][ 1 ] * v[ 1 ] + m[ 2 ][ 2 ] * v[ 2 ] );
+    }
+
+    /// @return the image of vector \a v by the transposed linear part.
+    /// Called on the inverse transformation, it maps normals.
+    Vector3 transposedVector( const Vector3& v ) const
+    {
+      return Vector3( m[ 0 ][ 0 ] * v[ 0 ] + m[ 1 ][ 0 ] * v[ 1 ] + m[ 2 ][ 0 ] * v[ 2 ],
+                      m[ 0 ][ 1 ] * v[ 0 ] + m[ 1 ][ 1 ] * v[ 1 ] + m[ 2 ][ 1 ] * v[ 2 ],
+                      m[ 0 ][ 2 ] * v[ 0 ] + m[ 1 ][ 2 ] * v[ 1 ] + m[ 2 ][ 2 ] * v[ 2 ] );
+    }
+
+    /// @return the determinant of the linear part.
+    Real determinant() const
+    {
+      return m[ 0 ][ 0 ] * ( m[ 1 ][ 1 ] * m[ 2 ][ 2 ] - m[ 1 ][ 2 ] * m[ 2 ][ 1 ] )
+        -    m[ 0 ][ 1 ] * ( m[ 1 ][ 0 ] * m[ 2 ][ 2 ] - m[ 1 ][ 2 ] * m[ 2 ][ 0 ] )
+        +    m[ 0 ][ 2 ] * ( m[ 1 ][ 0 ] * m[ 2 ][ 1 ] - m[ 1 ][ 1 ] * m[ 2 ][ 0 ] );
+    }
+
+    /// @return the inverse transformation (the linear part must be invertible).
+    Transform inverse() const
+    {
+      Transform t;
+      const Real inv_det = 1.0f / determinant();
+      // Cofactors, transposed.
+      for ( int i = 0; i < 3; ++i )
+        for ( int j = 0; j < 3; ++j )
+          {
+            int i1 = ( j + 1 ) % 3, i2 = ( j + 2 ) % 3;
+            int j1 = ( i + 1 ) % 3, j2 = ( i + 2 ) % 3;
+            t.m[ i ][ j ] = ( m[ i1 ][ j1 ] * m[ i2 ][ j2 ] - m[ i1 ][ j2 ] * m[ i2 ][ j1 ] ) * inv_det;
+          }
+      for ( int i = 0; i < 3; ++i )
+        t.m[ i ][ 3 ] = - ( t.m[ i ][ 0 ] * m[ 0 ][ 3 ] + t.m[ i ][ 1 ] * m[ 1 ][ 3 ]
+                            + t.m[ i ][ 2 ] * m[ 2 ][ 3 ] );
+      return t;
+    }
+
+    /// @return a box containing the image of box \a box.
+    BoundingBox box( const BoundingBox& box ) const
+    {
+      BoundingBox result;
+      if ( box.empty() ) return result;
+      for ( int c = 0; c < 8; ++c )
+        result.extend( point( Point3( c & 1 ? box.hi[ 0 ] : box.lo[ 0 ],
+                                      c & 2 ? box.hi[ 1 ] : box.lo[ 1 ],
+                                      c & 4 ? box.hi[ 2 ] : box.lo[ 2 ] ) ) );
+      return result;
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _TRANSFORM_H_
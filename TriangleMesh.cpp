@@ -0,0 +1,319 @@
+/**
+@file TriangleMesh.cpp
+*/
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include "ParseReal.h"
+#include "TriangleMesh.h"
+
+void
+rt::MeshData::finalize()
+{
+  const int n = size();
+  // Smooth normals: each vertex gets the average of the normals of its
+  // triangles, weighted by their areas.
+  if ( normals.empty() && n > 0 )
+    {
+      normals.assign( vertices.size(), Vector3( 0.0f, 0.0f, 0.0f ) );
+      for ( int i = 0; i < n; ++i )
+        {
+          const int* v  = &triangles[ 3 * i ];
+          Vector3    fn = ( vertices[ v[ 1 ] ] - vertices[ v[ 0 ] ] )
+            .cross( vertices[ v[ 2 ] ] - vertices[ v[ 0 ] ] );
+          for ( int k = 0; k < 3; ++k ) normals[ v[ k ] ] += fn;
+        }
+      for ( Vector3& u : normals )
+        {
+          Real l2 = u.dot( u );
+          if ( l2 != 0.0f ) u /= std::sqrt( l2 );
+        }
+      corner_normals = triangles;
+    }
+  std::vector< BoundingBox > boxes( n );
+  for ( int i = 0; i < n; ++i ) boxes[ i ] = boundingBox( i );
+  bvh.build( boxes );
+  std::vector< int > sorted( 3 * n ), sorted_normals( 3 * n );
+  for ( int k = 0; k < n; ++k )
+    for ( int j = 0; j < 3; ++j )
+      {
+        sorted[ 3 * k + j ]         = triangles[ 3 * bvh.indices()[ k ] + j ];
+        sorted_normals[ 3 * k + j ] = corner_normals[ 3 * bvh.indices()[ k ] + j ];
+      }
+  triangles.swap( sorted );
+  corner_normals.swap( sorted_normals );
+}
+
+rt::BoundingBox
+rt::MeshData::boundingBox( int i ) const
+{
+  BoundingBox box;
+  for ( int k = 0; k < 3; ++k ) box.extend( vertices[ triangles[ 3 * i + k ] ] );
+  // Slightly enlarged, so that the slab test of the BVH, which rounds,
+  // does not miss rays through edges and vertices that the watertight
+  // test would hit.
+  Vector3 d    = box.hi - box.lo;
+  Real    size = std::max( std::max( d[ 0 ], d[ 1 ] ), d[ 2 ] );
+  for ( int k = 0; k < 3; ++k )
+    {
+      Real margin = 1e-5f * ( std::fabs( box.lo[ k ] ) + std::fabs( box.hi[ k ] ) + size );
+      box.lo[ k ] -= margin;
+      box.hi[ k ] += margin;
+    }
+  return box;
+}
+
+namespace {
+  bool isBlank( char c ) { return c == ' ' || c == '\t' || c == '\r'; }
+
+  /// Reads an index of an OBJ face at \a s, 1-based or negative
+  /// (relative to the \a nb elements read so far).
+  /// @return 'false' if there is none or it is out of range.
+  bool objIndex( const char*& s, int nb, int& index )
+  {
+    char* next;
+    long  i = strtol( s, &next, 10 );
+    if ( next == s ) return false;
+    s     = next;
+    index = i < 0 ? nb + (int) i : (int) i - 1;
+    return index >= 0 && index < nb;
+  }
+}
+
+bool
+rt::MeshData::readOBJ( const std::string& filename, std::string& error )
+{
+  std::ifstream input( filename.c_str() );
+  int           line_nb = 0;
+  auto fail = [&] ( const std::string& msg ) {
+    std::ostringstream s;
+    s << filename << ":" << line_nb << ": " << msg;
+    error = s.str();
+    return false;
+  };
+  if ( ! input.good() ) return fail( "unable to open " + filename );
+  *this = MeshData();
+  std::string        line;
+  std::vector< int > face_v, face_n;
+  while ( std::getline( input, line ) )
+    {
+      ++line_nb;
+      const char* s = line.c_str();
+      while ( isBlank( *s ) ) ++s;
+      if ( s[ 0 ] == 'v' && ( isBlank( s[ 1 ] ) || ( s[ 1 ] == 'n' && isBlank( s[ 2 ] ) ) ) )
+        {
+          bool normal = s[ 1 ] == 'n';
+          s += normal ? 2 : 1;
+          Point3 p;
+          for ( int k = 0; k < 3; ++k )
+            {
+              char* next;
+              p[ k ] = parseReal( s, &next );
+              if ( next == s ) return fail( "expected a number" );
+              s = next;
+            }
+          if ( ! normal ) vertices.push_back( p );
+          else
+            {
+              Real l2 = p.dot( p );
+              normals.push_back( l2 != 0.0f ? p / std::sqrt( l2 ) : p );
+            }
+        }
+      else if ( s[ 0 ] == 'f' && isBlank( s[ 1 ] ) )
+        {
+          // Corners are v, v/vt, v/vt/vn or v//vn.
+          face_v.clear();
+          face_n.clear();
+          ++s;
+          for ( ;; )
+            {
+              while ( isBlank( *s ) ) ++s;
+              if ( *s == '\0' || *s == '#' ) break;
+              int v, vn = -1;
+              if ( ! objIndex( s, (int) vertices.size(), v ) )
+                return fail( "invalid vertex index" );
+              if ( *s == '/' )
+                {
+                  ++s;
+                  if ( *s != '/' && ! isBlank( *s ) && *s != '\0' )
+                    {
+                      char* next;
+                      strtol( s, &next, 10 ); // texture coordinates are ignored
+                      s = next;
+                    }
+                  if ( *s == '/' )
+                    {
+                      ++s;
+                      if ( ! objIndex( s, (int) normals.size(), vn ) )
+                        return fail( "invalid normal index" );
+                    }
+                }
+              face_v.push_back( v );
+              face_n.push_back( vn );
+            }
+          if ( face_v.size() < 3 ) return fail( "a face needs at least 3 vertices" );
+          // A face without all its normals is flat.
+          bool flat = false;
+          for ( int vn : face_n ) flat = flat || vn < 0;
+          for ( size_t k = 1; k + 1 < face_v.size(); ++k )
+            if ( flat ) addTriangle( face_v[ 0 ], face_v[ k ], face_v[ k + 1 ] );
+            else addTriangle( face_v[ 0 ], face_v[ k ], face_v[ k + 1 ],
+                              face_n[ 0 ], face_n[ k ], face_n[ k + 1 ] );
+        }
+      // Other statements (vt, g, o, s, usemtl, comments...) are ignored.
+    }
+  if ( input.bad() ) return fail( "unable to read " + filename );
+  if ( triangles.empty() ) return fail( "no face in " + filename );
+  finalize();
+  return true;
+}
+
+rt::WatertightRay::WatertightRay( const Ray& ray )
+  : origin( ray.origin )
+{
+  const Vector3& d = ray.direction;
+  Real ax = std::fabs( d[ 0 ] ), ay = std::fabs( d[ 1 ] ), az = std::fabs( d[ 2 ] );
+  kz = ax > ay ? ( ax > az ? 0 : 2 ) : ( ay > az ? 1 : 2 );
+  kx = ( kz + 1 ) % 3;
+  ky = ( kx + 1 ) % 3;
+  // Keeps the winding of triangles.
+  if ( d[ kz ] < 0.0f ) std::swap( kx, ky );
+  sx = d[ kx ] / d[ kz ];
+  sy = d[ ky ] / d[ kz ];
+  sz = 1.0f / d[ kz ];
+}
+
+bool
+rt::WatertightRay::intersect( const Point3& a, const Point3& b, const Point3& c,
+                              Real tmin, Real tmax, Real& t ) const
+{
+  const Vector3 A = a - origin;
+  const Vector3 B = b - origin;
+  const Vector3 C = c - origin;
+  // Sheared coordinates: the ray is now the z axis.
+  const Real Ax = A[ kx ] - sx * A[ kz ], Ay = A[ ky ] - sy * A[ kz ];
+  const Real Bx = B[ kx ] - sx * B[ kz ], By = B[ ky ] - sy * B[ kz ];
+  const Real Cx = C[ kx ] - sx * C[ kz ], Cy = C[ ky ] - sy * C[ kz ];
+  // Scaled barycentric coordinates (edge functions).
+  Real U = Cx * By - Cy * Bx;
+  Real V = Ax * Cy - Ay * Cx;
+  Real W = Bx * Ay - By * Ax;
+  // On an edge, the sign is decided in double precision.
+  if ( U == 0.0f || V == 0.0f || W == 0.0f )
+    {
+      U = (Real)( (double) Cx * (double) By - (double) Cy * (double) Bx );
+      V = (Real)( (double) Ax * (double) Cy - (double) Ay * (double) Cx );
+      W = (Real)( (double) Bx * (double) Ay - (double) By * (double) Ax );
+    }
+  if ( ( U < 0.0f || V < 0.0f || W < 0.0f ) && ( U > 0.0f || V > 0.0f || W > 0.0f ) )
+    return false;
+  const Real det = U + V + W;
+  if ( det == 0.0f ) return false;
+  const Real T = U * sz * A[ kz ] + V * sz * B[ kz ] + W * sz * C[ kz ];
+  const Real x = T / det;
+  if ( ! ( x > tmin && x < tmax ) ) return false;
+  t = x;
+  return true;
+}
+
+#ifdef RT_HEADLESS
+void
+rt::TriangleMesh::draw( Viewer& /* viewer */ )
+{} // nothing to draw without OpenGL window.
+#else
+void
+rt::TriangleMesh::draw( Viewer& /* viewer */ )
+{
+  const MeshData& m = *ptrData;
+  glBegin( GL_TRIANGLES );
+  glColor4fv( material.ambient );
+  glMaterialfv(GL_FRONT, GL_DIFFUSE, material.diffuse);
+  glMaterialfv(GL_FRONT, GL_SPECULAR, material.specular);
+  glMaterialf(GL_FRONT, GL_SHININESS, material.shinyness );
+  for ( int i = 0; i < m.size(); ++i )
+    for ( int k = 0; k < 3; ++k )
+      {
+        Point3 p = m.vertices[ m.triangles[ 3 * i + k ] ];
+        glNormal3fv( getNormal( p, i ) );
+        glVertex3fv( p );
+      }
+  glEnd();
+}
+#endif
+
+rt::Vector3
+rt::TriangleMesh::getNormal( Point3 p, int part )
+{
+  Hit hit;
+  hit.point = p;
+  hit.part  = part;
+  surface( hit );
+  return hit.normal;
+}
+
+void
+rt::TriangleMesh::surface( Hit& hit )
+{
+  const MeshData& m  = *ptrData;
+  const int*      v  = &m.triangles[ 3 * hit.part ];
+  const int*      vn = &m.corner_normals[ 3 * hit.part ];
+  const Point3&   a  = m.vertices[ v[ 0 ] ];
+  const Vector3   e1 = m.vertices[ v[ 1 ] ] - a;
+  const Vector3   e2 = m.vertices[ v[ 2 ] ] - a;
+  Vector3         n  = e1.cross( e2 );
+  Real            l2 = n.dot( n );
+  hit.setMaterial( material );
+  hit.normal = hit.geometric_normal = l2 == 0.0f ? n : n / std::sqrt( l2 );
+  if ( l2 == 0.0f || vn[ 0 ] < 0 ) return;
+  // barycentric coordinates of the point, as ratios of areas.
+  const Vector3 ap = hit.point - a;
+  Real wb = ap.cross( e2 ).dot( n ) / l2;
+  Real wc = e1.cross( ap ).dot( n ) / l2;
+  Real wa = 1.0f - wb - wc;
+  Vector3 s = wa * m.normals[ vn[ 0 ] ] + wb * m.normals[ vn[ 1 ] ]
+    + wc * m.normals[ vn[ 2 ] ];
+  Real s2 = s.dot( s );
+  if ( s2 != 0.0f ) hit.normal = s / std::sqrt( s2 );
+}
+
+rt::Real
+rt::TriangleMesh::rayIntersection( const Ray& ray, Point3& p, int& part )
+{
+  Real tmax = std::numeric_limits<Real>::max();
+  if ( ! nextIntersection( ray, 0.0f, tmax, tmax, part ) ) return 1.0f;
+  p = ray.origin + ray.direction * tmax;
+  return -tmax;
+}
+
+bool
+rt::TriangleMesh::nextIntersection( const Ray& ray, Real tmin, Real tmax,
+                                    Real& t, int& part )
+{
+  const MeshData&     m  = *ptrData;
+  const WatertightRay wr( ray );
+  Real best     = tmax;
+  int  triangle = -1;
+  auto leaf = [&] ( int first, int count, Real& t_best ) {
+    for ( int i = first, iE = first + count; i < iE; ++i )
+      {
+        const int* v = &m.triangles[ 3 * i ];
+        if ( wr.intersect( m.vertices[ v[ 0 ] ], m.vertices[ v[ 1 ] ], m.vertices[ v[ 2 ] ],
+                           tmin, t_best, t_best ) )
+          triangle = i;
+      }
+  };
+  m.bvh.traverseLeaves( ray, best, leaf );
+  if ( triangle < 0 ) return false;
+  t    = best;
+  part = triangle;
+  return true;
+}
+
+rt::BoundingBox
+rt::TriangleMesh::boundingBox() const
+{
+  return ptrData->bvh.empty() ? BoundingBox() : ptrData->bvh.data()[ 0 ].box;
+}
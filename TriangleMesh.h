@@ -0,0 +1,158 @@
+/**
+@file TriangleMesh.h
+@author JOL
+*/
+#pragma once
+#ifndef _TRIANGLE_MESH_H_
+#define _TRIANGLE_MESH_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "GraphicalObject.h"
+#include "BVH.h"
+
+/// Namespace RayTracer
+namespace rt {
+
+  /// The geometry of a triangle mesh: shared vertices and normals,
+  /// triangles given by indices, and the BVH of the triangles. It may
+  /// be shared by several TriangleMesh objects.
+  struct MeshData {
+    /// The vertices.
+    std::vector< Point3 >  vertices;
+    /// The normals at the vertices (unit vectors).
+    std::vector< Vector3 > normals;
+    /// The indices in vertices of the 3 corners of each triangle,
+    /// counterclockwise when seen from outside.
+    std::vector< int >     triangles;
+    /// The indices in normals of the normals at the 3 corners of each
+    /// triangle (-1 if the triangle is flat).
+    std::vector< int >     corner_normals;
+    /// The hierarchy over the triangles, which are stored in the order
+    /// of its leaves.
+    BVH                    bvh;
+
+    /// @return the number of triangles.
+    int size() const { return (int) triangles.size() / 3; }
+
+    /// Adds the triangle of vertices \a v0, \a v1, \a v2 and normals
+    /// \a n0, \a n1, \a n2 (indices, -1 for no normal).
+    void addTriangle( int v0, int v1, int v2, int n0 = -1, int n1 = -1, int n2 = -1 )
+    {
+      triangles.push_back( v0 ); triangles.push_back( v1 ); triangles.push_back( v2 );
+      corner_normals.push_back( n0 ); corner_normals.push_back( n1 );
+      corner_normals.push_back( n2 );
+    }
+
+    /// Must be called once all triangles are added. Gives smooth
+    /// normals to the mesh if it has none, builds the BVH and reorders
+    /// the triangles accordingly.
+    void finalize();
+
+    /// @return the bounding box of the \a i-th triangle.
+    BoundingBox boundingBox( int i ) const;
+
+    /// Reads the mesh from the Wavefront OBJ file \a filename. Only
+    /// vertices (v), normals (vn) and faces (f) are used; polygons are
+    /// cut into triangles. The file is read line by line, so that it
+    /// is never entirely in memory. Calls finalize().
+    /// @return 'false' in case of error, described in \a error as
+    /// "file:line: message".
+    bool readOBJ( const std::string& filename, std::string& error );
+  };
+
+  /// A ray prepared for the watertight ray-triangle test of Woo,
+  /// Benthin and Wald ("Watertight ray/triangle intersection", JCGT
+  /// 2013): coordinates are permuted so that z is the largest
+  /// component of the direction, which is then sheared to (0,0,1).
+  /// Edges shared by two triangles are then tested consistently, so
+  /// that rays never slip between them.
+  struct WatertightRay {
+    Point3 origin;
+    int    kx, ky, kz;
+    Real   sx, sy, sz;
+
+    WatertightRay( const Ray& ray );
+
+    /// Intersects the triangle \a a, \a b, \a c.
+    /// @param[out] t the distance of the hit, if any.
+    /// @return 'true' if the ray meets the triangle in ]tmin,tmax[.
+    bool intersect( const Point3& a, const Point3& b, const Point3& c,
+                    Real tmin, Real tmax, Real& t ) const;
+  };
+
+  /**
+  A mesh of triangles, which may have millions of them: triangles are
+  not graphical objects but parts of the mesh (see GraphicalObject),
+  numbered as in its MeshData. They are found with the BVH of the
+  mesh, and normals are interpolated between their corners.
+  */
+  struct TriangleMesh final : public GraphicalObject {
+
+    /// Creates a mesh of geometry \a data and material \a m.
+    TriangleMesh( std::shared_ptr< const MeshData > data, const Material& m )
+      : GraphicalObject(), ptrData( data ), material( m )
+    {}
+
+    /// Virtual destructor since object contains virtual methods.
+    virtual ~TriangleMesh() {}
+
+    /// @return the geometry of the mesh.
+    const MeshData& data() const { return *ptrData; }
+
+    // ---------------- GraphicalObject services ----------------------------
+  public:
+
+    /// Nothing to precompute.
+    void init( Viewer& /* viewer */ ) {}
+
+    /// Draws the triangles in the OpenGL window.
+    void draw( Viewer& viewer );
+
+    /// The methods without part answer for the first triangle; Scene
+    /// and Renderer use the methods with parts.
+    Vector3 getNormal( Point3 p ) { return getNormal( p, 0 ); }
+    Material getMaterial( Point3 /* p */ ) { return material; }
+    Real rayIntersection( const Ray& ray, Point3& p )
+    {
+      int part;
+      return rayIntersection( ray, p, part );
+    }
+    bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t )
+    {
+      int part;
+      return nextIntersection( ray, tmin, tmax, t, part );
+    }
+
+    /// @return the normal at point \a p of triangle \a part,
+    /// interpolated between the normals of its corners.
+    Vector3 getNormal( Point3 p, int part );
+
+    /// @return the material of the mesh.
+    Material getMaterial( Point3 /* p */, int /* part */ ) { return material; }
+
+    /// Gives the normal of the triangle and the interpolated one.
+    void surface( Hit& hit );
+
+    /// Closest hit among the triangles, found with the BVH.
+    /// @return -t if triangle \a part is hit at distance t, 1 otherwise.
+    Real rayIntersection( const Ray& ray, Point3& p, int& part );
+
+    /// First crossing of a triangle in ]tmin,tmax[.
+    bool nextIntersection( const Ray& ray, Real tmin, Real tmax, Real& t, int& part );
+
+    /// @return the box of the root of the BVH.
+    BoundingBox boundingBox() const;
+
+  private:
+    std::shared_ptr< const MeshData > ptrData;
+
+  public:
+    /// The material (global to the mesh).
+    Material material;
+  };
+
+} // namespace rt
+
+#endif // #define _TRIANGLE_MESH_H_
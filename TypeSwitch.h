@@ -0,0 +1,62 @@
+/**
+@file TypeSwitch.h
+@author JOL
+*/
+#pragma once
+#ifndef _TYPE_SWITCH_H_
+#define _TYPE_SWITCH_H_
+
+#include <typeinfo>
+
+/// Namespace RayTracer
+namespace rt {
+
+  /**
+  Dispatches objects seen through their base class \a Base to their
+  concrete type among \a Types, known at compile time. The functor
+  then receives a pointer to the concrete type, so that the calls it
+  makes are static and may be inlined, provided the types are final.
+  Objects of any other type are passed as \a Base and called through
+  their virtual methods, so that new types still work.
+
+  The index of the type of an object is computed once (e.g. when it
+  is added to the scene), then apply() costs a few comparisons.
+  */
+  template <typename Base, typename... Types>
+  struct TypeSwitch;
+
+  /// No more concrete types: the object is passed as its base class.
+  template <typename Base>
+  struct TypeSwitch< Base > {
+    /// Number of concrete types.
+    static const int SIZE = 0;
+
+    /// @return the index of the type of \a obj, SIZE if it is none of Types.
+    static int index( const Base& /* obj */ ) { return 0; }
+
+    /// Calls \a f( \a obj ) with \a obj cast to the type of index \a i.
+    template <typename Function>
+    static void apply( int /* i */, Base* obj, Function& f ) { f( obj ); }
+  };
+
+  template <typename Base, typename T, typename... Others>
+  struct TypeSwitch< Base, T, Others... > {
+    typedef TypeSwitch< Base, Others... > Next;
+    static const int SIZE = 1 + Next::SIZE;
+
+    static int index( const Base& obj )
+    {
+      return typeid( obj ) == typeid( T ) ? 0 : 1 + Next::index( obj );
+    }
+
+    template <typename Function>
+    static void apply( int i, Base* obj, Function& f )
+    {
+      if ( i == 0 ) f( static_cast< T* >( obj ) );
+      else Next::apply( i - 1, obj, f );
+    }
+  };
+
+} // namespace rt
+
+#endif // #define _TYPE_SWITCH_H_
@@ -8,19 +8,131 @@
 #include "Renderer.h"
 #include "Image2D.h"
 #include "Image2DWriter.h"
+#include "ProgressiveRenderer.h"
 
 using namespace std;
 
+/// @return the view of \a camera, rendered at the resolution of the
+/// window divided by \a divisor with rays of depth \a max_depth.
+static rt::ProgressiveRenderer::View
+viewOf( const qglviewer::Camera* camera, int divisor, int max_depth )
+{
+  rt::ProgressiveRenderer::View view;
+  int w = camera->screenWidth();
+  int h = camera->screenHeight();
+  qglviewer::Vec orig, dir;
+  camera->convertClickToLine( QPoint( 0,0 ), orig, dir );
+  view.origin = rt::Point3( orig );
+  view.dirUL  = rt::Vector3( dir );
+  camera->convertClickToLine( QPoint( w,0 ), orig, dir );
+  view.dirUR  = rt::Vector3( dir );
+  camera->convertClickToLine( QPoint( 0, h ), orig, dir );
+  view.dirLL  = rt::Vector3( dir );
+  camera->convertClickToLine( QPoint( w, h ), orig, dir );
+  view.dirLR  = rt::Vector3( dir );
+  view.width     = w / divisor;
+  view.height    = h / divisor;
+  view.max_depth = max_depth;
+  return view;
+}
+
+rt::Viewer::~Viewer()
+{
+  delete ptrProgressive;
+  if ( myOverlay != 0 )
+    { // the texture belongs to the context of the viewer.
+      makeCurrent();
+      glDeleteTextures( 1, &myOverlay );
+    }
+}
+
 // Draws a tetrahedron with 4 colors.
 void 
 rt::Viewer::draw()
 {
+  // Lights may not move while the scene is rendered.
+  bool lights_moved = ptrProgressive != 0 && ptrScene != 0 && ptrScene->lightsMoved();
+  if ( lights_moved ) ptrProgressive->stop();
   // Set up lights
   if ( ptrScene != 0 )
     ptrScene->light( *this );
   // Draw all objects
   if ( ptrScene != 0 )
     ptrScene->draw( *this );
+  // Draw the rendering over them
+  if ( ptrProgressive != 0 )
+    drawRendering( lights_moved );
+}
+
+void
+rt::Viewer::toggleRendering( int divisor )
+{
+  if ( ptrProgressive != 0 && divisor == myDivisor )
+    { // Back to the OpenGL display.
+      delete ptrProgressive;
+      ptrProgressive = 0;
+      stopAnimation();
+      update();
+      return;
+    }
+  if ( ptrProgressive == 0 ) ptrProgressive = new ProgressiveRenderer( *ptrScene );
+  myDivisor     = divisor;
+  myOverlayPass = -1;
+  ptrProgressive->start( viewOf( camera(), myDivisor, maxDepth ) );
+  // The animation displays the passes as soon as they are finished.
+  startAnimation();
+}
+
+void
+rt::Viewer::drawRendering( bool lights_moved )
+{
+  ProgressiveRenderer::View view = viewOf( camera(), myDivisor, maxDepth );
+  if ( lights_moved || view != ptrProgressive->view() )
+    { // The passes already rendered no longer match.
+      ptrProgressive->start( view );
+      myOverlayPass = -1;
+      if ( ! animationIsStarted() ) startAnimation();
+    }
+  Image2D<Color> image;
+  if ( ptrProgressive->latest( image, myOverlayPass ) )
+    {
+      std::vector< unsigned char > bytes( 3 * image.w() * image.h() );
+      Image2DWriter<Color>::quantize( (const float*) image.data(), (int) bytes.size(),
+                                      bytes.data() );
+      if ( myOverlay == 0 ) glGenTextures( 1, &myOverlay );
+      glBindTexture( GL_TEXTURE_2D, myOverlay );
+      glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+      glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, image.w(), image.h(), 0,
+                    GL_RGB, GL_UNSIGNED_BYTE, bytes.data() );
+      std::cout << "Pass " << myOverlayPass + 1 << "/" << ProgressiveRenderer::NB_PASSES
+                << " (" << image.w() << "x" << image.h() << ")" << std::endl;
+      if ( ptrProgressive->finished() )
+        {
+          ofstream output( "output.ppm", ios::binary );
+          Image2DWriter<Color>::write( image, output, false );
+          output.close();
+          stopAnimation();
+        }
+    }
+  if ( myOverlayPass < 0 ) return;
+  // The last pass covers the window, with coarse pixels if need be.
+  glPushAttrib( GL_ENABLE_BIT | GL_TEXTURE_BIT );
+  glDisable( GL_LIGHTING );
+  glDisable( GL_DEPTH_TEST );
+  glEnable( GL_TEXTURE_2D );
+  glBindTexture( GL_TEXTURE_2D, myOverlay );
+  glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
+  startScreenCoordinatesSystem();
+  glBegin( GL_QUADS );
+  glTexCoord2f( 0.0f, 0.0f ); glVertex2i( 0, 0 );
+  glTexCoord2f( 1.0f, 0.0f ); glVertex2i( width(), 0 );
+  glTexCoord2f( 1.0f, 1.0f ); glVertex2i( width(), height() );
+  glTexCoord2f( 0.0f, 1.0f ); glVertex2i( 0, height() );
+  glEnd();
+  stopScreenCoordinatesSystem();
+  glPopAttrib();
 }
 
 
@@ -31,9 +143,9 @@ rt::Viewer::init()
   restoreStateFromFile();
 
   // Add custom key description (see keyPressEvent).
-  setKeyDescription(Qt::Key_R, "Renders the scene with a ray-tracer (low resolution)");
-  setKeyDescription(Qt::SHIFT+Qt::Key_R, "Renders the scene with a ray-tracer (medium resolution)");
-  setKeyDescription(Qt::CTRL+Qt::Key_R, "Renders the scene with a ray-tracer (high resolution)");
+  setKeyDescription(Qt::Key_R, "Starts/stops rendering the scene with a ray-tracer (low resolution)");
+  setKeyDescription(Qt::SHIFT+Qt::Key_R, "Starts/stops rendering the scene with a ray-tracer (medium resolution)");
+  setKeyDescription(Qt::CTRL+Qt::Key_R, "Starts/stops rendering the scene with a ray-tracer (high resolution)");
   setKeyDescription(Qt::Key_D, "Augments the max depth of ray-tracing algorithm");
   setKeyDescription(Qt::SHIFT+Qt::Key_D, "Decreases the max depth of ray-tracing algorithm");
   
@@ -60,28 +172,11 @@ rt::Viewer::keyPressEvent(QKeyEvent *e)
   bool handled = false;
   if ((e->key()==Qt::Key_R) && ptrScene != 0 )
     {
-      int w = camera()->screenWidth();
-      int h = camera()->screenHeight();
-      Renderer renderer( *ptrScene );
-      qglviewer::Vec orig, dir;
-      camera()->convertClickToLine( QPoint( 0,0 ), orig, dir );
-      Vector3 origin( orig );
-      Vector3 dirUL( dir );
-      camera()->convertClickToLine( QPoint( w,0 ), orig, dir );
-      Vector3 dirUR( dir );
-      camera()->convertClickToLine( QPoint( 0, h ), orig, dir );
-      Vector3 dirLL( dir );
-      camera()->convertClickToLine( QPoint( w, h ), orig, dir );
-      Vector3 dirLR( dir );
-      renderer.setViewBox( origin, dirUL, dirUR, dirLL, dirLR );
-      if ( modifiers == Qt::ShiftModifier ) { w /= 2; h /= 2; }
-      else if ( modifiers == Qt::NoModifier ) { w /= 8; h /= 8; }
-      Image2D<Color> image( w, h );
-      renderer.setResolution( image.w(), image.h() );
-     renderer.render( image, maxDepth );
-      ofstream output( "output.ppm" );
-      Image2DWriter<Color>::write( image, output, true );
-      output.close();
+      // Rendered in the background, pass after pass, up to 5x5
+      // samples per pixel filtered into the image (see draw).
+      if ( modifiers == Qt::ShiftModifier )     toggleRendering( 2 );
+      else if ( modifiers == Qt::NoModifier )   toggleRendering( 8 );
+      else                                      toggleRendering( 1 );
       handled = true;
     }
   if (e->key()==Qt::Key_D)
@@ -91,6 +186,7 @@ rt::Viewer::keyPressEvent(QKeyEvent *e)
       if ( modifiers == Qt::NoModifier )
         { maxDepth = std::min( 20, maxDepth + 1 ); handled = true; }
       std::cout << "Max depth is " << maxDepth << std::endl; 
+      update(); // restarts the rendering, if any
     }
     
   if (!handled) QGLViewer::keyPressEvent(e);
@@ -117,5 +213,9 @@ rt::Viewer::helpString() const
   text += "Press <b>R</b> to render the scene (low resolution).";
   text += "Press <b>Shift+R</b> to render the scene (medium resolution).";
   text += "Press <b>Ctrl+R</b> to render the scene (high resolution).";
+  text += "The rendering is refined in the background and displayed over the scene. ";
+  text += "It starts again when the camera, a light or the depth changes. ";
+  text += "Press the same key again to go back to the OpenGL display. ";
+  text += "The finished rendering is saved in output.ppm.";
   return text;
 }
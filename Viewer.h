@@ -14,6 +14,8 @@ namespace rt {
   
   /// Forward declaration of class Scene
   struct Scene;
+  /// Forward declaration of class ProgressiveRenderer
+  struct ProgressiveRenderer;
 
   /// This class displays the interface for placing the camera and the
   /// lights, and the user may call the renderer from it.
@@ -21,7 +23,11 @@ namespace rt {
   {
   public:
     /// Default constructor. Scene is empty.
-    Viewer() : QGLViewer(), ptrScene( 0 ), maxDepth( 6 ) {}
+    Viewer() : QGLViewer(), ptrScene( 0 ), maxDepth( 6 ),
+               ptrProgressive( 0 ), myDivisor( 0 ), myOverlay( 0 ), myOverlayPass( -1 ) {}
+
+    /// Destructor. Stops the rendering in progress.
+    ~Viewer();
     
     /// Sets the scene
     void setScene( rt::Scene& aScene )
@@ -49,12 +55,29 @@ namespace rt {
     virtual QString helpString() const;
     /// Celled when pressing a key.
     virtual void keyPressEvent(QKeyEvent *e);
-    
+
+    /// Starts the progressive rendering of the current view, whose
+    /// resolution is the one of the window divided by \a divisor, or
+    /// stops it if it is already running with this divisor.
+    void toggleRendering( int divisor );
+    /// Restarts the progressive rendering if the camera, a light or the
+    /// depth changed, and displays its last pass over the scene.
+    void drawRendering( bool lights_moved );
+
     /// Stores the scene
     rt::Scene* ptrScene;
 
     /// Maximum depth
     int maxDepth;
+
+    /// Renders the current view in the background (0 if not rendering).
+    rt::ProgressiveRenderer* ptrProgressive;
+    /// Resolution divisor of the rendering.
+    int myDivisor;
+    /// Texture holding the last displayed pass (0 if none yet).
+    GLuint myOverlay;
+    /// Number of the last displayed pass (-1 if none).
+    int myOverlayPass;
   };
 }
 
@@ -0,0 +1,218 @@
+/**
+@file ray-tracer-batch.cpp
+@author JOL
+
+Command-line renderer. It is compiled with RT_HEADLESS defined, so it
+links neither Qt nor QGLViewer and needs no X server nor OpenGL
+context (see target ray-tracer-batch in ray-tracer.pro).
+*/
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include "Scene.h"
+#include "Scenes.h"
+#include "SceneFile.h"
+#include "Camera.h"
+#include "Renderer.h"
+#include "Image2D.h"
+#include "Image2DWriter.h"
+#include "ImageSink.h"
+
+using namespace std;
+using namespace rt;
+
+static void usage( const char* name )
+{
+  cerr << "Usage: " << name << " [options]" << endl
+       << "  -scene <name>     scene: bubbles, spheres, refraction or a scene file, text or binary (default bubbles)" << endl
+       << "  -o <file>         output image, PPM, or PFM or Radiance HDR if it ends with .pfm or .hdr (default output.ppm)" << endl
+       << "  -srgb             encodes the PPM image with the sRGB curve instead of linearly" << endl
+       << "  -size <w> <h>     resolution (default 320 200)" << endl
+       << "  -depth <d>        maximum depth of rays, at most " << RayStack::MAX_DEPTH << " (default 6)" << endl
+       << "  -rays <n>         maximum number of rays traced per sample (default: no limit)" << endl
+       << "  -cull <w>         culls reflected and refracted rays of weight below w (default 0: none)" << endl
+       << "  -roulette         keeps culled rays with probability weight / w instead (unbiased)" << endl
+       << "  -threads <n>      number of rendering threads (default: all cores)" << endl
+       << "  -kernel <name>    sphere kernel: auto, scalar, sse or avx2 (default auto)" << endl
+       << "  -samples <n>      n x n samples per pixel (default 1)" << endl
+       << "  -filter <name>    pixel filter: box, tent or gaussian (default box)" << endl
+       << "  -nopackets        trace camera rays one by one instead of by packets" << endl
+       << "  -wavefront        trace the rays of 64x64 tiles stage by stage" << endl
+       << "  -stats <file>     writes the statistics of the rendering as JSON (needs RT_STATS)" << endl
+       << "  -progress <fmt>   progress report: bar, json (one line per report on stderr) or none (default bar)" << endl
+       << "  -eye <x> <y> <z>  position of the camera" << endl
+       << "  -dir <x> <y> <z>  viewing direction of the camera" << endl
+       << "  -at <x> <y> <z>   point looked at by the camera (instead of -dir)" << endl
+       << "  -up <x> <y> <z>   up vector of the camera" << endl
+       << "  -fov <degrees>    vertical field of view (default 45)" << endl;
+}
+
+/// Reads 3 reals starting at argv[ i ].
+static Vector3 readVector( char** argv, int i )
+{
+  return Vector3( atof( argv[ i ] ), atof( argv[ i+1 ] ), atof( argv[ i+2 ] ) );
+}
+
+int main( int argc, char** argv )
+{
+  // The scene is created first, since a scene file may give the
+  // defaults of the other options.
+  string scene_name = "bubbles";
+  for ( int i = 1; i + 1 < argc; ++i )
+    if ( string( argv[ i ] ) == "-scene" ) scene_name = argv[ i + 1 ];
+  Scene         scene;
+  SceneSettings settings;
+  if ( ! makeScene( scene, scene_name ) )
+    {
+      string error;
+      if ( ! readScene( scene_name, scene, settings, error ) )
+        {
+          cerr << error << endl;
+          return 1;
+        }
+    }
+
+  string output_name = "output.ppm";
+  string stats_name;
+  int    width  = settings.width  > 0 ? settings.width  : 320;
+  int    height = settings.height > 0 ? settings.height : 200;
+  int    depth  = settings.depth >= 0 ? settings.depth  : 6;
+  int    nb_threads = 0;
+  int    ray_budget = 0;
+  double cull       = 0.0;
+  bool   roulette   = false;
+  bool   packets    = true;
+  bool   wavefront  = false;
+  bool   srgb       = false;
+  ProgressReporter::Format progress = ProgressReporter::BAR;
+  int    nb_samples = settings.samples > 0 ? settings.samples : 1;
+  PixelFilter filter = settings.filter;
+  Camera camera      = settings.camera;
+  Vector3 dir   = camera.direction;
+  Vector3 up    = camera.up;
+  bool    at    = false;
+  Point3  target;
+  for ( int i = 1; i < argc; ++i )
+    {
+      string opt = argv[ i ];
+      int    n   = argc - i - 1; // number of remaining arguments
+      if      ( opt == "-scene" && n >= 1 ) ++i; // already read
+      else if ( opt == "-o"     && n >= 1 ) output_name = argv[ ++i ];
+      else if ( opt == "-depth" && n >= 1 ) depth       = atoi( argv[ ++i ] );
+      else if ( opt == "-rays"  && n >= 1 ) ray_budget  = atoi( argv[ ++i ] );
+      else if ( opt == "-cull"  && n >= 1 ) cull        = atof( argv[ ++i ] );
+      else if ( opt == "-roulette" ) roulette = true;
+      else if ( opt == "-threads" && n >= 1 ) nb_threads = atoi( argv[ ++i ] );
+      else if ( opt == "-kernel" && n >= 1 )
+        {
+          if ( ! selectSphereKernel( argv[ ++i ] ) )
+            {
+              cerr << "Unknown or unsupported kernel " << argv[ i ] << endl;
+              return 1;
+            }
+        }
+      else if ( opt == "-nopackets" ) packets = false;
+      else if ( opt == "-wavefront" ) wavefront = true;
+      else if ( opt == "-srgb" ) srgb = true;
+      else if ( opt == "-stats" && n >= 1 ) stats_name = argv[ ++i ];
+      else if ( opt == "-progress" && n >= 1 )
+        {
+          bool ok;
+          progress = ProgressReporter::fromName( argv[ ++i ], ok );
+          if ( ! ok )
+            {
+              cerr << "Unknown progress format " << argv[ i ] << endl;
+              return 1;
+            }
+        }
+      else if ( opt == "-samples" && n >= 1 ) nb_samples = atoi( argv[ ++i ] );
+      else if ( opt == "-filter" && n >= 1 )
+        {
+          bool ok;
+          filter = PixelFilter::fromName( argv[ ++i ], ok );
+          if ( ! ok )
+            {
+              cerr << "Unknown filter " << argv[ i ] << endl;
+              return 1;
+            }
+        }
+      else if ( opt == "-fov"   && n >= 1 ) camera.fieldOfView = atof( argv[ ++i ] ) * M_PI / 180.0;
+      else if ( opt == "-size"  && n >= 2 )
+        {
+          width  = atoi( argv[ ++i ] );
+          height = atoi( argv[ ++i ] );
+        }
+      else if ( opt == "-eye" && n >= 3 ) { camera.position = readVector( argv, i+1 ); i += 3; }
+      else if ( opt == "-dir" && n >= 3 ) { dir = readVector( argv, i+1 ); at = false; i += 3; }
+      else if ( opt == "-at"  && n >= 3 ) { target = readVector( argv, i+1 ); at = true; i += 3; }
+      else if ( opt == "-up"  && n >= 3 ) { up  = readVector( argv, i+1 ); i += 3; }
+      else { usage( argv[ 0 ] ); return 1; }
+    }
+  if ( width < 2 || height < 2 || depth < 0 || depth > RayStack::MAX_DEPTH
+       || nb_threads < 0 || nb_samples < 1 || ray_budget < 0 || cull < 0.0 )
+    {
+      cerr << "Invalid resolution, depth, number of rays, threads, samples or culling weight." << endl;
+      return 1;
+    }
+  if ( ! stats_name.empty() && ! RenderStats::ENABLED )
+    {
+      cerr << "Statistics are not counted: compile with -DRT_STATS." << endl;
+      return 1;
+    }
+  if ( at ) camera.lookAt( target, up );
+  else      camera.setOrientation( dir, up );
+
+  // Renders it.
+  Renderer renderer( scene );
+  renderer.setThreads( nb_threads );
+  renderer.setPackets( packets );
+  renderer.setSupersampling( nb_samples, filter );
+  renderer.setRayBudget( ray_budget );
+  renderer.setCulling( cull, roulette );
+  renderer.setProgress( progress, progress == ProgressReporter::JSON ? cerr : cout );
+  if ( wavefront )
+    {
+      renderer.setWavefront( true );
+      renderer.setThreads( nb_threads, 64 );
+    }
+  Vector3 dirUL, dirUR, dirLL, dirLR;
+  camera.getViewBox( width, height, dirUL, dirUR, dirLL, dirLR );
+  renderer.setViewBox( camera.position, dirUL, dirUR, dirLL, dirLR );
+  renderer.setResolution( width, height );
+
+  // The image is written band by band while it is rendered.
+  ofstream output( output_name.c_str(), ios::binary );
+  if ( ! output.good() )
+    {
+      cerr << "Unable to open " << output_name << endl;
+      return 1;
+    }
+  bool pfm = output_name.size() >= 4
+    && output_name.compare( output_name.size() - 4, 4, ".pfm" ) == 0;
+  bool hdr = output_name.size() >= 4
+    && output_name.compare( output_name.size() - 4, 4, ".hdr" ) == 0;
+  ofstream stats;
+  if ( ! stats_name.empty() )
+    {
+      stats.open( stats_name.c_str() );
+      if ( ! stats.good() )
+        {
+          cerr << "Unable to open " << stats_name << endl;
+          return 1;
+        }
+      renderer.setStatsOutput( &stats );
+    }
+  PPMSink ppm( output, srgb );
+  PFMSink pfm_sink( output );
+  HDRSink hdr_sink( output );
+  ImageSink& sink = pfm ? (ImageSink&) pfm_sink : hdr ? (ImageSink&) hdr_sink : (ImageSink&) ppm;
+  if ( ! renderer.render( sink, depth ) )
+    {
+      cerr << "Error while writing " << output_name << endl;
+      return 1;
+    }
+  output.close();
+  return 0;
+}
@@ -0,0 +1,323 @@
+/**
+@file ray-tracer-bench.cpp
+@author JOL
+
+Micro-benchmarks of the hot paths of the ray tracer: vector and color
+arithmetic, sphere and scene intersection, illumination, shadows and
+refraction. Each benchmark is warmed up, then timed over several
+repetitions; the median time per operation is reported with its
+spread, and the throughput in rays per second for ray queries. Inputs
+are generated from a fixed seed, so that runs are comparable (see
+target ray-tracer-bench in ray-tracer.pro).
+*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "Scene.h"
+#include "Scenes.h"
+#include "Camera.h"
+#include "Renderer.h"
+
+using namespace std;
+using namespace rt;
+
+/// Options shared by all benchmarks.
+struct BenchOptions {
+  /// Number of timed repetitions.
+  int    repetitions = 15;
+  /// Minimal duration of one repetition, in seconds.
+  double min_time    = 0.02;
+  /// Only benchmarks whose name contains this string are run.
+  string filter;
+};
+
+static BenchOptions options;
+
+/// Prevents the compiler from optimizing away the benchmarked calls.
+static volatile Real sink;
+
+/// Times \a f, which performs \a ops operations (rays, dot products,
+/// ...) per call, and prints one line of results. The number of calls
+/// per repetition is calibrated during the warmup.
+template <typename Function>
+static void bench( const string& name, long ops, bool rays, Function f )
+{
+  typedef chrono::steady_clock Clock;
+  if ( name.find( options.filter ) == string::npos ) return;
+  // Warmup and calibration: doubles the number of calls until one
+  // repetition lasts long enough.
+  long calls = 1;
+  for ( ;; calls *= 2 )
+    {
+      auto   t0 = Clock::now();
+      for ( long i = 0; i < calls; ++i ) f();
+      double t  = chrono::duration<double>( Clock::now() - t0 ).count();
+      if ( t >= options.min_time ) break;
+    }
+  vector< double > ns;
+  for ( int r = 0; r < options.repetitions; ++r )
+    {
+      auto   t0 = Clock::now();
+      for ( long i = 0; i < calls; ++i ) f();
+      double t  = chrono::duration<double>( Clock::now() - t0 ).count();
+      ns.push_back( t * 1e9 / ( (double) calls * ops ) );
+    }
+  sort( ns.begin(), ns.end() );
+  double median = ns[ ns.size() / 2 ];
+  // Median absolute deviation, robust to the occasional preemption.
+  vector< double > dev;
+  for ( double x : ns ) dev.push_back( fabs( x - median ) );
+  sort( dev.begin(), dev.end() );
+  double mad = dev[ dev.size() / 2 ];
+  printf( "%-40s %10.2f ns/op  +- %5.1f%%  min %10.2f", name.c_str(),
+          median, 100.0 * mad / median, ns.front() );
+  if ( rays ) printf( "  %10.3f Mrays/s", 1e3 / median );
+  printf( "\n" );
+  fflush( stdout );
+}
+
+/// Uniform random reals in [lo,hi[, from a fully specified generator.
+struct Random {
+  mt19937 gen;
+  Random( unsigned int seed ) : gen( seed ) {}
+  Real operator()( Real lo, Real hi )
+  { return lo + ( hi - lo ) * (Real)( gen() >> 8 ) / 16777216.0f; }
+  Vector3 direction()
+  {
+    Vector3 d( (*this)( -1, 1 ), (*this)( -1, 1 ), (*this)( -1, 1 ) );
+    return d / d.norm();
+  }
+};
+
+/// The camera rays of a \a w x \a h image seen from the default camera.
+static vector< Ray > cameraRays( int w, int h )
+{
+  Camera  camera;
+  Vector3 dirUL, dirUR, dirLL, dirLR;
+  camera.getViewBox( w, h, dirUL, dirUR, dirLL, dirLR );
+  vector< Ray > rays;
+  for ( int y = 0; y < h; ++y )
+    {
+      Real    ty   = (Real) y / (Real)( h - 1 );
+      Vector3 dirL = ( 1.0f - ty ) * dirUL + ty * dirLL;
+      Vector3 dirR = ( 1.0f - ty ) * dirUR + ty * dirLR;
+      dirL /= dirL.norm();
+      dirR /= dirR.norm();
+      for ( int x = 0; x < w; ++x )
+        {
+          Real tx = (Real) x / (Real)( w - 1 );
+          rays.push_back( Ray( camera.position, ( 1.0f - tx ) * dirL + tx * dirR, 6 ) );
+        }
+    }
+  return rays;
+}
+
+/// A hit of a camera ray, input of the shading benchmarks.
+struct CameraHit {
+  Ray ray;
+  Hit hit;
+};
+
+static vector< CameraHit > cameraHits( Scene& scene, const vector< Ray >& rays )
+{
+  vector< CameraHit > hits;
+  for ( const Ray& ray : rays )
+    {
+      CameraHit h;
+      h.ray = ray;
+      if ( scene.rayIntersection( ray, h.hit ) < 0.0f ) hits.push_back( h );
+    }
+  return hits;
+}
+
+static void benchArithmetic()
+{
+  Random rnd( 1 );
+  const int N = 1024;
+  vector< Vector3 > u( N ), v( N );
+  vector< Color >   c( N ), d( N );
+  for ( int i = 0; i < N; ++i )
+    {
+      u[ i ] = Vector3( rnd( -1, 1 ), rnd( -1, 1 ), rnd( -1, 1 ) );
+      v[ i ] = Vector3( rnd( -1, 1 ), rnd( -1, 1 ), rnd( -1, 1 ) );
+      c[ i ] = Color( rnd( 0, 1 ), rnd( 0, 1 ), rnd( 0, 1 ) );
+      d[ i ] = Color( rnd( 0, 1 ), rnd( 0, 1 ), rnd( 0, 1 ) );
+    }
+  bench( "Vector3::dot", N, false, [&] () {
+      Real s = 0.0f;
+      for ( int i = 0; i < N; ++i ) s += u[ i ].dot( v[ i ] );
+      sink = s;
+    } );
+  bench( "Vector3::cross", N, false, [&] () {
+      Vector3 s;
+      for ( int i = 0; i < N; ++i ) s += u[ i ].cross( v[ i ] );
+      sink = s[ 0 ];
+    } );
+  bench( "Vector3 a*u+v", N, false, [&] () {
+      Vector3 s;
+      for ( int i = 0; i < N; ++i ) s += 0.5f * u[ i ] + v[ i ];
+      sink = s[ 0 ];
+    } );
+  bench( "Vector3::norm", N, false, [&] () {
+      Real s = 0.0f;
+      for ( int i = 0; i < N; ++i ) s += u[ i ].norm();
+      sink = s;
+    } );
+  bench( "Color c*d+e", N, false, [&] () {
+      Color s;
+      for ( int i = 0; i < N; ++i ) s += c[ i ] * d[ i ] + c[ i ] * 0.5f;
+      sink = s.r();
+    } );
+}
+
+static void benchSphere()
+{
+  Random rnd( 2 );
+  Sphere sphere( Point3( 0, 0, 0 ), 2.0f, Material::glass() );
+  const int N = 1024;
+  vector< Ray > rays;
+  // Half of the rays aim at the sphere, half are random.
+  for ( int i = 0; i < N; ++i )
+    {
+      Point3  o( rnd( -10, 10 ), rnd( -10, 10 ), rnd( -10, 10 ) );
+      Vector3 d = ( i % 2 ) ? rnd.direction()
+        : Vector3( rnd( -1, 1 ), rnd( -1, 1 ), rnd( -1, 1 ) ) - o;
+      rays.push_back( Ray( o, d / d.norm() ) );
+    }
+  bench( "Sphere::rayIntersection", N, true, [&] () {
+      Point3 p;
+      Real   s = 0.0f;
+      for ( const Ray& ray : rays ) s += sphere.rayIntersection( ray, p );
+      sink = s;
+    } );
+  // The same sphere as a mesh of 2 x 500 x 1000 triangles.
+  TriangleMesh mesh( makeSphereMesh( Point3( 0, 0, 0 ), 2.0f, 500, 1000 ),
+                     Material::glass() );
+  bench( "TriangleMesh::rayIntersection", N, true, [&] () {
+      Point3 p;
+      int    part;
+      Real   s = 0.0f;
+      for ( const Ray& ray : rays ) s += mesh.rayIntersection( ray, p, part );
+      sink = s;
+    } );
+}
+
+static void benchScene( const string& label, Scene& scene, const vector< Ray >& rays )
+{
+  const long N = rays.size();
+  bench( "Scene::rayIntersection " + label, N, true, [&] () {
+      GraphicalObject* obj = 0;
+      Point3 p;
+      Real   s = 0.0f;
+      for ( const Ray& ray : rays ) s += scene.rayIntersection( ray, obj, p );
+      sink = s;
+    } );
+  if ( ! scene.hasValidBVH() ) return;
+  bench( "Scene::rayIntersection(packet) " + label, N, true, [&] () {
+      RayPacket packet;
+      Hit       hit[ RayPacket::SIZE ];
+      Real      r[ RayPacket::SIZE ];
+      Real      s = 0.0f;
+      for ( long i = 0; i < N; i += RayPacket::SIZE )
+        {
+          packet.nb = 0;
+          for ( long k = i; k < min( N, i + RayPacket::SIZE ); ++k )
+            packet.add( rays[ k ] );
+          scene.rayIntersection( packet, hit, r );
+          s += r[ 0 ];
+        }
+      sink = s;
+    } );
+}
+
+static void benchShading( const string& label, Scene& scene, const vector< CameraHit >& hits )
+{
+  Renderer renderer( scene );
+  const long N = hits.size();
+  if ( N == 0 ) return;
+  bench( "Renderer::illumination " + label, N, false, [&] () {
+      Real s = 0.0f;
+      for ( const CameraHit& h : hits ) s += renderer.illumination( h.ray, h.hit ).r();
+      sink = s;
+    } );
+  // One shadow ray per hit and per light.
+  vector< Ray >  shadow_rays;
+  vector< Real > distances;
+  vector< Color > colors;
+  for ( const CameraHit& h : hits )
+    for ( Light* light : scene.myLights )
+      {
+        const Point3& p = h.hit.point;
+        shadow_rays.push_back( Ray( p, light->direction( p ), 1 ) );
+        distances.push_back( light->distance( p ) );
+        colors.push_back( light->color( p ) );
+      }
+  bench( "Renderer::shadow " + label, shadow_rays.size(), true, [&] () {
+      Real s = 0.0f;
+      for ( size_t i = 0; i < shadow_rays.size(); ++i )
+        s += renderer.shadow( shadow_rays[ i ], colors[ i ], distances[ i ] ).r();
+      sink = s;
+    } );
+  bench( "Renderer::refractionRay " + label, N, true, [&] () {
+      Real s = 0.0f;
+      for ( const CameraHit& h : hits )
+        s += renderer.refractionRay( h.ray, h.hit.point, h.hit.normal,
+                                     h.hit.material() ).direction[ 0 ];
+      sink = s;
+    } );
+}
+
+static void usage( const char* name )
+{
+  fprintf( stderr, "Usage: %s [options]\n"
+           "  -filter <text>  only runs benchmarks whose name contains text\n"
+           "  -reps <n>       number of timed repetitions (default 15)\n"
+           "  -time <s>       minimal duration of a repetition (default 0.02)\n"
+           "  -kernel <name>  sphere kernel: auto, scalar, sse or avx2 (default auto)\n",
+           name );
+}
+
+int main( int argc, char** argv )
+{
+  for ( int i = 1; i < argc; ++i )
+    {
+      string opt = argv[ i ];
+      int    n   = argc - i - 1;
+      if      ( opt == "-filter" && n >= 1 ) options.filter      = argv[ ++i ];
+      else if ( opt == "-reps"   && n >= 1 ) options.repetitions = max( 1, atoi( argv[ ++i ] ) );
+      else if ( opt == "-time"   && n >= 1 ) options.min_time    = atof( argv[ ++i ] );
+      else if ( opt == "-kernel" && n >= 1 )
+        {
+          if ( ! selectSphereKernel( argv[ ++i ] ) )
+            {
+              fprintf( stderr, "Unknown or unsupported kernel %s\n", argv[ i ] );
+              return 1;
+            }
+        }
+      else { usage( argv[ 0 ] ); return 1; }
+    }
+  printf( "# sphere kernel: %s, %d repetitions, median (spread = median absolute deviation)\n",
+          sphereKernelName().c_str(), options.repetitions );
+  benchArithmetic();
+  benchSphere();
+
+  vector< Ray > rays = cameraRays( 160, 100 );
+  Scene bubbles;
+  makeBubbleScene( bubbles );
+  benchScene( "bubbles/linear", bubbles, rays );
+  bubbles.buildBVH();
+  benchScene( "bubbles", bubbles, rays );
+  benchShading( "bubbles", bubbles, cameraHits( bubbles, rays ) );
+
+  Scene spheres;
+  makeSpheresScene( spheres, 100000 );
+  spheres.buildBVH();
+  benchScene( "spheres", spheres, rays );
+  benchShading( "spheres", spheres, cameraHits( spheres, rays ) );
+  return 0;
+}
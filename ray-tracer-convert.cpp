@@ -0,0 +1,70 @@
+/**
+@file ray-tracer-convert.cpp
+@author JOL
+
+Converts a text scene file (see SceneReader), or a built-in scene, to
+the binary format of SceneFile, which is mapped in memory instead of
+being parsed when rendering (see target ray-tracer-convert in
+ray-tracer.pro).
+
+Typical use:
+  ./ray-tracer-convert big.scene big.rtscene
+  ./ray-tracer-batch -scene big.rtscene
+*/
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "Scene.h"
+#include "Scenes.h"
+#include "SceneFile.h"
+
+using namespace std;
+using namespace rt;
+
+static void usage( const char* name )
+{
+  cerr << "Usage: " << name << " [options] <input> <output>" << endl
+       << "  <input>   text scene file, or bubbles, spheres or refraction" << endl
+       << "  <output>  binary scene file" << endl
+       << "  -nobvh    does not store the BVH, which is then built when loading" << endl;
+}
+
+int main( int argc, char** argv )
+{
+  bool   with_bvh = true;
+  string names[ 2 ];
+  int    nb_names = 0;
+  for ( int i = 1; i < argc; ++i )
+    {
+      string opt = argv[ i ];
+      if ( opt == "-nobvh" ) with_bvh = false;
+      else if ( opt[ 0 ] != '-' && nb_names < 2 ) names[ nb_names++ ] = opt;
+      else { usage( argv[ 0 ] ); return 1; }
+    }
+  if ( nb_names != 2 ) { usage( argv[ 0 ] ); return 1; }
+
+  typedef chrono::steady_clock Clock;
+  auto          t0 = Clock::now();
+  Scene         scene;
+  SceneSettings settings;
+  string        error;
+  if ( ! makeScene( scene, names[ 0 ] )
+       && ! readScene( names[ 0 ], scene, settings, error ) )
+    {
+      cerr << error << endl;
+      return 1;
+    }
+  auto      t1 = Clock::now();
+  SceneFile file;
+  if ( ! file.write( names[ 1 ], scene, settings, with_bvh ) )
+    {
+      cerr << file.error() << endl;
+      return 1;
+    }
+  auto t2 = Clock::now();
+  cout << names[ 0 ] << ": " << scene.myObjects.size() << " objects read in "
+       << chrono::duration<double>( t1 - t0 ).count() << " s, "
+       << names[ 1 ] << " written in "
+       << chrono::duration<double>( t2 - t1 ).count() << " s" << endl;
+  return 0;
+}
@@ -0,0 +1,336 @@
+/**
+@file ray-tracer-regress.cpp
+@author JOL
+
+End-to-end performance regression harness. Renders a fixed set of
+canonical scenes at fixed resolutions and depths and writes, for each
+one, the wall time, the throughput, the peak resident memory, the
+PSNR against a stored reference image and, when compiled with
+RT_STATS, the number of traced rays to a JSON file. Each case is
+rendered in its own child process so that its peak memory is its own
+(see target ray-tracer-regress in ray-tracer.pro).
+
+Field "identical" is true if the image is the reference, false if it
+differs and null if it was not compared (no reference, or -update);
+"psnr_db" is then null too, as well as for identical images (JSON has
+no infinity).
+
+Each case is also rendered at a quarter of its resolution into the
+compact pixel formats of PixelFormats.h; "format_errors" gives their
+largest error against colors (relative to the largest channel for
+RGBE).
+
+A case fails, and so does the program, if its image differs from the
+reference by more than -max-diff in a channel or has a PSNR below
+-min-psnr, or if a compact format is less precise than it should
+(see FORMAT_BOUNDS).
+
+Typical use:
+  ./ray-tracer-regress -json results.json         # compare to regression/
+  ./ray-tracer-regress -update                    # store new references
+*/
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Scene.h"
+#include "Scenes.h"
+#include "Camera.h"
+#include "Renderer.h"
+#include "Image2D.h"
+#include "Image2DWriter.h"
+#include "PixelFormats.h"
+
+using namespace std;
+using namespace rt;
+
+/// A canonical rendering: scene, camera, resolution and depth.
+struct Case {
+  const char* name;
+  const char* scene;
+  int         width;
+  int         height;
+  int         depth;
+  int         samples;
+  /// Point looked at by the default camera.
+  Point3      target;
+};
+
+/// The canonical cases. Changing them invalidates the references.
+static const Case CASES[] = {
+  { "bubbles",    "bubbles",    320, 200,  6, 1, Point3( -5, 4, -1 ) },
+  { "spheres",    "spheres",    320, 200,  4, 1, Point3(  0, 0,  0 ) },
+  { "refraction", "refraction", 320, 200, 32, 1, Point3(  0, 0,  0 ) },
+};
+
+/// The compact pixel formats that are checked.
+enum Format { HALF, RGBE, SRGB, NB_FORMATS };
+static const char* FORMAT_NAMES[ NB_FORMATS ] = { "half", "rgbe", "srgb" };
+/// Largest error of each format: half a unit in the last place of a
+/// half float in [0,1], of an RGBE mantissa, and of an sRGB byte near
+/// 1 (where the curve is the steepest).
+static const double FORMAT_BOUNDS[ NB_FORMATS ] = { 2.5e-4, 4.0e-3, 4.5e-3 };
+
+/// Measurements of one case, filled by the child process.
+struct Result {
+  double seconds;
+  double psnr;       // in dB, < 0 if there is no reference
+  int    max_diff;   // largest difference of a channel with the reference
+  long   rays;       // number of rays traced, < 0 without RT_STATS
+  double format_errors[ NB_FORMATS ];
+  bool   ok;
+};
+
+/// Renders into an image of pixels \a TValue, with the settings of
+/// \a renderer, and compares it with \a colors, rendered the same.
+/// @return the largest error of a channel (divided by the largest
+/// channel of the pixel if \a relative is 'true').
+template <typename TValue>
+static double formatError( Renderer& renderer, const Image2D<Color>& colors, int depth,
+                           bool relative )
+{
+  Image2D<TValue> image;
+  Image2D<Color>  back;
+  renderer.render( image, depth );
+  convertImage( image, back );
+  double error = 0.0;
+  for ( int y = 0; y < colors.h(); ++y )
+    for ( int x = 0; x < colors.w(); ++x )
+      {
+        const Color a = colors.at( x, y ), b = back.at( x, y );
+        double e = max( fabs( a.r() - b.r() ), max( fabs( a.g() - b.g() ), fabs( a.b() - b.b() ) ) );
+        if ( relative ) e = a.max() > 0.0f ? e / a.max() : e;
+        error = max( error, e );
+      }
+  return error;
+}
+
+/// Reads a binary PPM (P6, 255) into \a bytes.
+/// @return 'false' if the file is missing or is not such an image.
+static bool readPPM( const string& name, int& w, int& h, vector< unsigned char >& bytes )
+{
+  ifstream input( name.c_str(), ios::binary );
+  string magic;
+  int    maxval = 0;
+  input >> magic;
+  // skips comments
+  while ( input >> ws && input.peek() == '#' )
+    {
+      string line;
+      getline( input, line );
+    }
+  input >> w >> h >> maxval;
+  if ( ! input.good() || magic != "P6" || maxval != 255 || w <= 0 || h <= 0 )
+    return false;
+  input.get(); // single whitespace before the pixels
+  bytes.resize( 3 * w * h );
+  input.read( (char*) bytes.data(), bytes.size() );
+  return input.good();
+}
+
+/// What a rendering may differ from its reference.
+struct Tolerance {
+  /// Largest difference of a channel, in levels.
+  int    max_diff;
+  /// Smallest PSNR, in dB.
+  double min_psnr;
+};
+
+/// Renders \a c and compares it with the reference in \a refdir (or
+/// replaces the reference if \a update is 'true'). The case is ok if
+/// it is within \a tolerance.
+static Result runCase( const Case& c, const string& refdir, bool update, int nb_threads,
+                       const Tolerance& tolerance )
+{
+  Result result{ 0.0, -1.0, -1, -1, { -1.0, -1.0, -1.0 }, false };
+  Scene scene;
+  makeScene( scene, c.scene );
+  Camera camera;
+  camera.lookAt( c.target, camera.up );
+  Renderer renderer( scene );
+  renderer.setThreads( nb_threads );
+  renderer.setProgress( ProgressReporter::NONE );
+  renderer.setSupersampling( c.samples );
+  Vector3 dirUL, dirUR, dirLL, dirLR;
+  camera.getViewBox( c.width, c.height, dirUL, dirUR, dirLL, dirLR );
+  renderer.setViewBox( camera.position, dirUL, dirUR, dirLL, dirLR );
+  renderer.setResolution( c.width, c.height );
+  Image2D<Color> image;
+  auto t0 = chrono::steady_clock::now();
+  scene.buildBVH();
+  renderer.render( image, c.depth );
+  result.seconds = chrono::duration<double>( chrono::steady_clock::now() - t0 ).count();
+  if ( RenderStats::ENABLED ) result.rays = renderer.stats().totalRays();
+
+  // Compact formats, at a quarter of the resolution.
+  Image2D<Color> colors;
+  camera.getViewBox( c.width / 4, c.height / 4, dirUL, dirUR, dirLL, dirLR );
+  renderer.setViewBox( camera.position, dirUL, dirUR, dirLL, dirLR );
+  renderer.setResolution( c.width / 4, c.height / 4 );
+  renderer.render( colors, c.depth );
+  result.format_errors[ HALF ] = formatError< HalfColor >( renderer, colors, c.depth, false );
+  result.format_errors[ RGBE ] = formatError< RGBEColor >( renderer, colors, c.depth, true );
+  result.format_errors[ SRGB ] = formatError< SRGBColor >( renderer, colors, c.depth, false );
+  bool formats_ok = true;
+  for ( int f = 0; f < NB_FORMATS; ++f )
+    formats_ok = formats_ok && result.format_errors[ f ] <= FORMAT_BOUNDS[ f ];
+
+  ostringstream ppm;
+  Image2DWriter<Color>::write( image, ppm, false );
+  const string reference = refdir + "/" + c.name + ".ppm";
+  if ( update )
+    {
+      ofstream output( reference.c_str(), ios::binary );
+      output << ppm.str();
+      result.ok = output.good() && formats_ok;
+      return result;
+    }
+  int w, h;
+  vector< unsigned char > ref, img;
+  if ( ! readPPM( reference, w, h, ref ) || w != c.width || h != c.height )
+    return result;
+  // Pixels are the last 3*w*h bytes of the rendered PPM.
+  const string& s = ppm.str();
+  img.assign( s.end() - ref.size(), s.end() );
+  double sse = 0.0;
+  result.max_diff = 0;
+  for ( size_t i = 0; i < ref.size(); ++i )
+    {
+      int d = abs( (int) img[ i ] - (int) ref[ i ] );
+      sse += d * d;
+      result.max_diff = max( result.max_diff, d );
+    }
+  double mse  = sse / ref.size();
+  result.psnr = mse == 0.0 ? INFINITY : 10.0 * log10( 255.0 * 255.0 / mse );
+  result.ok   = result.max_diff <= tolerance.max_diff && result.psnr >= tolerance.min_psnr
+    && formats_ok;
+  return result;
+}
+
+static void usage( const char* name )
+{
+  cerr << "Usage: " << name << " [options]" << endl
+       << "  -json <file>     output file (default regression.json)" << endl
+       << "  -refdir <dir>    directory of the reference images (default regression)" << endl
+       << "  -update          stores the rendered images as new references" << endl
+       << "  -case <name>     only runs this case (may be repeated)" << endl
+       << "  -max-diff <n>    largest difference of a channel with the reference (default 2)" << endl
+       << "  -min-psnr <dB>   smallest PSNR against the reference (default 50)" << endl
+       << "  -threads <n>     number of rendering threads (default: all cores)" << endl
+       << "  -kernel <name>   sphere kernel: auto, scalar, sse or avx2 (default auto)" << endl;
+}
+
+int main( int argc, char** argv )
+{
+  string json_name = "regression.json";
+  string refdir    = "regression";
+  bool   update    = false;
+  int    nb_threads = 0;
+  Tolerance tolerance{ 2, 50.0 };
+  vector< string > selected;
+  for ( int i = 1; i < argc; ++i )
+    {
+      string opt = argv[ i ];
+      int    n   = argc - i - 1;
+      if      ( opt == "-json"    && n >= 1 ) json_name = argv[ ++i ];
+      else if ( opt == "-refdir"  && n >= 1 ) refdir    = argv[ ++i ];
+      else if ( opt == "-update" )            update    = true;
+      else if ( opt == "-case"    && n >= 1 ) selected.push_back( argv[ ++i ] );
+      else if ( opt == "-threads" && n >= 1 ) nb_threads = atoi( argv[ ++i ] );
+      else if ( opt == "-max-diff" && n >= 1 ) tolerance.max_diff = atoi( argv[ ++i ] );
+      else if ( opt == "-min-psnr" && n >= 1 ) tolerance.min_psnr = atof( argv[ ++i ] );
+      else if ( opt == "-kernel"  && n >= 1 )
+        {
+          if ( ! selectSphereKernel( argv[ ++i ] ) )
+            {
+              cerr << "Unknown or unsupported kernel " << argv[ i ] << endl;
+              return 1;
+            }
+        }
+      else { usage( argv[ 0 ] ); return 1; }
+    }
+
+  Renderer renderer; // only tells the number of threads
+  renderer.setThreads( nb_threads );
+  ofstream json( json_name.c_str() );
+  json << "{\n"
+       << "  \"timestamp\": " << (long) time( 0 ) << ",\n"
+       << "  \"sphere_kernel\": \"" << sphereKernelName() << "\",\n"
+       << "  \"threads\": " << renderer.nbThreads() << ",\n"
+       << "  \"cases\": [";
+  bool first = true;
+  bool all_ok = true;
+  for ( const Case& c : CASES )
+    {
+      if ( ! selected.empty()
+           && find( selected.begin(), selected.end(), c.name ) == selected.end() )
+        continue;
+      // The case runs in a child process, which sends back its result
+      // through a pipe; its peak memory is given by wait4.
+      int fd[ 2 ];
+      cout.flush();
+      if ( pipe( fd ) != 0 ) { perror( "pipe" ); return 1; }
+      pid_t pid = fork();
+      if ( pid < 0 ) { perror( "fork" ); return 1; }
+      if ( pid == 0 )
+        {
+          close( fd[ 0 ] );
+          Result r = runCase( c, refdir, update, nb_threads, tolerance );
+          ssize_t written = write( fd[ 1 ], &r, sizeof( r ) );
+          cout.flush();
+          _exit( written == (ssize_t) sizeof( r ) ? 0 : 1 );
+        }
+      close( fd[ 1 ] );
+      Result r{ 0.0, -1.0, -1, -1, { -1.0, -1.0, -1.0 }, false };
+      bool   received = read( fd[ 0 ], &r, sizeof( r ) ) == (ssize_t) sizeof( r );
+      close( fd[ 0 ] );
+      int           status;
+      struct rusage usage;
+      wait4( pid, &status, 0, &usage );
+      r.ok = r.ok && received && WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+      all_ok = all_ok && r.ok;
+      const double primary_rays = (double) c.width * c.height * c.samples * c.samples;
+      json << ( first ? "\n" : ",\n" )
+           << "    {\n"
+           << "      \"name\": \"" << c.name << "\",\n"
+           << "      \"scene\": \"" << c.scene << "\",\n"
+           << "      \"width\": " << c.width << ",\n"
+           << "      \"height\": " << c.height << ",\n"
+           << "      \"depth\": " << c.depth << ",\n"
+           << "      \"samples\": " << c.samples << ",\n"
+           << "      \"ok\": " << ( r.ok ? "true" : "false" ) << ",\n"
+           << "      \"wall_time_s\": " << r.seconds << ",\n"
+           << "      \"primary_rays_per_s\": " << ( r.seconds > 0.0 ? primary_rays / r.seconds : 0.0 ) << ",\n"
+           << "      \"peak_rss_kb\": " << usage.ru_maxrss << ",\n";
+      if ( r.rays < 0 ) json << "      \"total_rays\": null,\n";
+      else json << "      \"total_rays\": " << r.rays << ",\n";
+      const bool compared = ! update && r.max_diff >= 0;
+      json << "      \"identical\": "
+           << ( ! compared ? "null" : r.max_diff == 0 ? "true" : "false" ) << ",\n";
+      // JSON has no infinity: identical images have a null PSNR.
+      if ( ! compared || std::isinf( r.psnr ) ) json << "      \"psnr_db\": null,\n";
+      else json << "      \"psnr_db\": " << r.psnr << ",\n";
+      json << "      \"format_errors\": {";
+      for ( int f = 0; f < NB_FORMATS; ++f )
+        json << ( f == 0 ? " \"" : ", \"" ) << FORMAT_NAMES[ f ] << "\": " << r.format_errors[ f ];
+      json << " },\n"
+           << "      \"max_abs_diff\": " << r.max_diff << "\n"
+           << "    }";
+      first = false;
+      cout << c.name << ": " << r.seconds << " s, "
+           << ( update ? "reference updated" : r.ok ? "compared" : "FAILED" ) << endl;
+    }
+  json << "\n  ]\n}\n";
+  return all_ok ? 0 : 1;
+}
@@ -12,10 +12,17 @@ QT     += opengl xml
 
 # Noms de vos fichiers entete
 HEADERS = Viewer.h PointVector.h Color.h Sphere.h GraphicalObject.h Light.h \
-          Material.h PointLight.h Image2D.h Image2DWriter.h Renderer.h Ray.h
+          Material.h PointLight.h Image2D.h Image2DWriter.h Renderer.h Ray.h \
+          Scene.h Scenes.h Camera.h Headless.h TileScheduler.h \
+          BoundingBox.h BVH.h SphereSet.h RayPacket.h \
+          PixelFilter.h ImageSink.h SceneReader.h SphereCloud.h SceneFile.h \
+          TriangleMesh.h Transform.h Instance.h Hit.h \
+          TypeSwitch.h ObjectGroup.h RayStack.h RayQueue.h RenderStats.h \
+          ProgressReporter.h ProgressiveRenderer.h GBuffer.h PixelFormats.h \
+          ParseReal.h
           
 # Noms de vos fichiers source
-SOURCES = Viewer.cpp ray-tracer.cpp Sphere.cpp 
+SOURCES = Viewer.cpp ray-tracer.cpp Sphere.cpp SphereSet.cpp TriangleMesh.cpp
 
 ###########################################################
 # Commentez/decommentez selon votre config/systeme
@@ -24,4 +31,50 @@ SOURCES = Viewer.cpp ray-tracer.cpp Sphere.cpp
 
 # Exemple de configuration Linux Ubuntu 16.04, Qt5 et libQGLViewer
 #INCLUDEPATH *= /usr/include
-LIBS += -L/usr/lib/x86_64-linux-gnu -lQGLViewer-qt5
\ No newline at end of file
+LIBS += -L/usr/lib/x86_64-linux-gnu -lQGLViewer-qt5
+
+###########################################################
+# Statistiques de rendu (RenderStats, option -stats) : decommentez ces
+# deux lignes pour compter rayons, tests et temps (rendu un peu plus lent).
+###########################################################
+# STATS_FLAGS = -DRT_STATS
+# DEFINES += RT_STATS
+
+###########################################################
+# Rendu en ligne de commande (make ray-tracer-batch)
+# Compile avec RT_HEADLESS : ni Qt, ni QGLViewer, ni OpenGL.
+###########################################################
+BATCH_SOURCES = ray-tracer-batch.cpp Sphere.cpp SphereSet.cpp TriangleMesh.cpp
+batch.target   = ray-tracer-batch
+batch.depends  = $$BATCH_SOURCES $$HEADERS
+batch.commands = $(CXX) -pipe -O2 -Wall -W -DRT_HEADLESS $$STATS_FLAGS -I. -o $$batch.target $$BATCH_SOURCES -pthread
+QMAKE_EXTRA_TARGETS += batch
+
+###########################################################
+# Micro-benchmarks (make ray-tracer-bench), sans Qt non plus.
+###########################################################
+BENCH_SOURCES = ray-tracer-bench.cpp Sphere.cpp SphereSet.cpp TriangleMesh.cpp
+bench.target   = ray-tracer-bench
+bench.depends  = $$BENCH_SOURCES $$HEADERS
+bench.commands = $(CXX) -pipe -O2 -Wall -W -DRT_HEADLESS $$STATS_FLAGS -I. -o $$bench.target $$BENCH_SOURCES -pthread
+QMAKE_EXTRA_TARGETS += bench
+
+###########################################################
+# Non-regression des performances (make ray-tracer-regress) :
+# scenes canoniques comparees aux images de regression/.
+###########################################################
+REGRESS_SOURCES = ray-tracer-regress.cpp Sphere.cpp SphereSet.cpp TriangleMesh.cpp
+regress.target   = ray-tracer-regress
+regress.depends  = $$REGRESS_SOURCES $$HEADERS
+regress.commands = $(CXX) -pipe -O2 -Wall -W -DRT_HEADLESS $$STATS_FLAGS -I. -o $$regress.target $$REGRESS_SOURCES -pthread
+QMAKE_EXTRA_TARGETS += regress
+
+###########################################################
+# Conversion des scenes texte en scenes binaires, chargees
+# par projection en memoire (make ray-tracer-convert).
+###########################################################
+CONVERT_SOURCES = ray-tracer-convert.cpp Sphere.cpp SphereSet.cpp TriangleMesh.cpp
+convert.target   = ray-tracer-convert
+convert.depends  = $$CONVERT_SOURCES $$HEADERS
+convert.commands = $(CXX) -pipe -O2 -Wall -W -DRT_HEADLESS $$STATS_FLAGS -I. -o $$convert.target $$CONVERT_SOURCES -pthread
+QMAKE_EXTRA_TARGETS += convert
@@ -1,5 +1,5 @@
 #include <iostream>
-#include "PointVecteur.h"
+#include "PointVector.h"
 
 using namespace std;
 using namespace rt;
@@ -8,7 +8,7 @@ bool testPointVecteur()
 {
   Point3 p = { 1.0, 0.0, 0.0 };
   cout << "p=" << p << endl;
-  Vecteur3 w = { 0.5, 3.0, 2.0 };
+  Vector3 w = { 0.5, 3.0, 2.0 };
   cout << "w=" << w << endl;
   cout << "p+w=" << p+w << endl;
   cout << "p-w=" << p-w << endl;
@@ -16,8 +16,8 @@ bool testPointVecteur()
   return true;
 }
 
-int main( int argc, char* argv[] )
+int main()
 {
   bool ok = testPointVecteur();
-  return ok;
+  return ok ? 0 : 1;
 }